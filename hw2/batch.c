@@ -0,0 +1,343 @@
+// Description: Batch mode: simulate many assembly programs in one process.
+// The programs (from a list file or every .assembly file of a directory) are split into one
+// contiguous range per worker. A worker runs its own range from the front and, once it is
+// empty, steals the back half of another worker's range. Each worker keeps its own program_t
+// and machine_t, so nothing but the ranges is shared. Results are printed in input order as
+// one CSV or JSON record per program. Error messages, including the loader's, go to stderr, and
+// so does a summary with the speedup over running the programs one after another: the summed
+// per-program times over the wall time.
+
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <pthread.h>
+#include "simpleISS.h"
+
+#define BATCH_SUFFIX ".assembly"
+
+struct batch_result_t {
+	int status; // 0 when the program loaded and ran
+	unsigned int count_executed_instructions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits_to_local_memory;
+	unsigned int count_memory_accesses;
+	double seconds; // load and run time
+};
+
+// Programs [head, tail) still to run by one worker
+struct batch_range_t {
+	pthread_mutex_t lock;
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct batch_job_t {
+	char ** paths;
+	unsigned int count_paths;
+	const struct memory_config_t * config;
+	void (*execute)(const struct program_t *, struct machine_t *);
+	struct batch_result_t * results;
+	struct batch_range_t * ranges;
+	unsigned int count_workers;
+};
+
+struct batch_worker_t {
+	struct batch_job_t * job;
+	unsigned int id;
+};
+
+// Path as a JSON string
+static void print_json_path(const char * path)
+{
+	putchar('"');
+	for(; *path != '\0'; path++) {
+		unsigned char c = *path;
+
+		if(c == '"' || c == '\\') {
+			printf("\\%c", c);
+		} else if(c < 0x20) {
+			printf("\\u%04x", c);
+		} else {
+			putchar(c);
+		}
+	}
+	putchar('"');
+}
+
+// Path as a CSV field, quoted when it holds a comma, a quote or a line break
+static void print_csv_path(const char * path)
+{
+	if(strpbrk(path, ",\"\r\n") == NULL) {
+		fputs(path, stdout);
+		return;
+	}
+	putchar('"');
+	for(; *path != '\0'; path++) {
+		if(*path == '"') {
+			putchar('"');
+		}
+		putchar(*path);
+	}
+	putchar('"');
+}
+
+static int compare_paths(const void * a, const void * b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int add_path(char *** paths, unsigned int * count, unsigned int * capacity, const char * directory, const char * name)
+{
+	size_t length = (directory != NULL ? strlen(directory) + 1 : 0) + strlen(name) + 1;
+	char * path = malloc(length);
+
+	if(*count == *capacity) {
+		unsigned int new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+		char ** grown = realloc(*paths, new_capacity * sizeof(**paths));
+
+		if(grown == NULL) {
+			free(path);
+			return -1;
+		}
+		*paths = grown;
+		*capacity = new_capacity;
+	}
+	if(path == NULL) {
+		return -1;
+	}
+	if(directory != NULL) {
+		snprintf(path, length, "%s/%s", directory, name);
+	} else {
+		snprintf(path, length, "%s", name);
+	}
+	(*paths)[(*count)++] = path;
+	return 0;
+}
+
+// Every .assembly file of a directory in name order, or one path per line of a list file
+static char ** batch_paths(const char * source, unsigned int * count)
+{
+	char ** paths = NULL;
+	unsigned int capacity = 0;
+	DIR * directory = opendir(source);
+	int status = 0;
+
+	*count = 0;
+	if(directory != NULL) {
+		struct dirent * entry;
+
+		while(status == 0 && (entry = readdir(directory)) != NULL) {
+			size_t length = strlen(entry->d_name);
+
+			if(length > strlen(BATCH_SUFFIX) && strcmp(entry->d_name + length - strlen(BATCH_SUFFIX), BATCH_SUFFIX) == 0) {
+				status = add_path(&paths, count, &capacity, source, entry->d_name);
+			}
+		}
+		closedir(directory);
+		if(status == 0) {
+			qsort(paths, *count, sizeof(*paths), compare_paths);
+		}
+	} else {
+		FILE * list = fopen(source, "r");
+		char line[4096];
+
+		if(list == NULL) {
+			fprintf(stderr, "Error: Could not open %s\n", source);
+			return NULL;
+		}
+		while(status == 0 && fgets(line, sizeof(line), list) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if(line[0] != '\0') {
+				status = add_path(&paths, count, &capacity, NULL, line);
+			}
+		}
+		fclose(list);
+	}
+	if(status != 0) {
+		fprintf(stderr, "Error: Out of memory listing programs\n");
+	}
+	if(status != 0 || *count == 0) {
+		while(*count > 0) {
+			free(paths[--*count]);
+		}
+		free(paths);
+		return NULL;
+	}
+	return paths;
+}
+
+// Take the next program of this worker's range, or steal the back half of another range
+static int batch_next(struct batch_job_t * job, unsigned int id, unsigned int * index)
+{
+	struct batch_range_t * own = &job->ranges[id];
+	unsigned int i;
+
+	pthread_mutex_lock(&own->lock);
+	if(own->head < own->tail) {
+		*index = own->head++;
+		pthread_mutex_unlock(&own->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	for(i = 1; i < job->count_workers; i++) {
+		struct batch_range_t * victim = &job->ranges[(id + i) % job->count_workers];
+		unsigned int head;
+		unsigned int tail;
+
+		pthread_mutex_lock(&victim->lock);
+		tail = victim->tail;
+		head = victim->head + (tail - victim->head) / 2;
+		if(head < tail) {
+			victim->tail = head;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if(head < tail) {
+			*index = head;
+			pthread_mutex_lock(&own->lock);
+			own->head = head + 1;
+			own->tail = tail;
+			pthread_mutex_unlock(&own->lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void * batch_worker(void * argument)
+{
+	struct batch_worker_t * worker = argument;
+	struct batch_job_t * job = worker->job;
+	struct program_t * prog = calloc(1, sizeof(*prog));
+	struct machine_t * m = malloc(sizeof(*m));
+	unsigned int index;
+
+	if(prog == NULL || m == NULL) {
+		fprintf(stderr, "Error: Out of memory allocating a batch worker\n");
+		free(prog);
+		free(m);
+		return NULL;
+	}
+	while(batch_next(job, worker->id, &index)) {
+		struct batch_result_t * result = &job->results[index];
+		double start = seconds_now();
+
+		result->status = -1;
+		if(load_program(job->paths[index], prog) == 0 && init_machine(m, job->config) == 0) {
+			job->execute(prog, m);
+			result->status = 0;
+			result->count_executed_instructions = m->count_executed_instructions;
+			result->count_clock_cycles = m->count_clock_cycles;
+			result->count_hits_to_local_memory = m->count_hits_to_local_memory;
+			result->count_memory_accesses = m->count_memory_accesses;
+			free_machine(m);
+		}
+		result->seconds = seconds_now() - start;
+	}
+	free_program(prog);
+	free(prog);
+	free(m);
+	return NULL;
+}
+
+int run_batch(const char * source, const struct memory_config_t * config,
+	void (*execute)(const struct program_t *, struct machine_t *), unsigned int count_threads, int json)
+{
+	struct batch_job_t job;
+	struct batch_worker_t * workers;
+	pthread_t * threads;
+	unsigned int count_started;
+	unsigned int i;
+	double serial = 0.0;
+	double start;
+	double wall;
+
+	job.paths = batch_paths(source, &job.count_paths);
+	if(job.paths == NULL) {
+		fprintf(stderr, "Error: No programs to run in %s\n", source);
+		return -1;
+	}
+	if(count_threads == 0) {
+		count_threads = default_thread_count();
+	}
+	if(count_threads > job.count_paths) {
+		count_threads = job.count_paths;
+	}
+	job.config = config;
+	job.execute = execute;
+	job.count_workers = count_threads;
+	job.results = calloc(job.count_paths, sizeof(*job.results));
+	job.ranges = malloc(count_threads * sizeof(*job.ranges));
+	workers = malloc(count_threads * sizeof(*workers));
+	threads = malloc(count_threads * sizeof(*threads));
+	if(job.results == NULL || job.ranges == NULL || workers == NULL || threads == NULL) {
+		fprintf(stderr, "Error: Out of memory allocating batch\n");
+		for(i = 0; i < job.count_paths; i++) {
+			free(job.paths[i]);
+		}
+		free(job.paths);
+		free(job.results);
+		free(job.ranges);
+		free(workers);
+		free(threads);
+		return -1;
+	}
+	for(i = 0; i < count_threads; i++) {
+		pthread_mutex_init(&job.ranges[i].lock, NULL);
+		job.ranges[i].head = (unsigned int) ((unsigned long long) job.count_paths * i / count_threads);
+		job.ranges[i].tail = (unsigned int) ((unsigned long long) job.count_paths * (i + 1) / count_threads);
+		workers[i].job = &job;
+		workers[i].id = i;
+	}
+
+	// The calling thread is worker 0
+	start = seconds_now();
+	for(count_started = 1; count_started < count_threads; count_started++) {
+		if(pthread_create(&threads[count_started], NULL, batch_worker, &workers[count_started]) != 0) {
+			break;
+		}
+	}
+	batch_worker(&workers[0]);
+	for(i = 1; i < count_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	wall = seconds_now() - start;
+
+	if(!json) {
+		printf("program,status,instructions,cycles,hits,accesses,seconds\n");
+	}
+	for(i = 0; i < job.count_paths; i++) {
+		const struct batch_result_t * result = &job.results[i];
+
+		serial += result->seconds;
+		if(json) {
+			printf("{\"program\": ");
+			print_json_path(job.paths[i]);
+			printf(", \"status\": \"%s\", \"instructions\": %u, \"cycles\": %u, \"hits\": %u, \"accesses\": %u, \"seconds\": %.6f}\n",
+				result->status == 0 ? "ok" : "error", result->count_executed_instructions, result->count_clock_cycles,
+				result->count_hits_to_local_memory, result->count_memory_accesses, result->seconds);
+		} else {
+			print_csv_path(job.paths[i]);
+			printf(",%s,%u,%u,%u,%u,%.6f\n", result->status == 0 ? "ok" : "error",
+				result->count_executed_instructions, result->count_clock_cycles,
+				result->count_hits_to_local_memory, result->count_memory_accesses, result->seconds);
+		}
+	}
+	// Kept off stdout so the records stay machine readable. The per-program times are measured
+	// in this process, so they leave out the process start-up a separate run would pay.
+	fprintf(stderr, "%u programs on %u threads in %.3f s, %.3f s of per-program time: speedup %.2fx over a serial run\n",
+		job.count_paths, count_started, wall, serial, wall > 0.0 ? serial / wall : 0.0);
+
+	for(i = 0; i < count_threads; i++) {
+		pthread_mutex_destroy(&job.ranges[i].lock);
+	}
+	for(i = 0; i < job.count_paths; i++) {
+		free(job.paths[i]);
+	}
+	free(job.paths);
+	free(job.results);
+	free(job.ranges);
+	free(workers);
+	free(threads);
+	return 0;
+}
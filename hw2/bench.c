@@ -0,0 +1,364 @@
+// Description: Throughput benchmark of the loaders and execution engines.
+// Every loader and engine is run a number of times on one program. The mean and 95% confidence
+// interval are reported per measure as CSV rows (program,measure,mean,ci95,unit,status), with
+// the peak resident memory of the process. A baseline file in the same format can be updated
+// with this program's rows, or compared against; a measure regresses when it is more than
+// BENCH_TOLERANCE worse and the confidence intervals do not overlap.
+
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <sys/resource.h>
+#include "simpleISS.h"
+
+#define BENCH_TOLERANCE 0.05
+#define BENCH_MAX_LINE 512
+
+struct bench_measure_t {
+	const char * name;
+	const char * unit; // "ms" lower is better, "MIPS" higher is better
+	double mean;
+	double ci95;
+};
+
+struct bench_engine_t {
+	const char * name;
+	void (*execute)(const struct program_t *, struct machine_t *);
+};
+
+static const struct bench_engine_t engines[] = {
+	{"engine_switch", execute_switch},
+	{"engine_threaded", execute_threaded},
+	{"engine_fused", execute_fused},
+	{"engine_jit", execute_jit},
+	{"engine_fastforward", execute_fast_forward},
+	{"engine_optimized", execute_optimized},
+};
+
+// Two-sided 95% Student t quantile for df degrees of freedom
+double t_quantile(unsigned int df)
+{
+	static const double table[] = {0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086};
+
+	return df < sizeof(table) / sizeof(table[0]) ? table[df] : 1.96;
+}
+
+static void summarize(const double * samples, unsigned int runs, struct bench_measure_t * measure)
+{
+	double sum = 0.0;
+	double squares = 0.0;
+	unsigned int i;
+
+	for(i = 0; i < runs; i++) {
+		sum += samples[i];
+	}
+	measure->mean = sum / runs;
+	for(i = 0; i < runs; i++) {
+		squares += (samples[i] - measure->mean) * (samples[i] - measure->mean);
+	}
+	measure->ci95 = runs > 1 ? t_quantile(runs - 1) * sqrt(squares / (runs - 1)) / sqrt(runs) : 0.0;
+}
+
+static int measure_loader(const char * path, int (*load)(const char *, struct program_t *), struct program_t * prog,
+	double * samples, unsigned int runs, struct bench_measure_t * measure)
+{
+	unsigned int i;
+
+	for(i = 0; i < runs; i++) {
+		double start = seconds_now();
+
+		if(load(path, prog) != 0) {
+			return -1;
+		}
+		samples[i] = (seconds_now() - start) * 1e3;
+	}
+	summarize(samples, runs, measure);
+	return 0;
+}
+
+static int measure_engine(const struct program_t * prog, const struct memory_config_t * config,
+	void (*execute)(const struct program_t *, struct machine_t *), double * samples, unsigned int runs, struct bench_measure_t * measure)
+{
+	struct machine_t * m = malloc(sizeof(*m));
+	unsigned int i;
+
+	if(m == NULL || init_machine(m, config) != 0) {
+		free(m);
+		return -1;
+	}
+	for(i = 0; i < runs; i++) {
+		double start;
+
+		reset_machine(m);
+		start = seconds_now();
+		execute(prog, m);
+		samples[i] = m->count_executed_instructions / (seconds_now() - start) / 1e6;
+	}
+	free_machine(m);
+	free(m);
+	summarize(samples, runs, measure);
+	return 0;
+}
+
+// Find program,measure in a baseline file; 1 and the baseline mean/ci95 when present
+static int baseline_lookup(const char * baseline, const char * program, const char * name, double * mean, double * ci95)
+{
+	FILE * fptr = baseline != NULL ? fopen(baseline, "r") : NULL;
+	char line[BENCH_MAX_LINE];
+	size_t program_length = strlen(program);
+	size_t name_length = strlen(name);
+	int found = 0;
+
+	if(fptr == NULL) {
+		return 0;
+	}
+	while(!found && fgets(line, sizeof(line), fptr) != NULL) {
+		if(strncmp(line, program, program_length) == 0 && line[program_length] == ','
+				&& strncmp(line + program_length + 1, name, name_length) == 0 && line[program_length + 1 + name_length] == ',') {
+			found = sscanf(line + program_length + name_length + 2, "%lf,%lf", mean, ci95) == 2;
+		}
+	}
+	fclose(fptr);
+	return found;
+}
+
+static const char * compare_measure(const char * baseline, const char * program, const struct bench_measure_t * measure)
+{
+	double mean;
+	double ci95;
+
+	if(!baseline_lookup(baseline, program, measure->name, &mean, &ci95)) {
+		return "new";
+	}
+	if(strcmp(measure->unit, "MIPS") == 0) {
+		if(measure->mean < mean * (1.0 - BENCH_TOLERANCE) && measure->mean + measure->ci95 < mean - ci95) {
+			return "regression";
+		}
+	} else if(measure->mean > mean * (1.0 + BENCH_TOLERANCE) && measure->mean - measure->ci95 > mean + ci95) {
+		return "regression";
+	}
+	return "ok";
+}
+
+// Rewrite the baseline with this program's rows replaced by the new measures
+static int save_baseline(const char * path, const char * program, const struct bench_measure_t * measures, unsigned int count)
+{
+	FILE * old = fopen(path, "r");
+	char * kept = NULL;
+	size_t kept_length = 0;
+	size_t program_length = strlen(program);
+	char line[BENCH_MAX_LINE];
+	FILE * fptr;
+	unsigned int i;
+
+	if(old != NULL) {
+		while(fgets(line, sizeof(line), old) != NULL) {
+			size_t length = strlen(line);
+			char * grown;
+
+			if(strncmp(line, program, program_length) == 0 && line[program_length] == ',') {
+				continue;
+			}
+			grown = realloc(kept, kept_length + length);
+			if(grown == NULL) {
+				free(kept);
+				fclose(old);
+				return -1;
+			}
+			kept = grown;
+			memcpy(kept + kept_length, line, length);
+			kept_length += length;
+		}
+		fclose(old);
+	}
+
+	fptr = fopen(path, "w");
+	if(fptr == NULL) {
+		printf("Error: Could not write baseline %s\n", path);
+		free(kept);
+		return -1;
+	}
+	if(kept_length > 0) {
+		fwrite(kept, 1, kept_length, fptr);
+	}
+	for(i = 0; i < count; i++) {
+		fprintf(fptr, "%s,%s,%.6f,%.6f,%s\n", program, measures[i].name, measures[i].mean, measures[i].ci95, measures[i].unit);
+	}
+	free(kept);
+	return fclose(fptr) == 0 ? 0 : -1;
+}
+
+int run_benchmark(const char * path, unsigned int runs, const struct memory_config_t * config, const char * baseline, const char * save)
+{
+	static struct program_t prog;
+	struct bench_measure_t measures[2 + sizeof(engines) / sizeof(engines[0]) + 1];
+	unsigned int count = 0;
+	unsigned int regressions = 0;
+	int status;
+	struct rusage usage;
+	double * samples;
+	unsigned int i;
+
+	if(runs == 0) {
+		runs = 1;
+	}
+	samples = malloc(runs * sizeof(*samples));
+	if(samples == NULL) {
+		printf("Error: Out of memory allocating benchmark\n");
+		return -1;
+	}
+
+	measures[count].name = "load_sscanf";
+	measures[count].unit = "ms";
+	status = measure_loader(path, load_program_sscanf, &prog, samples, runs, &measures[count++]);
+	measures[count].name = "load_scan";
+	measures[count].unit = "ms";
+	if(status == 0) {
+		status = measure_loader(path, load_program, &prog, samples, runs, &measures[count++]);
+	}
+	for(i = 0; status == 0 && i < sizeof(engines) / sizeof(engines[0]); i++) {
+		measures[count].name = engines[i].name;
+		measures[count].unit = "MIPS";
+		status = measure_engine(&prog, config, engines[i].execute, samples, runs, &measures[count++]);
+	}
+	if(status != 0) {
+		free(samples);
+		free_program(&prog);
+		return -1;
+	}
+
+	// Peak memory is reported, but not compared: it is too noisy to flag regressions on
+	getrusage(RUSAGE_SELF, &usage);
+	measures[count].name = "peak_rss";
+	measures[count].unit = "kB";
+	measures[count].mean = usage.ru_maxrss;
+	measures[count].ci95 = 0.0;
+
+	printf("program,measure,mean,ci95,unit,status\n");
+	for(i = 0; i < count; i++) {
+		const char * status = compare_measure(baseline, path, &measures[i]);
+
+		regressions += strcmp(status, "regression") == 0;
+		printf("%s,%s,%.3f,%.3f,%s,%s\n", path, measures[i].name, measures[i].mean, measures[i].ci95, measures[i].unit, status);
+	}
+	printf("%s,%s,%.0f,0,%s,-\n", path, measures[count].name, measures[count].mean, measures[count].unit);
+	++count;
+
+	free(samples);
+	free_program(&prog);
+	if(save != NULL && save_baseline(save, path, measures, count) != 0) {
+		return -1;
+	}
+	return regressions > 0 ? 1 : 0;
+}
+
+// What reset_cache cost before generations: every tag, stamp, dirty flag and PLRU word
+static void clear_cache_eagerly(struct cache_t * c)
+{
+	unsigned int lines = c->sets * c->ways;
+	unsigned int i;
+
+	for(i = 0; i < lines; i++) {
+		c->tags[i] = INVALID_TAG;
+	}
+	memset(c->stamps, 0, lines * sizeof(*c->stamps));
+	memset(c->plru, 0, c->sets * sizeof(*c->plru));
+	memset(c->dirty, 0, lines);
+	memset(c->valid, 0, (lines + 63) / 64 * sizeof(*c->valid));
+}
+
+// Average seconds of one call of step, repeated for at least BENCH_RESET_SECONDS
+#define BENCH_RESET_SECONDS 0.2
+
+static double time_repeated(void (*step)(const struct program_t *, struct machine_t *), const struct program_t * prog, struct machine_t * m)
+{
+	unsigned long long count = 0;
+	double start = seconds_now();
+	double elapsed;
+
+	do {
+		step(prog, m);
+		count++;
+	} while(count % 64 != 0 || (elapsed = seconds_now() - start) < BENCH_RESET_SECONDS);
+	return elapsed / count;
+}
+
+static void reset_only(const struct program_t * prog, struct machine_t * m)
+{
+	(void) prog;
+	reset_machine(m);
+}
+
+static void eager_clear(const struct program_t * prog, struct machine_t * m)
+{
+	(void) prog;
+	clear_cache_eagerly(&m->cache);
+}
+
+// One access to every address; after the first call they all hit in caches of 256 lines or more
+static void access_all(const struct program_t * prog, struct machine_t * m)
+{
+	unsigned int address;
+	int hit;
+
+	(void) prog;
+	for(address = 0; address < MAIN_MEMORY_SIZE; address++) {
+		m->count_clock_cycles += cache_access(&m->cache, address, address & 1, &hit);
+		m->count_hits_to_local_memory += hit;
+	}
+}
+
+static void reset_and_run(const struct program_t * prog, struct machine_t * m)
+{
+	reset_machine(m);
+	execute_switch(prog, m);
+}
+
+// Per-run reset cost for growing caches: reset_machine against clearing every line, and a
+// whole run of the program with its reset. The cost of one LD/ST going through the cache shows
+// what the hit path pays for it.
+int benchmark_reset(const char * path, const struct memory_config_t * config)
+{
+	static struct program_t prog;
+	struct memory_config_t sized = *config;
+	struct machine_t * m = malloc(sizeof(*m));
+	struct machine_t * scratch = malloc(sizeof(*scratch));
+	unsigned int size;
+	int status = 0;
+
+	if(m == NULL || scratch == NULL || load_program(path, &prog) != 0) {
+		free(m);
+		free(scratch);
+		return -1;
+	}
+	printf("Program: %s (%u instructions)\n", path, prog.count_instructions);
+	printf("cache_bytes,lines,reset_ns,eager_clear_ns,run_with_reset_us,access_ns\n");
+	for(size = sized.l1.line_size > 256 ? sized.l1.line_size : 256; size <= (1u << 22); size <<= 2) {
+		double reset;
+		double eager;
+		double run;
+		double access;
+
+		sized.l1.size = size;
+		if(init_machine(m, &sized) != 0) {
+			status = -1;
+			break;
+		}
+		if(init_machine(scratch, &sized) != 0) {
+			free_machine(m);
+			status = -1;
+			break;
+		}
+		reset = time_repeated(reset_only, &prog, m);
+		eager = time_repeated(eager_clear, &prog, scratch); // a separate cache, this one is left inconsistent
+		run = time_repeated(reset_and_run, &prog, m);
+		access = time_repeated(access_all, &prog, m) / MAIN_MEMORY_SIZE;
+		printf("%u,%u,%.1f,%.1f,%.3f,%.2f\n", size, m->cache.sets * m->cache.ways, reset * 1e9, eager * 1e9, run * 1e6, access * 1e9);
+		free_machine(m);
+		free_machine(scratch);
+	}
+	free(m);
+	free(scratch);
+	free_program(&prog);
+	return status;
+}
@@ -0,0 +1,426 @@
+// Description: Configuration, allocation and miss handling of the cache model.
+
+#include "simpleISS.h"
+
+void default_memory_config(struct memory_config_t * config)
+{
+	config->l1.size = LOCAL_MEMORY_SIZE;
+	config->l1.line_size = 1;
+	config->l1.associativity = 1;
+	config->l1.replacement = REPLACE_LRU;
+	config->l1.write = WRITE_BACK;
+	config->l1.hit_cycles = HIT_CYCLES;
+	config->l1.miss_cycles = MISS_CYCLES;
+	config->l1.write_cycles = MISS_CYCLES;
+
+	config->l2 = config->l1;
+	config->l2.size = 0;
+	config->l2.hit_cycles = L2_HIT_CYCLES;
+}
+
+// Value of a --name=<number> option, -1 if arg is not that option or, with *bad set, if the
+// value is not a non-negative number
+static long option_value(const char * arg, const char * name, int * bad)
+{
+	size_t length = strlen(name);
+	char * end;
+	long value;
+
+	if(strncmp(arg, name, length) != 0 || arg[length] != '=') {
+		return -1;
+	}
+	value = strtol(arg + length + 1, &end, 10);
+	if(*end != '\0' || value < 0) {
+		printf("Error: %s needs a non-negative number\n", name);
+		*bad = 1;
+		return -1;
+	}
+	return value;
+}
+
+int parse_cache_option(const char * arg, struct memory_config_t * memory)
+{
+	struct cache_config_t * config = &memory->l1;
+	long value;
+	int bad = 0;
+
+	if((value = option_value(arg, "--l2-size", &bad)) >= 0) {
+		memory->l2.size = value;
+	} else if((value = option_value(arg, "--l2-line-size", &bad)) >= 0) {
+		memory->l2.line_size = value;
+	} else if((value = option_value(arg, "--l2-assoc", &bad)) >= 0) {
+		memory->l2.associativity = value;
+	} else if((value = option_value(arg, "--l2-hit-cycles", &bad)) >= 0) {
+		memory->l2.hit_cycles = value;
+	} else if((value = option_value(arg, "--cache-size", &bad)) >= 0) {
+		config->size = value;
+	} else if((value = option_value(arg, "--line-size", &bad)) >= 0) {
+		config->line_size = value;
+	} else if((value = option_value(arg, "--assoc", &bad)) >= 0) {
+		config->associativity = value;
+	} else if((value = option_value(arg, "--hit-cycles", &bad)) >= 0) {
+		config->hit_cycles = value;
+	} else if((value = option_value(arg, "--miss-cycles", &bad)) >= 0) {
+		config->miss_cycles = value;
+	} else if((value = option_value(arg, "--write-cycles", &bad)) >= 0) {
+		config->write_cycles = value;
+	} else if(strcmp(arg, "--replacement=lru") == 0) {
+		config->replacement = REPLACE_LRU;
+	} else if(strcmp(arg, "--replacement=fifo") == 0) {
+		config->replacement = REPLACE_FIFO;
+	} else if(strcmp(arg, "--replacement=random") == 0) {
+		config->replacement = REPLACE_RANDOM;
+	} else if(strcmp(arg, "--replacement=plru") == 0) {
+		config->replacement = REPLACE_PLRU;
+	} else if(strcmp(arg, "--write-policy=wb") == 0) {
+		config->write = WRITE_BACK;
+	} else if(strcmp(arg, "--write-policy=wt") == 0) {
+		config->write = WRITE_THROUGH;
+	} else {
+		return bad ? -1 : 0;
+	}
+	return 1;
+}
+
+static int is_power_of_two(unsigned int n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+static unsigned int log2_of(unsigned int n)
+{
+	unsigned int shift = 0;
+
+	while((1u << shift) < n) {
+		++shift;
+	}
+	return shift;
+}
+
+int init_cache(struct cache_t * c, const struct cache_config_t * config)
+{
+	unsigned int lines;
+
+	memset(c, 0, sizeof(*c));
+	c->config = *config;
+	if(!is_power_of_two(config->size) || !is_power_of_two(config->line_size) || config->line_size > config->size) {
+		printf("Error: cache and line sizes must be powers of two, with the line no larger than the cache\n");
+		return -1;
+	}
+	lines = config->size / config->line_size;
+	c->ways = config->associativity == 0 ? lines : config->associativity;
+	if(!is_power_of_two(c->ways) || c->ways > lines) {
+		printf("Error: associativity must be a power of two no larger than the number of lines\n");
+		return -1;
+	}
+	// The PLRU tree of a set lives in one 32-bit word
+	if(config->replacement == REPLACE_PLRU && c->ways > 32) {
+		printf("Error: PLRU replacement supports at most 32 ways\n");
+		return -1;
+	}
+	c->sets = lines / c->ways;
+	c->line_shift = log2_of(config->line_size);
+	c->set_shift = log2_of(c->sets);
+	c->set_mask = c->sets - 1;
+	c->untagged = c->ways == 1 && c->sets * config->line_size >= MAIN_MEMORY_SIZE;
+
+	// Zeroed once here; a reset leaves all of these alone. Generation 0 words are stale.
+	c->tags = calloc(lines, sizeof(*c->tags));
+	c->stamps = calloc(lines, sizeof(*c->stamps));
+	c->plru = calloc(c->sets, sizeof(*c->plru));
+	c->dirty = calloc(lines, 1);
+	c->valid = calloc((lines + 63) / 64, sizeof(*c->valid));
+	c->valid_generations = calloc((lines + 63) / 64, sizeof(*c->valid_generations));
+	c->used_words = calloc((lines + 63) / 64, sizeof(*c->used_words));
+	if(c->tags == NULL || c->stamps == NULL || c->plru == NULL || c->dirty == NULL || c->valid == NULL
+			|| c->valid_generations == NULL || c->used_words == NULL) {
+		printf("Error: Out of memory allocating cache\n");
+		free_cache(c);
+		return -1;
+	}
+	reset_cache(c);
+	return 0;
+}
+
+// Only the words stamped since the last reset are cleared, whatever the cache size; the rest
+// of their state goes stale with the generation. After 2^32 resets generations could repeat,
+// so the stamps are cleared for real once.
+void reset_cache(struct cache_t * c)
+{
+	unsigned int i;
+
+	for(i = 0; i < c->count_used_words; i++) {
+		c->valid[c->used_words[i]] = 0;
+	}
+	c->count_used_words = 0;
+	if(++c->generation == 0) {
+		memset(c->valid_generations, 0, (c->sets * c->ways + 63) / 64 * sizeof(*c->valid_generations));
+		c->generation = 1;
+	}
+	c->clock = 0;
+	c->random = 2463534242u;
+	c->hits = 0;
+	c->misses = 0;
+	if(c->next != NULL) {
+		reset_cache(c->next);
+	}
+}
+
+void free_cache(struct cache_t * c)
+{
+	free(c->tags);
+	free(c->stamps);
+	free(c->plru);
+	free(c->dirty);
+	free(c->valid);
+	free(c->valid_generations);
+	free(c->used_words);
+	c->tags = NULL;
+	c->stamps = NULL;
+	c->plru = NULL;
+	c->dirty = NULL;
+	c->valid = NULL;
+	c->valid_generations = NULL;
+	c->used_words = NULL;
+}
+
+// Bring a word of the valid bitset into the current generation: the dirty flags of its lines
+// and the PLRU trees of the sets starting in it start over. Its valid bits are already zero.
+static void refresh_word(struct cache_t * c, unsigned int word)
+{
+	unsigned int lines = c->sets * c->ways;
+	unsigned int first = word * 64;
+	unsigned int count = lines - first < 64 ? lines - first : 64;
+
+	if(c->valid_generations[word] == c->generation) {
+		return;
+	}
+	memset(c->dirty + first, 0, count);
+	if(c->config.replacement == REPLACE_PLRU) {
+		// PLRU allows at most 32 ways, so a word holds whole sets
+		memset(c->plru + first / c->ways, 0, (count / c->ways) * sizeof(*c->plru));
+	}
+	c->valid_generations[word] = c->generation;
+	c->used_words[c->count_used_words++] = word;
+}
+
+void cache_set_valid(struct cache_t * c, unsigned int index, int valid)
+{
+	uint64_t bit = (uint64_t) 1 << (index & 63);
+
+	refresh_word(c, index >> 6);
+	if(valid) {
+		c->valid[index >> 6] |= bit;
+	} else {
+		c->valid[index >> 6] &= ~bit;
+		c->dirty[index] = 0;
+	}
+}
+
+void cache_refresh(struct cache_t * c, unsigned int count_lines)
+{
+	unsigned int lines = c->sets * c->ways;
+	unsigned int word;
+
+	if(count_lines > lines) {
+		count_lines = lines;
+	}
+	for(word = 0; word * 64 < count_lines; word++) {
+		refresh_word(c, word);
+	}
+}
+
+int init_hierarchy(struct cache_t * l1, struct cache_t * l2, const struct memory_config_t * config)
+{
+	struct cache_config_t l2_config = config->l2;
+
+	if(init_cache(l1, &config->l1) != 0) {
+		return -1;
+	}
+	memset(l2, 0, sizeof(*l2));
+	if(l2_config.size == 0) {
+		return 0;
+	}
+	l2_config.replacement = config->l1.replacement;
+	l2_config.write = config->l1.write;
+	l2_config.miss_cycles = config->l1.miss_cycles;
+	l2_config.write_cycles = config->l1.write_cycles;
+	if(init_cache(l2, &l2_config) != 0) {
+		free_cache(l1);
+		return -1;
+	}
+	l1->next = l2;
+	return 0;
+}
+
+// Way of set holding tag, ways when the line is not cached
+static unsigned int find_way(const struct cache_t * c, unsigned int set, unsigned int tag)
+{
+	const unsigned int * tags = c->tags + set * c->ways;
+	unsigned int way;
+
+	for(way = 0; way < c->ways && !(tags[way] == tag && cache_line_valid(c, set * c->ways + way)); way++) {
+	}
+	return way;
+}
+
+int cache_invalidate(struct cache_t * c, unsigned int address)
+{
+	unsigned int line = address >> c->line_shift;
+	unsigned int set = line & c->set_mask;
+	unsigned int way = find_way(c, set, line >> c->set_shift);
+	int dirty;
+
+	if(way == c->ways) {
+		return 0;
+	}
+	dirty = c->dirty[set * c->ways + way];
+	cache_set_valid(c, set * c->ways + way, 0);
+	return dirty;
+}
+
+int cache_clean(struct cache_t * c, unsigned int address)
+{
+	unsigned int line = address >> c->line_shift;
+	unsigned int set = line & c->set_mask;
+	unsigned int way = find_way(c, set, line >> c->set_shift);
+	int dirty;
+
+	if(way == c->ways) {
+		return 0;
+	}
+	dirty = c->dirty[set * c->ways + way];
+	c->dirty[set * c->ways + way] = 0;
+	return dirty;
+}
+
+int cache_is_flat(const struct cache_t * c)
+{
+	return c->ways == 1 && c->config.line_size == 1 && c->sets >= MAIN_MEMORY_SIZE && c->next == NULL;
+}
+
+// Tree pseudo-LRU: node bits point towards the half to replace next. A use flips
+// every node on the path to point away from the used way.
+void cache_touch(struct cache_t * c, unsigned int set, unsigned int way)
+{
+	if(c->config.replacement == REPLACE_LRU) {
+		c->stamps[set * c->ways + way] = ++c->clock;
+	} else if(c->config.replacement == REPLACE_PLRU) {
+		unsigned int bits = c->plru[set];
+		unsigned int node = 1;
+		unsigned int level;
+
+		for(level = c->ways >> 1; level > 0; level >>= 1) {
+			unsigned int right = (way & level) != 0;
+
+			if(right) {
+				bits &= ~(1u << node);
+			} else {
+				bits |= 1u << node;
+			}
+			node = 2 * node + right;
+		}
+		c->plru[set] = bits;
+	}
+}
+
+static unsigned int choose_victim(struct cache_t * c, unsigned int set)
+{
+	unsigned int * stamps = c->stamps + set * c->ways;
+	unsigned int victim = 0;
+	unsigned int way;
+
+	// Fill empty ways first
+	for(way = 0; way < c->ways; way++) {
+		if(!cache_line_valid(c, set * c->ways + way)) {
+			return way;
+		}
+	}
+
+	switch(c->config.replacement) {
+		case REPLACE_LRU:
+		case REPLACE_FIFO:
+			for(way = 1; way < c->ways; way++) {
+				if(stamps[way] < stamps[victim]) {
+					victim = way;
+				}
+			}
+			break;
+		case REPLACE_RANDOM:
+			c->random ^= c->random << 13;
+			c->random ^= c->random >> 17;
+			c->random ^= c->random << 5;
+			victim = c->random & (c->ways - 1);
+			break;
+		case REPLACE_PLRU: {
+			unsigned int node = 1;
+
+			while(node < c->ways) {
+				node = 2 * node + ((c->plru[set] >> node) & 1);
+			}
+			victim = node - c->ways;
+			break;
+		}
+	}
+	return victim;
+}
+
+// Pass an access on to the next level, counting its hits and misses there
+static unsigned int next_level_access(struct cache_t * next, unsigned int address, int is_store)
+{
+	int hit;
+	unsigned int cycles = cache_access(next, address, is_store, &hit);
+
+	next->hits += hit;
+	next->misses += !hit;
+	return cycles;
+}
+
+unsigned int cache_write_next(struct cache_t * c, unsigned int address)
+{
+	if(c->next == NULL) {
+		return c->config.write_cycles;
+	}
+	return next_level_access(c->next, address, 1);
+}
+
+unsigned int cache_fill(struct cache_t * c, unsigned int address, int is_store)
+{
+	unsigned int line = address >> c->line_shift;
+	unsigned int set = line & c->set_mask;
+	unsigned int tag = line >> c->set_shift;
+	unsigned int way;
+	unsigned int index;
+	unsigned int cycles;
+	unsigned int word;
+
+	// A pending reset is applied before the set is looked at, so an empty line is also clean.
+	// Only fully associative caches of more than 64 lines have sets spanning several words.
+	for(word = (set * c->ways) >> 6; word <= (set * c->ways + c->ways - 1) >> 6; word++) {
+		refresh_word(c, word);
+	}
+	way = choose_victim(c, set);
+	index = set * c->ways + way;
+	if(c->dirty[index]) {
+		cycles = cache_write_next(c, ((c->tags[index] << c->set_shift) | set) << c->line_shift);
+	} else {
+		cycles = 0;
+	}
+	if(c->next == NULL) {
+		cycles += c->config.miss_cycles;
+	} else {
+		cycles += next_level_access(c->next, address, 0);
+	}
+	if(is_store && c->config.write == WRITE_THROUGH) {
+		cycles += cache_write_next(c, address);
+	}
+	c->tags[index] = tag;
+	cache_set_valid(c, index, 1);
+	c->dirty[index] = is_store && c->config.write == WRITE_BACK;
+	if(c->config.replacement == REPLACE_FIFO) {
+		c->stamps[index] = ++c->clock;
+	} else {
+		cache_touch(c, set, way);
+	}
+	return cycles;
+}
@@ -0,0 +1,123 @@
+// Description: Configurable set-associative model of the local memory (cache).
+// The cache only tracks which lines are present; the data itself lives in the machine's
+// main memory array. The default configuration, 256 one-byte lines direct-mapped over the
+// 256-byte address space, behaves exactly like the original valid-bit array.
+// Caches can be chained: a level with a next level sends its misses, write-through stores
+// and dirty evictions there instead of charging the main memory latency.
+// Which lines are valid is a plain bitset in 64-line words, the only thing a hit reads besides
+// the tag, and all it reads in an untagged cache. Each word is stamped with the generation it was last brought up to date in, and the
+// words stamped in the current generation are listed. A reset bumps the generation and zeroes
+// the bits of the listed words only, so it costs what the last run used, not the cache size.
+// The dirty flags and PLRU bits of a word from an older generation are cleared when the word
+// is next written. Tags, stamps and PLRU bits of invalid lines are stale and never read.
+#ifndef __CACHE__H
+#define __CACHE__H
+
+#include <stdint.h>
+
+#define INVALID_TAG 0xFFFFFFFFu
+
+enum replacement_policy {REPLACE_LRU, REPLACE_FIFO, REPLACE_RANDOM, REPLACE_PLRU};
+enum write_policy {WRITE_BACK, WRITE_THROUGH};
+
+struct cache_config_t {
+	unsigned int size; // capacity in bytes
+	unsigned int line_size; // bytes per line
+	unsigned int associativity; // ways per set, 0 for fully associative
+	enum replacement_policy replacement;
+	enum write_policy write;
+	unsigned int hit_cycles; // cost of a LD/ST that hits
+	unsigned int miss_cycles; // cost of a LD/ST served by main memory
+	unsigned int write_cycles; // extra cost of a write-through store or a dirty eviction to main memory
+};
+
+// L1 -> L2 -> main memory. The L2 takes its replacement and write policies and the main
+// memory latencies from the L1 configuration.
+struct memory_config_t {
+	struct cache_config_t l1;
+	struct cache_config_t l2; // size 0 when there is no L2
+};
+
+struct cache_t {
+	struct cache_config_t config;
+	unsigned int sets;
+	unsigned int ways;
+	unsigned int line_shift; // log2(line_size)
+	unsigned int set_shift; // log2(sets)
+	unsigned int set_mask; // sets - 1
+	int untagged; // direct-mapped with a set per block of the address space: every tag is 0
+	unsigned int clock; // access counter for LRU/FIFO stamps
+	unsigned int random; // xorshift state for random replacement
+	unsigned int * tags; // sets * ways line tags, meaningful for valid lines only
+	uint64_t * valid; // bit per line, zero in every word not stamped with the current generation
+	unsigned int * valid_generations; // generation each word of valid was last brought up to date in
+	unsigned int * used_words; // words stamped with the current generation, cleared by reset_cache
+	unsigned int count_used_words;
+	unsigned int generation; // bumped by reset_cache
+	unsigned int * stamps; // LRU: last use, FIFO: fill time
+	unsigned int * plru; // tree bits per set
+	unsigned char * dirty; // write-back lines that differ from memory
+	struct cache_t * next; // next level, NULL when misses go to main memory
+	unsigned int hits; // fills and writes from the previous level, the L1 is counted by the machine
+	unsigned int misses;
+};
+
+void default_memory_config(struct memory_config_t * config); // Original 256 x 1-byte L1, 2/45 cycles, no L2
+int parse_cache_option(const char * arg, struct memory_config_t * config); // Apply a cache option, 1 if consumed, -1 for a bad value
+int init_cache(struct cache_t * c, const struct cache_config_t * config); // Allocate; -1 if the config is invalid
+int init_hierarchy(struct cache_t * l1, struct cache_t * l2, const struct memory_config_t * config); // Set up L1 and the optional L2
+void reset_cache(struct cache_t * c); // Invalidate every line, touching only the words the last run used
+void cache_set_valid(struct cache_t * c, unsigned int index, int valid); // Mark line index valid or invalid
+void cache_refresh(struct cache_t * c, unsigned int count_lines); // Apply a pending reset to lines [0, count_lines) now
+void free_cache(struct cache_t * c);
+unsigned int cache_fill(struct cache_t * c, unsigned int address, int is_store); // Miss path, returns the miss latency
+unsigned int cache_write_next(struct cache_t * c, unsigned int address); // Write a line to the next level, returns cycles
+void cache_touch(struct cache_t * c, unsigned int set, unsigned int way); // Record a use for LRU/PLRU
+int cache_invalidate(struct cache_t * c, unsigned int address); // Drop the line holding address, 1 if it was dirty
+int cache_clean(struct cache_t * c, unsigned int address); // Mark the line holding address clean, 1 if it was dirty
+int cache_is_flat(const struct cache_t * c); // Every address has its own line and nothing is ever evicted
+
+static inline int cache_line_valid(const struct cache_t * c, unsigned int index)
+{
+	return (c->valid[index >> 6] >> (index & 63)) & 1;
+}
+
+// Look up address and update the cache. Returns the access latency in cycles and sets *hit
+// to 1 on a hit, 0 on a miss.
+static inline unsigned int cache_access(struct cache_t * c, unsigned int address, int is_store, int * hit)
+{
+	unsigned int line = address >> c->line_shift;
+	unsigned int set = line & c->set_mask;
+	unsigned int tag = line >> c->set_shift;
+	unsigned int first = set * c->ways;
+	unsigned int * tags = c->tags + first;
+	unsigned int way;
+	unsigned int cycles;
+
+	if(c->untagged) {
+		way = cache_line_valid(c, set) ? 0 : 1;
+	} else {
+		for(way = 0; way < c->ways && !(tags[way] == tag && cache_line_valid(c, first + way)); way++) {
+		}
+	}
+	if(way == c->ways) {
+		*hit = 0;
+		return cache_fill(c, address, is_store);
+	}
+
+	cycles = c->config.hit_cycles;
+	if(is_store) {
+		if(c->config.write == WRITE_THROUGH) {
+			cycles += cache_write_next(c, address);
+		} else {
+			c->dirty[first + way] = 1;
+		}
+	}
+	if(c->ways > 1 && (c->config.replacement == REPLACE_LRU || c->config.replacement == REPLACE_PLRU)) {
+		cache_touch(c, set, way);
+	}
+	*hit = 1;
+	return cycles;
+}
+
+#endif
@@ -0,0 +1,287 @@
+// Description: Checkpoints of the complete simulator state.
+// A checkpoint is a fixed header followed by the machine state: registers, CMP_VAL, counters
+// and main memory, then each cache level as its clock, random state and hit/miss counters,
+// a valid bitmap and the tag, stamp and dirty flag of every valid line only, so a checkpoint
+// of a partly filled cache stays small. The header records the cache configuration the state
+// belongs to and a checksum of the program, so a checkpoint only restores into the program it
+// was taken from. Restoring costs one file read instead of re-running up to the same point.
+
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+#define CHECKPOINT_MAGIC "SISSCKP"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header_t {
+	char magic[8]; // CHECKPOINT_MAGIC
+	uint32_t version; // CHECKPOINT_VERSION
+	uint32_t program_checksum; // checksum of the instruction array
+	uint32_t count_instructions;
+	uint32_t first_address;
+	uint32_t index; // next instruction to execute
+	uint32_t payload_size;
+	uint32_t payload_checksum;
+	struct memory_config_t config; // hierarchy the cache state belongs to
+	uint32_t header_checksum; // checksum of all header fields above
+};
+
+// Bounds-checked cursor over the payload
+struct checkpoint_cursor_t {
+	unsigned char * data;
+	size_t length;
+	size_t capacity;
+	int overflow;
+};
+
+static void put(struct checkpoint_cursor_t * c, const void * value, size_t size)
+{
+	if(c->length + size > c->capacity) {
+		c->overflow = 1;
+		return;
+	}
+	memcpy(c->data + c->length, value, size);
+	c->length += size;
+}
+
+static void get(struct checkpoint_cursor_t * c, void * value, size_t size)
+{
+	if(c->length + size > c->capacity) {
+		c->overflow = 1;
+		memset(value, 0, size);
+		return;
+	}
+	memcpy(value, c->data + c->length, size);
+	c->length += size;
+}
+
+// Largest encoding of a cache level: every line valid
+static size_t cache_state_size(const struct cache_t * cache)
+{
+	size_t lines = (size_t) cache->sets * cache->ways;
+
+	return 4 * sizeof(uint32_t) + (lines + 7) / 8 + lines * (2 * sizeof(uint32_t) + 1) + cache->sets * sizeof(uint32_t);
+}
+
+static void put_cache(struct checkpoint_cursor_t * c, const struct cache_t * cache)
+{
+	unsigned int lines = cache->sets * cache->ways;
+	unsigned int i;
+
+	put(c, &cache->clock, sizeof(cache->clock));
+	put(c, &cache->random, sizeof(cache->random));
+	put(c, &cache->hits, sizeof(cache->hits));
+	put(c, &cache->misses, sizeof(cache->misses));
+	for(i = 0; i < lines; i += 8) {
+		unsigned char valid = 0;
+		unsigned int bit;
+
+		for(bit = 0; bit < 8 && i + bit < lines; bit++) {
+			valid |= cache_line_valid(cache, i + bit) << bit;
+		}
+		put(c, &valid, 1);
+	}
+	for(i = 0; i < lines; i++) {
+		if(cache_line_valid(cache, i)) {
+			put(c, &cache->tags[i], sizeof(cache->tags[i]));
+			put(c, &cache->stamps[i], sizeof(cache->stamps[i]));
+			put(c, &cache->dirty[i], 1);
+		}
+	}
+	if(cache->config.replacement == REPLACE_PLRU) {
+		put(c, cache->plru, cache->sets * sizeof(*cache->plru));
+	}
+}
+
+// cache must be freshly reset: lines missing from the bitmap stay invalid
+static void get_cache(struct checkpoint_cursor_t * c, struct cache_t * cache)
+{
+	unsigned int lines = cache->sets * cache->ways;
+	size_t bitmap;
+	unsigned int i;
+
+	get(c, &cache->clock, sizeof(cache->clock));
+	get(c, &cache->random, sizeof(cache->random));
+	get(c, &cache->hits, sizeof(cache->hits));
+	get(c, &cache->misses, sizeof(cache->misses));
+	bitmap = c->length;
+	c->length += (lines + 7) / 8;
+	if(c->length > c->capacity) {
+		c->overflow = 1;
+		return;
+	}
+	for(i = 0; i < lines && !c->overflow; i++) {
+		if(c->data[bitmap + i / 8] & (1 << (i % 8))) {
+			cache_set_valid(cache, i, 1);
+			get(c, &cache->tags[i], sizeof(cache->tags[i]));
+			get(c, &cache->stamps[i], sizeof(cache->stamps[i]));
+			get(c, &cache->dirty[i], 1);
+		}
+	}
+	if(cache->config.replacement == REPLACE_PLRU) {
+		get(c, cache->plru, cache->sets * sizeof(*cache->plru));
+	}
+}
+
+static uint32_t header_checksum(const struct checkpoint_header_t * header)
+{
+	return checksum(header, offsetof(struct checkpoint_header_t, header_checksum), CHECKSUM_SEED);
+}
+
+unsigned int execute_until(const struct program_t * prog, struct machine_t * m, const struct checkpoint_trigger_t * trigger)
+{
+	unsigned int pc_index = trigger->has_pc ? trigger->pc - prog->first_address : prog->count_instructions;
+	unsigned int index = 0;
+
+	while(index < prog->count_instructions && index != pc_index
+			&& (trigger->count_instructions == 0 || m->count_executed_instructions < trigger->count_instructions)) {
+		index = step_instruction(prog, m, index);
+	}
+	return index;
+}
+
+// Write to a temporary file of its own and rename it, so neither a crash nor a concurrent writer
+// ever leaves a partial checkpoint
+int write_checkpoint(const char * path, const struct program_t * prog, const struct machine_t * m, unsigned int index)
+{
+	struct checkpoint_header_t header;
+	struct checkpoint_cursor_t payload;
+	size_t length = strlen(path);
+	char * temp = malloc(length + 8);
+	FILE * fptr = NULL;
+	int status = 0;
+	int fd;
+
+	memset(&payload, 0, sizeof(payload));
+	payload.capacity = sizeof(m->registers) + 1 + 4 * sizeof(uint32_t) + sizeof(m->memory) + cache_state_size(&m->cache)
+		+ (m->cache.next != NULL ? cache_state_size(&m->l2) : 0);
+	payload.data = malloc(payload.capacity);
+	if(temp == NULL || payload.data == NULL) {
+		printf("Error: Out of memory writing checkpoint\n");
+		free(temp);
+		free(payload.data);
+		return -1;
+	}
+	memcpy(temp, path, length);
+	memcpy(temp + length, ".XXXXXX", 8);
+
+	put(&payload, m->registers, sizeof(m->registers));
+	put(&payload, &m->CMP_VAL, 1);
+	put(&payload, &m->count_executed_instructions, sizeof(m->count_executed_instructions));
+	put(&payload, &m->count_clock_cycles, sizeof(m->count_clock_cycles));
+	put(&payload, &m->count_hits_to_local_memory, sizeof(m->count_hits_to_local_memory));
+	put(&payload, &m->count_memory_accesses, sizeof(m->count_memory_accesses));
+	put(&payload, m->memory, sizeof(m->memory));
+	put_cache(&payload, &m->cache);
+	if(m->cache.next != NULL) {
+		put_cache(&payload, &m->l2);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.version = CHECKPOINT_VERSION;
+	header.program_checksum = checksum(prog->instructions, (size_t) prog->count_instructions * sizeof(struct instruction_t), CHECKSUM_SEED);
+	header.count_instructions = prog->count_instructions;
+	header.first_address = prog->first_address;
+	header.index = index;
+	header.payload_size = payload.length;
+	header.payload_checksum = checksum(payload.data, payload.length, CHECKSUM_SEED);
+	header.config.l1 = m->cache.config;
+	header.config.l2 = m->l2.config; // size 0 without an L2
+	header.header_checksum = header_checksum(&header);
+
+	fd = mkstemp(temp);
+	if(fd >= 0) {
+		fchmod(fd, 0644); // mkstemp creates the file private to the user
+		fptr = fdopen(fd, "wb");
+		if(fptr == NULL) {
+			close(fd);
+		}
+	}
+	if(fptr == NULL
+			|| fwrite(&header, sizeof(header), 1, fptr) != 1
+			|| fwrite(payload.data, payload.length, 1, fptr) != 1) {
+		status = -1;
+	}
+	if(fptr != NULL && fclose(fptr) != 0) {
+		status = -1;
+	}
+	if(status == 0 && rename(temp, path) != 0) {
+		status = -1;
+	}
+	if(status != 0) {
+		printf("Error: Can't write checkpoint %s\n", path);
+		if(fd >= 0) {
+			remove(temp);
+		}
+	}
+	free(temp);
+	free(payload.data);
+	return status;
+}
+
+int read_checkpoint(const char * path, const struct program_t * prog, struct machine_t * m, unsigned int * index)
+{
+	struct checkpoint_header_t header;
+	struct checkpoint_cursor_t payload;
+	FILE * fptr = fopen(path, "rb");
+	long size;
+
+	if(fptr == NULL) {
+		printf("Error: Can't open checkpoint %s\n", path);
+		return -1;
+	}
+	memset(&payload, 0, sizeof(payload));
+	if(fread(&header, sizeof(header), 1, fptr) != 1
+			|| memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0
+			|| header.header_checksum != header_checksum(&header)
+			|| header.version != CHECKPOINT_VERSION
+			|| fseek(fptr, 0, SEEK_END) != 0
+			|| (size = ftell(fptr)) < 0
+			|| (size_t) size != sizeof(header) + header.payload_size
+			|| fseek(fptr, sizeof(header), SEEK_SET) != 0
+			|| (payload.data = malloc(header.payload_size + 1)) == NULL
+			|| fread(payload.data, 1, header.payload_size, fptr) != header.payload_size
+			|| header.payload_checksum != checksum(payload.data, header.payload_size, CHECKSUM_SEED)) {
+		printf("Error: %s is not a valid checkpoint\n", path);
+		fclose(fptr);
+		free(payload.data);
+		return -1;
+	}
+	fclose(fptr);
+	payload.capacity = header.payload_size;
+
+	if(header.count_instructions != prog->count_instructions || header.first_address != prog->first_address
+			|| header.program_checksum != checksum(prog->instructions, (size_t) prog->count_instructions * sizeof(struct instruction_t), CHECKSUM_SEED)
+			|| header.index > prog->count_instructions) {
+		printf("Error: checkpoint %s was taken from a different program\n", path);
+		free(payload.data);
+		return -1;
+	}
+	if(init_machine(m, &header.config) != 0) {
+		free(payload.data);
+		return -1;
+	}
+
+	get(&payload, m->registers, sizeof(m->registers));
+	get(&payload, &m->CMP_VAL, 1);
+	get(&payload, &m->count_executed_instructions, sizeof(m->count_executed_instructions));
+	get(&payload, &m->count_clock_cycles, sizeof(m->count_clock_cycles));
+	get(&payload, &m->count_hits_to_local_memory, sizeof(m->count_hits_to_local_memory));
+	get(&payload, &m->count_memory_accesses, sizeof(m->count_memory_accesses));
+	get(&payload, m->memory, sizeof(m->memory));
+	get_cache(&payload, &m->cache);
+	if(m->cache.next != NULL) {
+		get_cache(&payload, &m->l2);
+	}
+	free(payload.data);
+	if(payload.overflow || payload.length != payload.capacity) {
+		printf("Error: %s is not a valid checkpoint\n", path);
+		free_machine(m);
+		return -1;
+	}
+	*index = header.index;
+	return 0;
+}
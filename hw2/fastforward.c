@@ -0,0 +1,291 @@
+// Description: Step interpreter with analytic fast-forwarding of steady-state counted loops.
+// When a backward jump to a loop head is taken, two further iterations are recorded. The loop
+// is in a steady state when both took the same path with the same counter deltas, every LD/ST
+// hit at a fixed address, every ADD Rn, Rm source and every loaded value was the same in both,
+// and no access reached the L2. Each iteration then adds a fixed delta to every register, so
+// the first iteration in which a CMP changes its outcome follows in closed form from the CMP
+// operand deltas. Every iteration before that one is skipped at once: registers, counters,
+// stored bytes and the LRU stamps are advanced by the number of skipped iterations times
+// their per-iteration deltas, exactly as stepping through them would leave them. Hits do not
+// change tags, dirty bits, FIFO stamps or PLRU bits once an iteration has run, so the rest
+// of the cache needs no update.
+
+#include "simpleISS.h"
+
+#define FF_MAX_PATH 1024 // longest loop iteration considered, in executed instructions
+#define FF_MAX_ATTEMPTS 4 // failed attempts before a loop head is left alone
+
+// One executed instruction of a recorded iteration
+struct ff_step_t {
+	unsigned int index;
+	unsigned char a; // CMP first operand, ADD_REG source, LD/ST address
+	unsigned char b; // CMP second operand, LD loaded value, ST stored value
+	unsigned char hit; // LD/ST hit in local memory
+};
+
+// Machine state at a loop head
+struct ff_snapshot_t {
+	char registers[NO_REGISTERS];
+	unsigned char CMP_VAL;
+	unsigned int count_executed_instructions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits_to_local_memory;
+	unsigned int count_memory_accesses;
+	unsigned int l2_hits;
+	unsigned int l2_misses;
+	unsigned int clock;
+};
+
+static void take_snapshot(const struct machine_t * m, struct ff_snapshot_t * s)
+{
+	memcpy(s->registers, m->registers, sizeof(s->registers));
+	s->CMP_VAL = m->CMP_VAL;
+	s->count_executed_instructions = m->count_executed_instructions;
+	s->count_clock_cycles = m->count_clock_cycles;
+	s->count_hits_to_local_memory = m->count_hits_to_local_memory;
+	s->count_memory_accesses = m->count_memory_accesses;
+	s->l2_hits = m->l2.hits;
+	s->l2_misses = m->l2.misses;
+	s->clock = m->cache.clock;
+}
+
+// Operands that name a register must name a simulated one for the loop to be analyzed
+static int uses_valid_registers(const struct instruction_t * instr)
+{
+	switch(instr->operation) {
+		case MOV:
+		case ADD_NUM:
+			return (unsigned char) instr->operand1 < NO_REGISTERS;
+		case ADD_REG:
+		case CMP:
+		case LD:
+		case ST:
+			return (unsigned char) instr->operand1 < NO_REGISTERS && (unsigned char) instr->operand2 < NO_REGISTERS;
+	}
+	return 1;
+}
+
+// Step from head until control is back at head. Returns the iteration length, or 0 when the
+// loop was left, ran too long or used an invalid register; *index is where execution stands.
+static unsigned int record_iteration(const struct program_t * prog, struct machine_t * m, unsigned int head,
+	struct ff_step_t * steps, unsigned int * index)
+{
+	unsigned int length = 0;
+	int valid = 1;
+
+	*index = head;
+	do {
+		const struct instruction_t * instr = &prog->instructions[*index];
+		struct ff_step_t * step = &steps[length];
+		unsigned int hits = m->count_hits_to_local_memory;
+
+		valid &= uses_valid_registers(instr);
+		step->index = *index;
+		step->a = 0;
+		step->b = 0;
+		if(valid) {
+			switch(instr->operation) {
+				case CMP:
+					step->a = (unsigned char) m->registers[(unsigned char) instr->operand1];
+					step->b = (unsigned char) m->registers[(unsigned char) instr->operand2];
+					break;
+				case ADD_REG:
+					step->a = (unsigned char) m->registers[(unsigned char) instr->operand2];
+					break;
+				case LD:
+					step->a = (unsigned char) m->registers[(unsigned char) instr->operand2];
+					break;
+				case ST:
+					step->a = (unsigned char) m->registers[(unsigned char) instr->operand1];
+					step->b = (unsigned char) m->registers[(unsigned char) instr->operand2];
+					break;
+			}
+		}
+		*index = step_instruction(prog, m, *index);
+		if(valid && instr->operation == LD) {
+			step->b = (unsigned char) m->registers[(unsigned char) instr->operand1];
+		}
+		step->hit = m->count_hits_to_local_memory != hits;
+		++length;
+	} while(*index != head && *index < prog->count_instructions && length < FF_MAX_PATH);
+
+	return valid && *index == head ? length : 0;
+}
+
+// First iteration j >= 1 after the second recorded one in which this CMP flips, 0 for never
+static unsigned int first_flip(const struct ff_step_t * first, const struct ff_step_t * second)
+{
+	unsigned char difference = (unsigned char) (second->a - second->b);
+	unsigned char slope = (unsigned char) ((second->a - first->a) - (second->b - first->b));
+	unsigned int j;
+
+	if(slope == 0) {
+		return 0;
+	}
+	if(difference == 0) {
+		return 1;
+	}
+	// difference + j * slope wraps back to 0 within 256 iterations if it ever does
+	for(j = 1; j <= 256; j++) {
+		if((unsigned char) (difference + j * slope) == 0) {
+			return j;
+		}
+	}
+	return 0;
+}
+
+// Number of iterations after the second recorded one that repeat it exactly, 0 if the loop is
+// not in a steady state or never ends
+static unsigned int steady_iterations(const struct program_t * prog, const struct ff_snapshot_t * s0, const struct ff_snapshot_t * s1,
+	const struct ff_snapshot_t * s2, const struct ff_step_t * first, const struct ff_step_t * second, unsigned int length)
+{
+	unsigned int iterations = 0;
+	unsigned int i;
+
+	if(s1->count_executed_instructions - s0->count_executed_instructions != s2->count_executed_instructions - s1->count_executed_instructions
+			|| s1->count_clock_cycles - s0->count_clock_cycles != s2->count_clock_cycles - s1->count_clock_cycles
+			|| s1->count_hits_to_local_memory - s0->count_hits_to_local_memory != s2->count_hits_to_local_memory - s1->count_hits_to_local_memory
+			|| s1->count_memory_accesses - s0->count_memory_accesses != s2->count_memory_accesses - s1->count_memory_accesses
+			|| s2->l2_hits != s1->l2_hits || s2->l2_misses != s1->l2_misses
+			|| s1->CMP_VAL != s2->CMP_VAL) {
+		return 0;
+	}
+	for(i = 0; i < NO_REGISTERS; i++) {
+		if((unsigned char) (s1->registers[i] - s0->registers[i]) != (unsigned char) (s2->registers[i] - s1->registers[i])) {
+			return 0;
+		}
+	}
+
+	for(i = 0; i < length; i++) {
+		unsigned int flip;
+
+		if(first[i].index != second[i].index) {
+			return 0;
+		}
+		switch(prog->instructions[second[i].index].operation) {
+			case ADD_REG:
+				if(first[i].a != second[i].a) {
+					return 0;
+				}
+				break;
+			case LD:
+			case ST:
+				if(!first[i].hit || !second[i].hit || first[i].a != second[i].a
+						|| (prog->instructions[second[i].index].operation == LD && first[i].b != second[i].b)) {
+					return 0;
+				}
+				break;
+			case CMP:
+				flip = first_flip(&first[i], &second[i]);
+				if(flip != 0 && (iterations == 0 || flip - 1 < iterations)) {
+					iterations = flip - 1;
+					if(iterations == 0) {
+						return 0;
+					}
+				}
+				break;
+		}
+	}
+	return iterations;
+}
+
+// Advance the machine by iterations more repetitions of the second recorded iteration
+static void skip_iterations(const struct program_t * prog, struct machine_t * m, const struct ff_snapshot_t * s1,
+	const struct ff_snapshot_t * s2, const struct ff_step_t * first, const struct ff_step_t * second, unsigned int length, unsigned int iterations)
+{
+	struct cache_t * cache = &m->cache;
+	unsigned int clock_delta = s2->clock - s1->clock;
+	unsigned int i;
+
+	for(i = 0; i < NO_REGISTERS; i++) {
+		m->registers[i] = (char) (m->registers[i] + iterations * (unsigned char) (s2->registers[i] - s1->registers[i]));
+	}
+	m->count_executed_instructions += iterations * (s2->count_executed_instructions - s1->count_executed_instructions);
+	m->count_clock_cycles += iterations * (s2->count_clock_cycles - s1->count_clock_cycles);
+	m->count_hits_to_local_memory += iterations * (s2->count_hits_to_local_memory - s1->count_hits_to_local_memory);
+	m->count_memory_accesses += iterations * (s2->count_memory_accesses - s1->count_memory_accesses);
+
+	// Stores in path order, so the last store to an address wins as it would when stepping
+	for(i = 0; i < length; i++) {
+		if(prog->instructions[second[i].index].operation == ST) {
+			m->memory[second[i].a] = (char) (second[i].b + iterations * (unsigned char) (second[i].b - first[i].b));
+		}
+	}
+
+	// Lines used in the last iteration carry LRU stamps after s1->clock; they move on with the clock
+	if(clock_delta != 0) {
+		unsigned int lines = cache->sets * cache->ways;
+
+		for(i = 0; i < lines; i++) {
+			if(cache->stamps[i] > s1->clock) {
+				cache->stamps[i] += iterations * clock_delta;
+			}
+		}
+		cache->clock += iterations * clock_delta;
+	}
+}
+
+// Run the loop at head for two recorded iterations and skip ahead if it is in a steady state.
+// Returns the index execution continues at; *fast_forwarded tells whether anything was skipped.
+static unsigned int fast_forward_loop(const struct program_t * prog, struct machine_t * m, unsigned int head,
+	struct ff_step_t * first, struct ff_step_t * second, int * fast_forwarded)
+{
+	struct ff_snapshot_t s0;
+	struct ff_snapshot_t s1;
+	struct ff_snapshot_t s2;
+	unsigned int length;
+	unsigned int iterations;
+	unsigned int index;
+
+	*fast_forwarded = 0;
+	take_snapshot(m, &s0);
+	length = record_iteration(prog, m, head, first, &index);
+	if(length == 0) {
+		return index;
+	}
+	take_snapshot(m, &s1);
+	if(record_iteration(prog, m, head, second, &index) != length) {
+		return index;
+	}
+	take_snapshot(m, &s2);
+
+	iterations = steady_iterations(prog, &s0, &s1, &s2, first, second, length);
+	if(iterations > 0) {
+		skip_iterations(prog, m, &s1, &s2, first, second, length, iterations);
+		*fast_forwarded = 1;
+	}
+	return head;
+}
+
+void execute_fast_forward(const struct program_t * prog, struct machine_t * m)
+{
+	struct ff_step_t * first = malloc(2 * FF_MAX_PATH * sizeof(*first));
+	unsigned char * attempts = calloc(prog->count_instructions + 1, 1);
+	unsigned int index = 0;
+
+	if(first == NULL || attempts == NULL) {
+		printf("Error: Out of memory allocating loop fast-forwarding\n");
+		free(first);
+		free(attempts);
+		execute_switch(prog, m);
+		return;
+	}
+	while(index < prog->count_instructions) {
+		const struct instruction_t * instr = &prog->instructions[index];
+		unsigned int next = step_instruction(prog, m, index);
+
+		// A taken backward jump closes a loop iteration
+		if((instr->operation == JMP || instr->operation == JE) && next <= index && attempts[next] < FF_MAX_ATTEMPTS) {
+			int fast_forwarded;
+			unsigned int head = next;
+
+			next = fast_forward_loop(prog, m, head, first, first + FF_MAX_PATH, &fast_forwarded);
+			if(!fast_forwarded) {
+				++attempts[head];
+			}
+		}
+		index = next;
+	}
+	free(first);
+	free(attempts);
+}
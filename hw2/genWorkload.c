@@ -0,0 +1,138 @@
+// Description: Synthetic workload generator for simpleISS benchmarks.
+// Writes an assembly program made of counted loops nested --depth deep around a body of
+// straight-line code. The body holds --length instructions in total, of which about --ldst
+// percent are LD/ST. Each LD/ST is followed by a MOV of the next address, walking the address
+// register through --working-set bytes, so --ldst is at most 50. All other body instructions
+// are ADDs and MOVs on a data register.
+//
+// Registers: R1-R3 loop counters (innermost last), R4 loop limit scratch, R5 address, R6 data.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DEPTH 3
+#define BASE_ADDRESS 0
+
+struct workload_t {
+	unsigned int depth; // nested loops, 1..MAX_DEPTH
+	unsigned int trips; // iterations of every loop, 1..127
+	unsigned int ldst; // percent of body instructions that are LD/ST, 0..50
+	unsigned int working_set; // bytes touched by the LD/STs, 1..128
+	unsigned int length; // body instructions
+	unsigned int seed;
+};
+
+static unsigned int address = 1;
+
+static void emit(const char * format, int a, int b)
+{
+	printf("%u\t", address++);
+	printf(format, a, b);
+	printf("\n");
+}
+
+// xorshift, so the same seed gives the same program everywhere
+static unsigned int next_random(unsigned int * state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void usage(void)
+{
+	printf("Error: ./genWorkload [--depth=1..3] [--trips=1..127] [--ldst=0..50] [--working-set=1..128] [--length=<n>] [--seed=<n>]\n");
+	exit(-1);
+}
+
+static int option(const char * arg, const char * name, unsigned int * value)
+{
+	size_t length = strlen(name);
+	char * end;
+
+	if(strncmp(arg, name, length) != 0 || arg[length] != '=') {
+		return 0;
+	}
+	*value = (unsigned int) strtoul(arg + length + 1, &end, 10);
+	if(*end != '\0') {
+		usage();
+	}
+	return 1;
+}
+
+int main(int argc, char * argv[])
+{
+	struct workload_t w = {2, 100, 30, 64, 40, 1};
+	unsigned int count_ldst;
+	unsigned int count_other;
+	unsigned int stride;
+	unsigned int step = 0;
+	unsigned int state;
+	unsigned int loop_start[MAX_DEPTH];
+	unsigned int i;
+	int d;
+
+	for(i = 1; i < (unsigned int) argc; i++) {
+		if(!option(argv[i], "--depth", &w.depth) && !option(argv[i], "--trips", &w.trips)
+				&& !option(argv[i], "--ldst", &w.ldst) && !option(argv[i], "--working-set", &w.working_set)
+				&& !option(argv[i], "--length", &w.length) && !option(argv[i], "--seed", &w.seed)) {
+			usage();
+		}
+	}
+	if(w.depth < 1 || w.depth > MAX_DEPTH || w.trips < 1 || w.trips > 127 || w.ldst > 50
+			|| w.working_set < 1 || w.working_set > 128 || w.length < 1) {
+		usage();
+	}
+	state = w.seed == 0 ? 1 : w.seed;
+
+	// Spread the LD/ST addresses evenly over the working set
+	count_ldst = (w.length * w.ldst + 50) / 100;
+	if(2 * count_ldst > w.length) {
+		count_ldst = w.length / 2;
+	}
+	count_other = w.length - 2 * count_ldst;
+	stride = count_ldst > 1 ? w.working_set / count_ldst : 1;
+	if(stride == 0) {
+		stride = 1;
+	}
+
+	emit("MOV R6, %d", 0, 0);
+	for(d = 0; d < (int) w.depth; d++) {
+		emit("MOV R%d, 0", d + 1, 0);
+		loop_start[d] = address;
+	}
+	emit("MOV R5, %d", BASE_ADDRESS, 0);
+
+	// Place the LD/STs at random positions while keeping their count exact
+	while(count_ldst + count_other > 0) {
+		if(next_random(&state) % (count_ldst + count_other) < count_ldst) {
+			if(next_random(&state) & 1) {
+				emit("LD R6, [R5]", 0, 0);
+			} else {
+				emit("ST [R5], R6", 0, 0);
+			}
+			step = (step + stride) % w.working_set;
+			emit("MOV R5, %d", BASE_ADDRESS + (int) step, 0);
+			--count_ldst;
+		} else {
+			if(next_random(&state) & 1) {
+				emit("ADD R6, %d", (int) (next_random(&state) % 7) + 1, 0);
+			} else {
+				emit("MOV R6, %d", (int) (next_random(&state) % 100), 0);
+			}
+			--count_other;
+		}
+	}
+
+	// Close the loops from the inside out: count, compare with the limit, exit or repeat
+	for(d = (int) w.depth - 1; d >= 0; d--) {
+		emit("ADD R%d, 1", d + 1, 0);
+		emit("MOV R4, %d", (int) w.trips, 0);
+		emit("CMP R%d, R4", d + 1, 0);
+		emit("JE %d", (int) address + 2, 0);
+		emit("JMP %d", (int) loop_start[d], 0);
+	}
+	return 0;
+}
@@ -0,0 +1,242 @@
+// Description: Binary program images.
+// An image is a fixed header followed by the decoded instruction array exactly as it sits in
+// memory, so loading is a single mmap: program_t points straight into the mapping. The header
+// records the format version, the instruction size and checksums of itself and the payload.
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+#define IMAGE_MAGIC "SISSIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_SUFFIX ".img"
+
+struct image_header_t {
+	char magic[8]; // IMAGE_MAGIC
+	uint32_t version; // IMAGE_VERSION
+	uint32_t instruction_size; // sizeof(struct instruction_t) of the writer
+	uint32_t count_instructions;
+	uint32_t first_address;
+	uint32_t payload_checksum; // checksum of the instruction array
+	uint32_t header_checksum; // checksum of all header fields above
+};
+
+// FNV-1a
+uint32_t checksum(const void * data, size_t size, uint32_t hash)
+{
+	const unsigned char * p = data;
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t header_checksum(const struct image_header_t * header)
+{
+	return checksum(header, offsetof(struct image_header_t, header_checksum), CHECKSUM_SEED);
+}
+
+int is_image_file(const char * path)
+{
+	char magic[sizeof(IMAGE_MAGIC)];
+	FILE * fptr = fopen(path, "rb");
+	int found;
+
+	if(fptr == NULL) {
+		return 0;
+	}
+	found = fread(magic, 1, sizeof(magic), fptr) == sizeof(magic) && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+	fclose(fptr);
+	return found;
+}
+
+// Write to a temporary file of its own next to path and rename it, so readers never see a
+// partial image and processes writing the same image at once don't share a temporary file
+int write_image(const char * path, const struct program_t * prog)
+{
+	struct image_header_t header;
+	size_t payload = (size_t) prog->count_instructions * sizeof(struct instruction_t);
+	size_t length = strlen(path);
+	char * temp = malloc(length + 8);
+	FILE * fptr = NULL;
+	int status = 0;
+	int fd;
+
+	if(temp == NULL) {
+		printf("Error: Out of memory writing image\n");
+		return -1;
+	}
+	memcpy(temp, path, length);
+	memcpy(temp + length, ".XXXXXX", 8);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	header.version = IMAGE_VERSION;
+	header.instruction_size = sizeof(struct instruction_t);
+	header.count_instructions = prog->count_instructions;
+	header.first_address = prog->first_address;
+	header.payload_checksum = checksum(prog->instructions, payload, CHECKSUM_SEED);
+	header.header_checksum = header_checksum(&header);
+
+	fd = mkstemp(temp);
+	if(fd >= 0) {
+		fchmod(fd, 0644); // mkstemp creates the file private to the user
+		fptr = fdopen(fd, "wb");
+		if(fptr == NULL) {
+			close(fd);
+		}
+	}
+	if(fptr == NULL
+			|| fwrite(&header, sizeof(header), 1, fptr) != 1
+			|| (payload > 0 && fwrite(prog->instructions, payload, 1, fptr) != 1)) {
+		status = -1;
+	}
+	if(fptr != NULL && fclose(fptr) != 0) {
+		status = -1;
+	}
+	if(status == 0 && rename(temp, path) != 0) {
+		status = -1;
+	}
+	if(status != 0) {
+		printf("Error: Can't write image %s\n", path);
+		if(fd >= 0) {
+			remove(temp);
+		}
+	}
+	free(temp);
+	return status;
+}
+
+static int valid_register(char r)
+{
+	return r >= 0 && r < NO_REGISTERS;
+}
+
+// The engines index their dispatch tables by operation and registers[] by operand without
+// checking, so a payload must hold only what the parser can produce
+static int valid_instructions(const struct instruction_t * instructions, unsigned int count)
+{
+	unsigned int i;
+
+	for(i = 0; i < count; i++) {
+		const struct instruction_t * instr = &instructions[i];
+
+		switch(instr->operation) {
+			case MOV:
+			case ADD_NUM:
+				if(!valid_register(instr->operand1)) {
+					return 0;
+				}
+				break;
+			case ADD_REG:
+			case CMP:
+			case LD:
+			case ST:
+				if(!valid_register(instr->operand1) || !valid_register(instr->operand2)) {
+					return 0;
+				}
+				break;
+			case JE:
+			case JMP:
+				break;
+			default:
+				return 0;
+		}
+	}
+	return 1;
+}
+
+// Returns 0 and fills prog on success, -1 if the file is missing, malformed or corrupt
+static int try_map_image(const char * path, struct program_t * prog)
+{
+	struct stat st;
+	const struct image_header_t * header;
+	unsigned char * mapping;
+	size_t payload;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		return -1;
+	}
+
+	header = (const struct image_header_t *) mapping;
+	payload = (size_t) header->count_instructions * sizeof(struct instruction_t);
+	if(memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0
+			|| header->header_checksum != header_checksum(header)
+			|| header->version != IMAGE_VERSION
+			|| header->instruction_size != sizeof(struct instruction_t)
+			|| (size_t) st.st_size != sizeof(*header) + payload
+			|| header->payload_checksum != checksum(mapping + sizeof(*header), payload, CHECKSUM_SEED)
+			|| !valid_instructions((const struct instruction_t *) (mapping + sizeof(*header)), header->count_instructions)) {
+		munmap(mapping, st.st_size);
+		return -1;
+	}
+
+	free_program(prog);
+	prog->instructions = (struct instruction_t *) (mapping + sizeof(*header));
+	prog->count_instructions = header->count_instructions;
+	prog->capacity = header->count_instructions;
+	prog->first_address = header->first_address;
+	prog->mapping = mapping;
+	prog->mapping_size = st.st_size;
+	return 0;
+}
+
+int map_image(const char * path, struct program_t * prog)
+{
+	if(try_map_image(path, prog) != 0) {
+		printf("Error: %s is not a valid program image\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+// Run from path.img when it is valid and at least as new as path, otherwise parse path
+// and write a fresh image for the next run
+int load_cached_program(const char * path, struct program_t * prog)
+{
+	struct stat source;
+	struct stat cached;
+	size_t length = strlen(path);
+	char * image = malloc(length + sizeof(IMAGE_SUFFIX));
+	int status;
+
+	if(image == NULL) {
+		printf("Error: Out of memory loading program\n");
+		return -1;
+	}
+	memcpy(image, path, length);
+	memcpy(image + length, IMAGE_SUFFIX, sizeof(IMAGE_SUFFIX));
+
+	if(stat(path, &source) == 0 && stat(image, &cached) == 0
+			&& (cached.st_mtim.tv_sec > source.st_mtim.tv_sec
+				|| (cached.st_mtim.tv_sec == source.st_mtim.tv_sec && cached.st_mtim.tv_nsec >= source.st_mtim.tv_nsec))
+			&& try_map_image(image, prog) == 0) {
+		free(image);
+		return 0;
+	}
+
+	status = load_program(path, prog);
+	if(status == 0) {
+		// A failed cache write only costs the next run a re-parse
+		write_image(image, prog);
+	}
+	free(image);
+	return status;
+}
@@ -0,0 +1,406 @@
+// Description: Client and load generator for the simpleISS server (simpleISS --serve=<socket>).
+// Sends assembly programs as jobs over the server's Unix domain socket. Without --jobs every
+// program is run once and each result line is printed as the server sent it. With --jobs=<n>,
+// n jobs cycling through the programs are spread over --connections sockets, each keeping
+// --depth requests in flight, and only the throughput and latency distribution are printed.
+// Programs are sent inline so the server's program cache sees their content; --by-path sends
+// the path instead, for a server that shares the file system.
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+struct client_t {
+	const char * socket_path;
+	char ** requests; // request body of every program, without the id and closing brace
+	size_t * request_lengths;
+	unsigned int count_programs;
+	unsigned int count_jobs;
+	unsigned int count_connections;
+	unsigned int depth; // requests in flight per connection
+	int print; // print every response
+	double * sent; // send time of every job
+	double * latencies; // response time of every job
+	unsigned int count_errors; // under errors_lock
+	pthread_mutex_t errors_lock;
+};
+
+struct client_connection_t {
+	struct client_t * client;
+	unsigned int first_job; // jobs [first_job, last_job) go over this connection
+	unsigned int last_job;
+	int status;
+};
+
+static double seconds_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void * a, const void * b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int reserve(char ** buffer, size_t * capacity, size_t needed)
+{
+	while(*capacity < needed) {
+		char * grown = realloc(*buffer, *capacity * 2);
+
+		if(grown == NULL) {
+			return -1;
+		}
+		*buffer = grown;
+		*capacity *= 2;
+	}
+	return 0;
+}
+
+static int append(char ** buffer, size_t * length, size_t * capacity, const char * text)
+{
+	size_t size = strlen(text);
+
+	if(reserve(buffer, capacity, *length + size) != 0) {
+		return -1;
+	}
+	memcpy(*buffer + *length, text, size);
+	*length += size;
+	return 0;
+}
+
+// Append text as the body of a JSON string
+static int append_escaped(char ** buffer, size_t * length, size_t * capacity, const char * text, size_t size)
+{
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		unsigned char c = text[i];
+
+		if(reserve(buffer, capacity, *length + 6) != 0) {
+			return -1;
+		}
+		if(c == '\n') {
+			*length += sprintf(*buffer + *length, "\\n");
+		} else if(c == '\t') {
+			*length += sprintf(*buffer + *length, "\\t");
+		} else if(c == '\r') {
+			*length += sprintf(*buffer + *length, "\\r");
+		} else if(c == '"' || c == '\\') {
+			(*buffer)[(*length)++] = '\\';
+			(*buffer)[(*length)++] = c;
+		} else if(c < 0x20) {
+			*length += sprintf(*buffer + *length, "\\u%04x", c);
+		} else {
+			(*buffer)[(*length)++] = c;
+		}
+	}
+	return 0;
+}
+
+// Every request field but the id, which send_job prepends, and the closing brace
+static char * build_request(const char * path, int by_path, const char * options, const char * engine,
+	unsigned long long max_instructions, size_t * length)
+{
+	size_t capacity = 4096;
+	char * buffer = malloc(capacity);
+	char * text = NULL;
+	size_t size;
+	char number[64];
+	int status = 0;
+
+	if(buffer == NULL) {
+		return NULL;
+	}
+	if(by_path) {
+		text = (char *) path;
+		size = strlen(path);
+	} else {
+		FILE * fptr = fopen(path, "rb");
+		long file_length = 0;
+
+		if(fptr == NULL || fseek(fptr, 0, SEEK_END) != 0 || (file_length = ftell(fptr)) < 0 || fseek(fptr, 0, SEEK_SET) != 0
+				|| (text = malloc(file_length + 1)) == NULL || fread(text, 1, file_length, fptr) != (size_t) file_length) {
+			printf("Error: Could not read %s\n", path);
+			if(fptr != NULL) {
+				fclose(fptr);
+			}
+			free(text);
+			free(buffer);
+			return NULL;
+		}
+		fclose(fptr);
+		size = file_length;
+	}
+
+	*length = 0;
+	status |= append(&buffer, length, &capacity, by_path ? ", \"program\": \"" : ", \"source\": \"");
+	status |= append_escaped(&buffer, length, &capacity, text, size);
+	status |= append(&buffer, length, &capacity, "\"");
+	if(options != NULL) {
+		status |= append(&buffer, length, &capacity, ", \"options\": \"");
+		status |= append_escaped(&buffer, length, &capacity, options, strlen(options));
+		status |= append(&buffer, length, &capacity, "\"");
+	}
+	if(engine != NULL) {
+		status |= append(&buffer, length, &capacity, ", \"engine\": \"");
+		status |= append_escaped(&buffer, length, &capacity, engine, strlen(engine));
+		status |= append(&buffer, length, &capacity, "\"");
+	}
+	if(max_instructions > 0) {
+		snprintf(number, sizeof(number), ", \"max_instructions\": %llu", max_instructions);
+		status |= append(&buffer, length, &capacity, number);
+	}
+	if(!by_path) {
+		free(text);
+	}
+	if(status != 0) {
+		printf("Error: Out of memory building requests\n");
+		free(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+static int send_all(int fd, const char * data, size_t length)
+{
+	while(length > 0) {
+		ssize_t written = write(fd, data, length);
+
+		if(written <= 0) {
+			return -1;
+		}
+		data += written;
+		length -= written;
+	}
+	return 0;
+}
+
+static int send_job(struct client_t * client, int fd, unsigned int job)
+{
+	unsigned int program = job % client->count_programs;
+	char head[32];
+	int length = snprintf(head, sizeof(head), "{\"id\": %u", job);
+
+	client->sent[job] = seconds_now();
+	if(send_all(fd, head, length) != 0
+			|| send_all(fd, client->requests[program], client->request_lengths[program]) != 0
+			|| send_all(fd, "}\n", 2) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void * client_connection(void * argument)
+{
+	struct client_connection_t * connection = argument;
+	struct client_t * client = connection->client;
+	struct sockaddr_un address;
+	unsigned int next = connection->first_job;
+	unsigned int pending = connection->last_job - connection->first_job;
+	char buffer[65536];
+	size_t length = 0;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	connection->status = -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", client->socket_path);
+	if(fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		printf("Error: Can't connect to %s\n", client->socket_path);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	while(next < connection->last_job && next - connection->first_job < client->depth) {
+		if(send_job(client, fd, next++) != 0) {
+			close(fd);
+			return NULL;
+		}
+	}
+	while(pending > 0) {
+		ssize_t count = read(fd, buffer + length, sizeof(buffer) - length);
+		size_t start = 0;
+		size_t i;
+
+		if(count <= 0) {
+			printf("Error: Server closed the connection with %u jobs pending\n", pending);
+			close(fd);
+			return NULL;
+		}
+		for(i = length; i < length + count; i++) {
+			double now;
+			double id;
+
+			if(buffer[i] != '\n') {
+				continue;
+			}
+			buffer[i] = '\0';
+			now = seconds_now();
+			if(sscanf(buffer + start, "{\"id\": %lf", &id) == 1 && id >= connection->first_job && id < connection->last_job) {
+				client->latencies[(unsigned int) id] = now - client->sent[(unsigned int) id];
+			}
+			if(strstr(buffer + start, "\"status\": \"error\"") != NULL) {
+				pthread_mutex_lock(&client->errors_lock);
+				client->count_errors++;
+				pthread_mutex_unlock(&client->errors_lock);
+			}
+			if(client->print) {
+				printf("%s\n", buffer + start);
+			}
+			start = i + 1;
+			pending--;
+			if(next < connection->last_job && send_job(client, fd, next++) != 0) {
+				close(fd);
+				return NULL;
+			}
+		}
+		length += count;
+		memmove(buffer, buffer + start, length - start);
+		length -= start;
+		if(length == sizeof(buffer)) {
+			printf("Error: Response line too long\n");
+			close(fd);
+			return NULL;
+		}
+	}
+	close(fd);
+	connection->status = 0;
+	return NULL;
+}
+
+static double percentile(const double * sorted, unsigned int count, double p)
+{
+	unsigned int index = (unsigned int) (p * (count - 1) + 0.5);
+
+	return sorted[index];
+}
+
+int main(int argc, char * argv[])
+{
+	struct client_t client;
+	struct client_connection_t * connections;
+	pthread_t * threads;
+	const char * options = NULL;
+	const char * engine = NULL;
+	unsigned long long max_instructions = 0;
+	int by_path = 0;
+	unsigned int i;
+	int status = 0;
+	double start;
+	double wall;
+
+	memset(&client, 0, sizeof(client));
+	client.count_connections = 1;
+	client.depth = 1;
+	client.requests = calloc(argc, sizeof(*client.requests));
+	client.request_lengths = calloc(argc, sizeof(*client.request_lengths));
+	if(client.requests == NULL || client.request_lengths == NULL) {
+		printf("Error: Out of memory\n");
+		return -1;
+	}
+	for(i = 1; i < (unsigned int) argc; i++) {
+		if(strncmp(argv[i], "--socket=", 9) == 0) {
+			client.socket_path = argv[i] + 9;
+		} else if(strncmp(argv[i], "--jobs=", 7) == 0) {
+			client.count_jobs = strtoul(argv[i] + 7, NULL, 10);
+		} else if(strncmp(argv[i], "--connections=", 14) == 0) {
+			client.count_connections = strtoul(argv[i] + 14, NULL, 10);
+		} else if(strncmp(argv[i], "--depth=", 8) == 0) {
+			client.depth = strtoul(argv[i] + 8, NULL, 10);
+		} else if(strncmp(argv[i], "--options=", 10) == 0) {
+			options = argv[i] + 10;
+		} else if(strncmp(argv[i], "--engine=", 9) == 0) {
+			engine = argv[i] + 9;
+		} else if(strncmp(argv[i], "--max-instructions=", 19) == 0) {
+			max_instructions = strtoull(argv[i] + 19, NULL, 10);
+		} else if(strcmp(argv[i], "--by-path") == 0) {
+			by_path = 1;
+		} else if(argv[i][0] != '-') {
+			size_t length;
+			char * request = build_request(argv[i], by_path, options, engine, max_instructions, &length);
+
+			if(request == NULL) {
+				return -1;
+			}
+			client.requests[client.count_programs] = request;
+			client.request_lengths[client.count_programs++] = length;
+		} else {
+			printf("Error: ./issClient --socket=<path> [--jobs=<n> [--connections=<n>] [--depth=<requests in flight>]] [--options=\"<cache options>\"] [--engine=<engine>] [--max-instructions=<n>] [--by-path] <program> ...\n");
+			return -1;
+		}
+	}
+	if(client.socket_path == NULL || client.count_programs == 0 || client.count_connections == 0 || client.depth == 0) {
+		printf("Error: ./issClient needs --socket=<path> and at least one program\n");
+		return -1;
+	}
+	if(client.count_jobs == 0) {
+		// One run of every program, results printed
+		client.count_jobs = client.count_programs;
+		client.count_connections = 1;
+		client.depth = client.count_programs;
+		client.print = 1;
+	}
+	if(client.count_connections > client.count_jobs) {
+		client.count_connections = client.count_jobs;
+	}
+	client.sent = calloc(client.count_jobs, sizeof(*client.sent));
+	client.latencies = calloc(client.count_jobs, sizeof(*client.latencies));
+	connections = calloc(client.count_connections, sizeof(*connections));
+	threads = calloc(client.count_connections, sizeof(*threads));
+	if(client.sent == NULL || client.latencies == NULL || connections == NULL || threads == NULL) {
+		printf("Error: Out of memory\n");
+		return -1;
+	}
+	pthread_mutex_init(&client.errors_lock, NULL);
+
+	start = seconds_now();
+	for(i = 0; i < client.count_connections; i++) {
+		connections[i].client = &client;
+		connections[i].first_job = (unsigned int) ((unsigned long long) client.count_jobs * i / client.count_connections);
+		connections[i].last_job = (unsigned int) ((unsigned long long) client.count_jobs * (i + 1) / client.count_connections);
+		if(pthread_create(&threads[i], NULL, client_connection, &connections[i]) != 0) {
+			printf("Error: Can't start connection threads\n");
+			return -1;
+		}
+	}
+	for(i = 0; i < client.count_connections; i++) {
+		pthread_join(threads[i], NULL);
+		status |= connections[i].status;
+	}
+	wall = seconds_now() - start;
+
+	if(status == 0) {
+		qsort(client.latencies, client.count_jobs, sizeof(*client.latencies), compare_doubles);
+		// Kept off stdout so printed results stay machine readable
+		fprintf(stderr, "%u jobs on %u connections, %u in flight each: %.0f jobs/s, latency ms p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f, %u errors\n",
+			client.count_jobs, client.count_connections, client.depth, wall > 0.0 ? client.count_jobs / wall : 0.0,
+			percentile(client.latencies, client.count_jobs, 0.5) * 1e3, percentile(client.latencies, client.count_jobs, 0.9) * 1e3,
+			percentile(client.latencies, client.count_jobs, 0.99) * 1e3, percentile(client.latencies, client.count_jobs, 0.999) * 1e3,
+			client.latencies[client.count_jobs - 1] * 1e3, client.count_errors);
+	}
+	for(i = 0; i < client.count_programs; i++) {
+		free(client.requests[i]);
+	}
+	free(client.requests);
+	free(client.request_lengths);
+	free(client.sent);
+	free(client.latencies);
+	free(connections);
+	free(threads);
+	pthread_mutex_destroy(&client.errors_lock);
+	return status == 0 && client.count_errors == 0 ? 0 : -1;
+}
@@ -0,0 +1,147 @@
+// Description: Small host program for libsimpleiss.a (make check-library).
+// Runs each assembly program given on the command line through every engine of the library and
+// checks that they agree with the switch interpreter, then steps halfway, saves a checkpoint,
+// restores it into a second context and checks that finishing the run gives the same result.
+// Finally it feeds the library a malformed program, which must come back as an error while the
+// host keeps running and the program loaded before stays in place.
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libsimpleiss.h"
+
+static const struct {
+	const char * name;
+	enum iss_engine engine;
+} engines[] = {
+	{"threaded", ISS_ENGINE_THREADED},
+	{"fused", ISS_ENGINE_FUSED},
+	{"jit", ISS_ENGINE_JIT},
+	{"fastforward", ISS_ENGINE_FAST_FORWARD},
+	{"optimized", ISS_ENGINE_OPTIMIZED}
+};
+
+static int same_stats(const struct iss_stats_t * a, const struct iss_stats_t * b)
+{
+	return a->count_executed_instructions == b->count_executed_instructions
+		&& a->count_clock_cycles == b->count_clock_cycles
+		&& a->count_hits_to_local_memory == b->count_hits_to_local_memory
+		&& a->count_memory_accesses == b->count_memory_accesses
+		&& a->l2_hits == b->l2_hits && a->l2_misses == b->l2_misses;
+}
+
+// Step half of the reference run, checkpoint, and finish it in a second context
+static int check_checkpoint(struct iss_t * iss, const char * path, const struct iss_stats_t * reference)
+{
+	char checkpoint[] = "/tmp/issHost.XXXXXX";
+	struct iss_t * resumed = iss_create(NULL);
+	struct iss_stats_t stats;
+	unsigned int i;
+	int fd = mkstemp(checkpoint);
+	int status = -1;
+
+	if(resumed == NULL || fd < 0) {
+		fprintf(stderr, "Error: can't set up the checkpoint check\n");
+		iss_destroy(resumed);
+		return -1;
+	}
+	close(fd);
+
+	iss_set_engine(iss, ISS_ENGINE_SWITCH);
+	iss_reset(iss);
+	for(i = 0; i < reference->count_executed_instructions / 2 && iss_step(iss); i++) {
+	}
+	if(iss_save_checkpoint(iss, checkpoint) == 0 && iss_load_file(resumed, path) == 0
+			&& iss_restore_checkpoint(resumed, checkpoint) == 0) {
+		iss_run(resumed);
+		iss_stats(resumed, &stats);
+		status = same_stats(&stats, reference) ? 0 : -1;
+	}
+	unlink(checkpoint);
+	iss_destroy(resumed);
+	return status;
+}
+
+static int check_program(const char * path)
+{
+	struct iss_t * iss = iss_create(NULL);
+	struct iss_stats_t reference;
+	struct iss_stats_t stats;
+	unsigned int e;
+	int failed = 0;
+
+	if(iss == NULL || iss_load_file(iss, path) != 0) {
+		fprintf(stderr, "Error: can't load %s\n", path);
+		iss_destroy(iss);
+		return -1;
+	}
+	iss_run(iss);
+	iss_stats(iss, &reference);
+
+	for(e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+		iss_set_engine(iss, engines[e].engine);
+		iss_reset(iss);
+		iss_run(iss);
+		iss_stats(iss, &stats);
+		if(!same_stats(&stats, &reference)) {
+			printf("%s (%s): DIFFERENT\n", path, engines[e].name);
+			failed = 1;
+		}
+	}
+	if(check_checkpoint(iss, path, &reference) != 0) {
+		printf("%s (checkpoint): DIFFERENT\n", path);
+		failed = 1;
+	}
+	if(!failed) {
+		printf("%s: %u instructions, %u cycles, every engine and a checkpoint resume agree\n",
+			path, reference.count_executed_instructions, reference.count_clock_cycles);
+	}
+	iss_destroy(iss);
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+	static const char malformed[] = "0 MOV R1, 1\n1 BOGUS R1\n";
+	struct iss_t * iss;
+	struct iss_stats_t before;
+	struct iss_stats_t after;
+	int failed = 0;
+	int i;
+
+	if(argc < 2) {
+		fprintf(stderr, "Usage: issHost <program.assembly>...\n");
+		return 1;
+	}
+	for(i = 1; i < argc; i++) {
+		failed |= check_program(argv[i]) != 0;
+	}
+
+	// A malformed program is reported to the host, not fatal to it, and leaves the context alone
+	iss = iss_create(NULL);
+	if(iss == NULL || iss_load_file(iss, argv[1]) != 0) {
+		fprintf(stderr, "Error: can't load %s\n", argv[1]);
+		iss_destroy(iss);
+		return 1;
+	}
+	iss_run(iss);
+	iss_stats(iss, &before);
+	if(iss_load_text(iss, malformed, sizeof(malformed) - 1) == 0) {
+		printf("malformed program: accepted\n");
+		failed = 1;
+	} else {
+		iss_reset(iss);
+		iss_run(iss);
+		iss_stats(iss, &after);
+		if(same_stats(&before, &after)) {
+			printf("malformed program: rejected, %s still loaded\n", argv[1]);
+		} else {
+			printf("malformed program: rejected, but %s was lost\n", argv[1]);
+			failed = 1;
+		}
+	}
+	iss_destroy(iss);
+	return failed;
+}
@@ -0,0 +1,391 @@
+// Description: Basic-block JIT compiler for x86-64 hosts.
+// Every basic block of the parsed program is translated into native code in an mmap'd buffer.
+// The generated code works directly on struct machine_t (pointer in rdi): simulated registers,
+// CMP_VAL, memory data and the four counters are read and updated in place. LD/ST are only
+// compiled for the flat cache configuration, where every tag is 0 and the valid bits and dirty
+// flags are plain per-address arrays; other cache models run those blocks through the
+// interpreter.
+// Blocks are chained with direct jumps; control only returns to C when the program finishes or
+// reaches a block that was not compiled, which is then run by the step interpreter.
+
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+#if defined(__x86_64__)
+
+// Native code of a block: takes the machine state, returns the index of the next instruction
+// to interpret (count_instructions when the program has finished)
+typedef unsigned int (*jit_block_t)(struct machine_t * m);
+
+// Bytes reserved per instruction/per block. LD/ST are the largest at about 90 bytes.
+#define JIT_BYTES_PER_INSTRUCTION 128
+#define JIT_BYTES_PER_BLOCK 32
+
+// A rel32 field that must be patched once the address of its target block is known
+struct fixup_t {
+	unsigned int position; // offset of the rel32 field in the buffer
+	unsigned int target; // instruction index of the target block
+};
+
+struct jit_t {
+	unsigned char * buffer;
+	size_t size;
+	size_t length;
+	struct fixup_t * fixups;
+	unsigned int count_fixups;
+	const struct cache_t * cache;
+};
+
+#define OFFSET_REGISTER(r) ((unsigned int) (offsetof(struct machine_t, registers) + (r)))
+#define OFFSET_CMP_VAL ((unsigned int) offsetof(struct machine_t, CMP_VAL))
+#define OFFSET_EXECUTED ((unsigned int) offsetof(struct machine_t, count_executed_instructions))
+#define OFFSET_CYCLES ((unsigned int) offsetof(struct machine_t, count_clock_cycles))
+#define OFFSET_HITS ((unsigned int) offsetof(struct machine_t, count_hits_to_local_memory))
+#define OFFSET_ACCESSES ((unsigned int) offsetof(struct machine_t, count_memory_accesses))
+#define OFFSET_MEMORY ((unsigned int) offsetof(struct machine_t, memory))
+
+static void emit8(struct jit_t * jit, unsigned char byte)
+{
+	jit->buffer[jit->length++] = byte;
+}
+
+static void emit32(struct jit_t * jit, unsigned int value)
+{
+	memcpy(jit->buffer + jit->length, &value, sizeof(value));
+	jit->length += sizeof(value);
+}
+
+// <opcode> [rdi + disp32] with the given ModRM reg field
+static void emit_rdi(struct jit_t * jit, unsigned char opcode, unsigned char reg, unsigned int disp)
+{
+	emit8(jit, opcode);
+	emit8(jit, 0x87 | (reg << 3));
+	emit32(jit, disp);
+}
+
+// <opcode> [rdi + rax + disp32] with the given ModRM reg field, indexes memory[]
+static void emit_memory_operand(struct jit_t * jit, unsigned char opcode, unsigned char reg, unsigned int disp)
+{
+	emit8(jit, opcode);
+	emit8(jit, 0x84 | (reg << 3));
+	emit8(jit, 0x07);
+	emit32(jit, disp);
+}
+
+// movabs <reg>, pointer
+static void emit_pointer(struct jit_t * jit, unsigned char reg, const void * pointer)
+{
+	unsigned long long value = (unsigned long long) (size_t) pointer;
+
+	emit8(jit, 0x48);
+	emit8(jit, 0xB8 + reg);
+	emit32(jit, (unsigned int) value);
+	emit32(jit, (unsigned int) (value >> 32));
+}
+
+// add dword [rdi + disp32], value
+static void emit_add_counter(struct jit_t * jit, unsigned int disp, unsigned int value)
+{
+	if(value == 0) {
+		return;
+	}
+	emit_rdi(jit, 0x81, 0, disp);
+	emit32(jit, value);
+}
+
+// rel32 jump field to the block starting at instruction index target
+static void emit_target(struct jit_t * jit, unsigned int target)
+{
+	jit->fixups[jit->count_fixups].position = jit->length;
+	jit->fixups[jit->count_fixups].target = target;
+	++jit->count_fixups;
+	emit32(jit, 0);
+}
+
+// mov eax, index; ret
+static void emit_exit(struct jit_t * jit, unsigned int index)
+{
+	emit8(jit, 0xB8);
+	emit32(jit, index);
+	emit8(jit, 0xC3);
+}
+
+// Register operands must name one of the simulated registers for a block to be compiled
+static int is_compilable(const struct instruction_t * instr, const struct cache_t * cache)
+{
+	switch(instr->operation) {
+		case MOV:
+		case ADD_NUM:
+			return (unsigned char) instr->operand1 < NO_REGISTERS;
+		case LD:
+		case ST:
+			if(!cache_is_flat(cache)) {
+				return 0;
+			}
+			// fall through
+		case ADD_REG:
+		case CMP:
+			return (unsigned char) instr->operand1 < NO_REGISTERS && (unsigned char) instr->operand2 < NO_REGISTERS;
+		case JE:
+		case JMP:
+			return 1;
+	}
+	return 0;
+}
+
+// Jump target index of a JE/JMP, count_instructions for addresses outside the program
+static unsigned int jump_index(const struct program_t * prog, const struct instruction_t * instr)
+{
+	unsigned int index = instr->target - prog->first_address;
+
+	return index > prog->count_instructions ? prog->count_instructions : index;
+}
+
+// LD Rn, [Rm] / ST [Rm], Rn on the flat cache: an address hits when bit address of the valid
+// bitset is set
+static void emit_memory(struct jit_t * jit, const struct instruction_t * instr)
+{
+	const struct cache_t * cache = jit->cache;
+	unsigned char address_reg = (unsigned char) (instr->operation == LD ? instr->operand2 : instr->operand1);
+	size_t miss;
+	size_t done;
+
+	emit8(jit, 0x0F); // movzx eax, byte [rdi + address register]
+	emit_rdi(jit, 0xB6, 0, OFFSET_REGISTER(address_reg));
+	emit_pointer(jit, 2, cache->valid); // mov rdx, valid
+	emit8(jit, 0x89); // mov ecx, eax
+	emit8(jit, 0xC1);
+	emit8(jit, 0xC1); // shr ecx, 6
+	emit8(jit, 0xE9);
+	emit8(jit, 0x06);
+	emit8(jit, 0x4C); // mov r8, [rdx + rcx*8]
+	emit8(jit, 0x8B);
+	emit8(jit, 0x04);
+	emit8(jit, 0xCA);
+	emit8(jit, 0x49); // bt r8, rax (the bit offset is taken modulo 64)
+	emit8(jit, 0x0F);
+	emit8(jit, 0xA3);
+	emit8(jit, 0xC0);
+	emit8(jit, 0x73); // jnc miss
+	emit8(jit, 0);
+	miss = jit->length;
+
+	// cache hit
+	emit_add_counter(jit, OFFSET_HITS, 1);
+	emit_add_counter(jit, OFFSET_CYCLES, cache->config.hit_cycles);
+	emit8(jit, 0xEB); // jmp done
+	emit8(jit, 0);
+	done = jit->length;
+	jit->buffer[miss - 1] = (unsigned char) (jit->length - miss);
+
+	// cache miss
+	emit8(jit, 0x49); // bts r8, rax
+	emit8(jit, 0x0F);
+	emit8(jit, 0xAB);
+	emit8(jit, 0xC0);
+	emit8(jit, 0x4C); // mov [rdx + rcx*8], r8
+	emit8(jit, 0x89);
+	emit8(jit, 0x04);
+	emit8(jit, 0xCA);
+	emit_add_counter(jit, OFFSET_CYCLES, cache->config.miss_cycles);
+	jit->buffer[done - 1] = (unsigned char) (jit->length - done);
+
+	if(instr->operation == LD) {
+		emit_memory_operand(jit, 0x8A, 1, OFFSET_MEMORY); // mov cl, [memory]
+		emit_rdi(jit, 0x88, 1, OFFSET_REGISTER((unsigned char) instr->operand1)); // mov [Rn], cl
+	} else {
+		emit_rdi(jit, 0x8A, 1, OFFSET_REGISTER((unsigned char) instr->operand2)); // mov cl, [Rn]
+		emit_memory_operand(jit, 0x88, 1, OFFSET_MEMORY); // mov [memory], cl
+		if(cache->config.write == WRITE_THROUGH) {
+			emit_add_counter(jit, OFFSET_CYCLES, cache->config.write_cycles);
+		} else {
+			emit_pointer(jit, 6, cache->dirty); // mov rsi, dirty
+			emit8(jit, 0xC6); // mov byte [rsi + rax], 1
+			emit8(jit, 0x04);
+			emit8(jit, 0x06);
+			emit8(jit, 0x01);
+		}
+	}
+}
+
+// Translate instructions [start, end) of one basic block
+static void emit_block(struct jit_t * jit, const struct program_t * prog, unsigned int start, unsigned int end)
+{
+	unsigned int count_cycles = 0;
+	unsigned int count_accesses = 0;
+	unsigned int i;
+	const struct instruction_t * last = &prog->instructions[end - 1];
+
+	// Every instruction of the block executes; all but LD/ST cost one cycle
+	for(i = start; i < end; i++) {
+		if(prog->instructions[i].operation == LD || prog->instructions[i].operation == ST) {
+			++count_accesses;
+		} else {
+			++count_cycles;
+		}
+	}
+	emit_add_counter(jit, OFFSET_EXECUTED, end - start);
+	emit_add_counter(jit, OFFSET_CYCLES, count_cycles);
+	emit_add_counter(jit, OFFSET_ACCESSES, count_accesses);
+
+	for(i = start; i < end; i++) {
+		const struct instruction_t * instr = &prog->instructions[i];
+
+		switch(instr->operation) {
+			case MOV: // mov byte [Rn], imm8
+				emit_rdi(jit, 0xC6, 0, OFFSET_REGISTER((unsigned char) instr->operand1));
+				emit8(jit, (unsigned char) instr->operand2);
+				break;
+			case ADD_NUM: // add byte [Rn], imm8
+				emit_rdi(jit, 0x80, 0, OFFSET_REGISTER((unsigned char) instr->operand1));
+				emit8(jit, (unsigned char) instr->operand2);
+				break;
+			case ADD_REG: // mov al, [Rm]; add [Rn], al
+				emit_rdi(jit, 0x8A, 0, OFFSET_REGISTER((unsigned char) instr->operand2));
+				emit_rdi(jit, 0x00, 0, OFFSET_REGISTER((unsigned char) instr->operand1));
+				break;
+			case CMP: // mov al, [Rn]; cmp al, [Rm]; sete [CMP_VAL]
+				emit_rdi(jit, 0x8A, 0, OFFSET_REGISTER((unsigned char) instr->operand1));
+				emit_rdi(jit, 0x3A, 0, OFFSET_REGISTER((unsigned char) instr->operand2));
+				emit8(jit, 0x0F);
+				emit_rdi(jit, 0x94, 0, OFFSET_CMP_VAL);
+				break;
+			case JE: // cmp byte [CMP_VAL], 0; jne target
+				emit_rdi(jit, 0x80, 7, OFFSET_CMP_VAL);
+				emit8(jit, 0x00);
+				emit8(jit, 0x0F);
+				emit8(jit, 0x85);
+				emit_target(jit, jump_index(prog, instr));
+				break;
+			case JMP:
+				emit8(jit, 0xE9);
+				emit_target(jit, jump_index(prog, instr));
+				break;
+			case LD:
+			case ST:
+				emit_memory(jit, instr);
+				break;
+		}
+	}
+
+	// Fall through into the next block
+	if(last->operation != JMP) {
+		emit8(jit, 0xE9);
+		emit_target(jit, end);
+	}
+}
+
+void execute_jit(const struct program_t * prog, struct machine_t * m)
+{
+	unsigned int count_instructions = prog->count_instructions;
+	unsigned char * is_leader = calloc(count_instructions + 1, 1);
+	unsigned char * compiled = calloc(count_instructions + 1, 1);
+	unsigned int * entry = calloc(count_instructions + 1, sizeof(*entry));
+	struct jit_t jit;
+	unsigned int count_blocks = 1;
+	unsigned int start;
+	unsigned int end;
+	unsigned int index;
+	unsigned int i;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if(is_leader == NULL || compiled == NULL || entry == NULL) {
+		printf("Error: Out of memory compiling program\n");
+		free(is_leader);
+		free(compiled);
+		free(entry);
+		execute_fused(prog, m);
+		return;
+	}
+
+	mark_block_leaders(prog, is_leader);
+	for(i = 1; i < count_instructions; i++) {
+		count_blocks += is_leader[i];
+	}
+
+	jit.size = (size_t) count_instructions * JIT_BYTES_PER_INSTRUCTION + (size_t) (count_blocks + 1) * JIT_BYTES_PER_BLOCK;
+	jit.size = (jit.size + page_size - 1) / page_size * page_size;
+	jit.length = 0;
+	jit.count_fixups = 0;
+	jit.cache = &m->cache;
+	jit.fixups = malloc((count_instructions + count_blocks) * sizeof(*jit.fixups));
+	jit.buffer = mmap(NULL, jit.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	// Without an executable buffer every instruction goes through the interpreter
+	if(jit.fixups == NULL || jit.buffer == MAP_FAILED) {
+		free(jit.fixups);
+		free(is_leader);
+		free(compiled);
+		free(entry);
+		execute_fused(prog, m);
+		return;
+	}
+
+	// Compile each block, or emit a stub handing it back to the interpreter
+	for(start = 0; start < count_instructions; start = end) {
+		int supported = 1;
+
+		for(end = start; end < count_instructions && (end == start || !is_leader[end]); end++) {
+			supported &= is_compilable(&prog->instructions[end], &m->cache);
+		}
+		entry[start] = jit.length;
+		if(supported) {
+			emit_block(&jit, prog, start, end);
+			compiled[start] = 1;
+		} else {
+			emit_exit(&jit, start);
+		}
+	}
+	entry[count_instructions] = jit.length;
+	emit_exit(&jit, count_instructions);
+
+	// Resolve block-to-block jumps, then make the buffer executable
+	for(i = 0; i < jit.count_fixups; i++) {
+		unsigned int position = jit.fixups[i].position;
+		unsigned int rel = entry[jit.fixups[i].target] - (position + 4);
+
+		memcpy(jit.buffer + position, &rel, sizeof(rel));
+	}
+	if(mprotect(jit.buffer, jit.size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(jit.buffer, jit.size);
+		free(jit.fixups);
+		free(is_leader);
+		free(compiled);
+		free(entry);
+		execute_fused(prog, m);
+		return;
+	}
+
+	// Compiled LD/ST set valid bits directly, so every word they reach must be stamped and listed
+	// for the next reset to clear, with the dirty flags of its lines already cleared
+	if(cache_is_flat(&m->cache)) {
+		cache_refresh(&m->cache, MAIN_MEMORY_SIZE);
+	}
+	index = 0;
+	while(index < count_instructions) {
+		if(compiled[index]) {
+			index = ((jit_block_t) (jit.buffer + entry[index]))(m);
+		} else {
+			index = step_instruction(prog, m, index);
+		}
+	}
+
+	munmap(jit.buffer, jit.size);
+	free(jit.fixups);
+	free(is_leader);
+	free(compiled);
+	free(entry);
+}
+
+#else
+
+// Other hosts always use the interpreter
+void execute_jit(const struct program_t * prog, struct machine_t * m)
+{
+	execute_fused(prog, m);
+}
+
+#endif
@@ -0,0 +1,160 @@
+// Description: Library interface: a self-contained simulation context around the engines.
+
+#include "simpleISS.h"
+#include "libsimpleiss.h"
+
+struct iss_t {
+	struct program_t program;
+	struct machine_t machine;
+	void (*execute)(const struct program_t *, struct machine_t *);
+	unsigned int index; // next instruction for iss_step, count_instructions when finished
+};
+
+struct iss_t * iss_create(const struct memory_config_t * config)
+{
+	struct memory_config_t defaults;
+	struct iss_t * iss = calloc(1, sizeof(*iss));
+
+	if(iss == NULL) {
+		printf("Error: Out of memory allocating simulator\n");
+		return NULL;
+	}
+	if(config == NULL) {
+		default_memory_config(&defaults);
+		config = &defaults;
+	}
+	if(init_machine(&iss->machine, config) != 0) {
+		free(iss);
+		return NULL;
+	}
+	iss->execute = execute_switch;
+	return iss;
+}
+
+void iss_destroy(struct iss_t * iss)
+{
+	if(iss == NULL) {
+		return;
+	}
+	free_machine(&iss->machine);
+	free_program(&iss->program);
+	free(iss);
+}
+
+int iss_set_engine(struct iss_t * iss, enum iss_engine engine)
+{
+	switch(engine) {
+		case ISS_ENGINE_SWITCH:
+			iss->execute = execute_switch;
+			return 0;
+		case ISS_ENGINE_THREADED:
+			iss->execute = execute_threaded;
+			return 0;
+		case ISS_ENGINE_FUSED:
+			iss->execute = execute_fused;
+			return 0;
+		case ISS_ENGINE_JIT:
+			iss->execute = execute_jit;
+			return 0;
+		case ISS_ENGINE_FAST_FORWARD:
+			iss->execute = execute_fast_forward;
+			return 0;
+		case ISS_ENGINE_OPTIMIZED:
+			iss->execute = execute_optimized;
+			return 0;
+	}
+	return -1;
+}
+
+// Take over a freshly loaded program, or drop it and keep the current one when loading failed
+static int install_program(struct iss_t * iss, struct program_t * loaded, int status)
+{
+	if(status != 0) {
+		free_program(loaded);
+		return status;
+	}
+	move_program(&iss->program, loaded);
+	iss_reset(iss);
+	return 0;
+}
+
+int iss_load_file(struct iss_t * iss, const char * path)
+{
+	struct program_t loaded;
+
+	memset(&loaded, 0, sizeof(loaded));
+	return install_program(iss, &loaded, is_image_file(path) ? map_image(path, &loaded) : load_program(path, &loaded));
+}
+
+int iss_load_text(struct iss_t * iss, const char * text, size_t size)
+{
+	struct program_t loaded;
+
+	memset(&loaded, 0, sizeof(loaded));
+	return install_program(iss, &loaded, parse_program(text, size, &loaded));
+}
+
+void iss_reset(struct iss_t * iss)
+{
+	reset_machine(&iss->machine);
+	iss->index = 0;
+}
+
+void iss_run(struct iss_t * iss)
+{
+	// The engines start at the first instruction; after iss_step or a restore the switch loop
+	// finishes the run
+	if(iss->index == 0) {
+		iss->execute(&iss->program, &iss->machine);
+	} else if(iss->index < iss->program.count_instructions) {
+		resume_switch(&iss->program, &iss->machine, iss->index);
+	}
+	iss->index = iss->program.count_instructions;
+}
+
+int iss_step(struct iss_t * iss)
+{
+	if(iss->index >= iss->program.count_instructions) {
+		return 0;
+	}
+	iss->index = step_instruction(&iss->program, &iss->machine, iss->index);
+	return iss->index < iss->program.count_instructions;
+}
+
+int iss_save_checkpoint(const struct iss_t * iss, const char * path)
+{
+	return write_checkpoint(path, &iss->program, &iss->machine, iss->index);
+}
+
+int iss_restore_checkpoint(struct iss_t * iss, const char * path)
+{
+	struct memory_config_t config;
+
+	config.l1 = iss->machine.cache.config;
+	config.l2 = iss->machine.l2.config;
+	free_machine(&iss->machine);
+	if(read_checkpoint(path, &iss->program, &iss->machine, &iss->index) != 0) {
+		// Fall back to a reset machine with the previous configuration
+		iss->index = 0;
+		if(init_machine(&iss->machine, &config) != 0) {
+			memset(&iss->machine, 0, sizeof(iss->machine));
+		}
+		return -1;
+	}
+	return 0;
+}
+
+void iss_stats(const struct iss_t * iss, struct iss_stats_t * stats)
+{
+	stats->count_executed_instructions = iss->machine.count_executed_instructions;
+	stats->count_clock_cycles = iss->machine.count_clock_cycles;
+	stats->count_hits_to_local_memory = iss->machine.count_hits_to_local_memory;
+	stats->count_memory_accesses = iss->machine.count_memory_accesses;
+	stats->l2_hits = iss->machine.l2.hits;
+	stats->l2_misses = iss->machine.l2.misses;
+}
+
+char iss_register(const struct iss_t * iss, unsigned int r)
+{
+	return r < NO_REGISTERS ? iss->machine.registers[r] : 0;
+}
@@ -0,0 +1,43 @@
+// Description: Library interface of the simple instruction set simulator (libsimpleiss.a).
+// A host program creates one iss_t per simulation it wants to keep around. The context holds
+// the program, the registers, the caches and the counters, so any number of contexts can be
+// used at once, from different threads if each context stays on one thread. Nothing is
+// printed except error messages; results are read back with iss_stats.
+//
+//	struct iss_t * iss = iss_create(NULL);
+//	iss_load_file(iss, "sample.assembly");
+//	for(...) { iss_reset(iss); iss_run(iss); iss_stats(iss, &stats); }
+//	iss_destroy(iss);
+#ifndef __LIBSIMPLEISS__H
+#define __LIBSIMPLEISS__H
+
+#include <stddef.h>
+#include "cache.h"
+
+enum iss_engine {ISS_ENGINE_SWITCH, ISS_ENGINE_THREADED, ISS_ENGINE_FUSED, ISS_ENGINE_JIT, ISS_ENGINE_FAST_FORWARD, ISS_ENGINE_OPTIMIZED};
+
+struct iss_t;
+
+struct iss_stats_t {
+	unsigned int count_executed_instructions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits_to_local_memory;
+	unsigned int count_memory_accesses;
+	unsigned int l2_hits; // 0 without an L2
+	unsigned int l2_misses;
+};
+
+struct iss_t * iss_create(const struct memory_config_t * config); // NULL config for the defaults, NULL on error
+void iss_destroy(struct iss_t * iss);
+int iss_set_engine(struct iss_t * iss, enum iss_engine engine); // -1 for an unknown engine
+int iss_load_file(struct iss_t * iss, const char * path); // Assembly or binary image; resets the machine, keeps the old program on error
+int iss_load_text(struct iss_t * iss, const char * text, size_t size); // Assembly held in memory; as iss_load_file
+void iss_reset(struct iss_t * iss); // Clear registers, memory, caches and counters, back to the first instruction
+void iss_run(struct iss_t * iss); // Run to the end of the program
+int iss_step(struct iss_t * iss); // Execute one instruction; 0 once the program has finished
+int iss_save_checkpoint(const struct iss_t * iss, const char * path); // Save the full state, e.g. between iss_step calls
+int iss_restore_checkpoint(struct iss_t * iss, const char * path); // Continue from a checkpoint of the loaded program; resets on error
+void iss_stats(const struct iss_t * iss, struct iss_stats_t * stats);
+char iss_register(const struct iss_t * iss, unsigned int r); // Value of register r, 0 for r out of range
+
+#endif
@@ -0,0 +1,511 @@
+// Description: Lockstep engine: one program, many instances with different initial registers
+// and memory, executed together in vector lanes.
+// Up to LOCKSTEP_LANES instances form a group. Registers, CMP_VAL and the instruction and
+// cycle counters of a group are stored lane-wise, so one decoded instruction updates every
+// instance with a few vector operations under a lane mask. The core is built for AVX-512,
+// AVX2 and plain x86-64 and the best one is picked at run time. Each instance keeps its own
+// machine_t for memory and caches; LD/ST gather the lane addresses and go through the
+// instance's own cache model, so every configuration behaves exactly as in the scalar loop.
+// With the flat default cache (one valid bit per address) memory and valid bits are held
+// lane-wise in the group instead. A LD/ST whose lanes all use the same address is then one
+// vector load of the data and one of the valid bits, and hits and cycles follow by masking.
+// Lanes whose JE outcomes differ split up. The group then always runs the lowest PC any live
+// lane is at, with only the lanes at that PC enabled, and runs unmasked again once all live
+// lanes meet at the same PC, which for loops is the first instruction after them.
+
+#include <ctype.h>
+#include "simpleISS.h"
+
+#define LOCKSTEP_LANES 64
+
+typedef unsigned char lane_bytes_t __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef signed char lane_mask_t __attribute__((vector_size(LOCKSTEP_LANES))); // -1 for enabled lanes
+typedef unsigned int lane_words_t __attribute__((vector_size(4 * LOCKSTEP_LANES)));
+typedef int lane_word_mask_t __attribute__((vector_size(4 * LOCKSTEP_LANES)));
+
+struct lockstep_group_t {
+	lane_bytes_t registers[NO_REGISTERS];
+	lane_bytes_t CMP_VAL;
+	lane_words_t count_executed_instructions;
+	lane_words_t count_clock_cycles;
+	lane_words_t count_hits_to_local_memory;
+	lane_words_t count_memory_accesses;
+	int flat; // memory, valid and dirty below are used instead of the machines' memory and caches
+	lane_bytes_t memory[MAIN_MEMORY_SIZE];
+	lane_bytes_t valid[MAIN_MEMORY_SIZE]; // flat cache: 0xFF when the lane has the address cached
+	lane_bytes_t dirty[MAIN_MEMORY_SIZE];
+	unsigned int pc[LOCKSTEP_LANES]; // next instruction index of each lane while the group is split
+	struct machine_t * machines[LOCKSTEP_LANES]; // memory and caches of each lane unless flat
+	unsigned int count_lanes;
+};
+
+// One initial value of an instance: register or memory byte
+struct lockstep_seed_t {
+	unsigned int instance;
+	int is_memory;
+	unsigned int target; // register index or address
+	char value;
+};
+
+// Index of a JE/JMP target, count_instructions for addresses outside the program
+static unsigned int target_index(const struct program_t * prog, const struct instruction_t * instr)
+{
+	unsigned int index = instr->target - prog->first_address;
+
+	return index > prog->count_instructions ? prog->count_instructions : index;
+}
+
+__attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+static void run_group(const struct program_t * prog, struct lockstep_group_t * g)
+{
+	unsigned int count = prog->count_instructions;
+	unsigned int pc = 0; // PC of the whole group while it is not split
+	int converged = 1;
+	lane_mask_t live;
+	lane_mask_t mask;
+	unsigned int l;
+
+	for(l = 0; l < LOCKSTEP_LANES; l++) {
+		live[l] = l < g->count_lanes && count > 0 ? -1 : 0;
+		g->pc[l] = 0;
+	}
+	while(1) {
+		const struct instruction_t * instr;
+		lane_word_mask_t words;
+		unsigned int next;
+		int any;
+		int all = 1;
+
+		// A group that is not split always has live lanes
+		if(converged) {
+			mask = live;
+		} else {
+			pc = count;
+			for(l = 0; l < LOCKSTEP_LANES; l++) {
+				if(live[l] && g->pc[l] < pc) {
+					pc = g->pc[l];
+				}
+			}
+			if(pc == count) {
+				break;
+			}
+			for(l = 0; l < LOCKSTEP_LANES; l++) {
+				mask[l] = live[l] && g->pc[l] == pc ? -1 : 0;
+				all &= mask[l] == live[l];
+			}
+			converged = all;
+		}
+
+		instr = &prog->instructions[pc];
+		words = __builtin_convertvector(mask, lane_word_mask_t);
+		g->count_executed_instructions -= (lane_words_t) words; // -1 adds one
+		next = pc + 1;
+		switch(instr->operation) {
+			case MOV:
+				g->registers[(unsigned char) instr->operand1] = (g->registers[(unsigned char) instr->operand1] & ~(lane_bytes_t) mask)
+					| ((lane_bytes_t) mask & (unsigned char) instr->operand2);
+				g->count_clock_cycles -= (lane_words_t) words;
+				break;
+			case ADD_REG:
+				g->registers[(unsigned char) instr->operand1] += g->registers[(unsigned char) instr->operand2] & (lane_bytes_t) mask;
+				g->count_clock_cycles -= (lane_words_t) words;
+				break;
+			case ADD_NUM:
+				g->registers[(unsigned char) instr->operand1] += (lane_bytes_t) mask & (unsigned char) instr->operand2;
+				g->count_clock_cycles -= (lane_words_t) words;
+				break;
+			case CMP:
+				g->CMP_VAL = (g->CMP_VAL & ~(lane_bytes_t) mask)
+					| ((lane_bytes_t) (g->registers[(unsigned char) instr->operand1] == g->registers[(unsigned char) instr->operand2])
+						& (lane_bytes_t) mask & 1);
+				g->count_clock_cycles -= (lane_words_t) words;
+				break;
+			case JE: {
+				lane_mask_t taken = (lane_mask_t) (g->CMP_VAL != 0) & mask;
+
+				g->count_clock_cycles -= (lane_words_t) words;
+				any = 0;
+				all = 1;
+				for(l = 0; l < LOCKSTEP_LANES; l++) {
+					any |= taken[l];
+					all &= taken[l] == mask[l];
+				}
+				if(all) {
+					next = target_index(prog, instr);
+				} else if(any) {
+					// The enabled lanes part ways
+					unsigned int target = target_index(prog, instr);
+
+					for(l = 0; l < LOCKSTEP_LANES; l++) {
+						if(mask[l]) {
+							g->pc[l] = taken[l] ? target : pc + 1;
+							live[l] = g->pc[l] < count ? -1 : 0;
+						}
+					}
+					converged = 0;
+					continue;
+				}
+				break;
+			}
+			case JMP:
+				next = target_index(prog, instr);
+				g->count_clock_cycles -= (lane_words_t) words;
+				break;
+			case LD:
+			case ST: {
+				const struct cache_config_t * config = &g->machines[0]->cache.config;
+				unsigned char address_register = instr->operation == LD ? instr->operand2 : instr->operand1;
+				lane_bytes_t addresses = g->registers[address_register];
+				unsigned char first = 0;
+				int uniform = g->flat;
+
+				g->count_memory_accesses -= (lane_words_t) words;
+				for(l = 0; l < LOCKSTEP_LANES && uniform; l++) {
+					if(mask[l]) {
+						first = addresses[l];
+						break;
+					}
+				}
+				for(; l < LOCKSTEP_LANES && uniform; l++) {
+					uniform = !mask[l] || addresses[l] == first;
+				}
+
+				if(uniform) {
+					// Every enabled lane touches the same address
+					lane_mask_t hits = (lane_mask_t) g->valid[first] & mask;
+					lane_word_mask_t hit_words = __builtin_convertvector(hits, lane_word_mask_t);
+
+					g->count_hits_to_local_memory -= (lane_words_t) hit_words;
+					g->count_clock_cycles += ((lane_words_t) hit_words & config->hit_cycles)
+						| ((lane_words_t) (words & ~hit_words) & config->miss_cycles);
+					g->valid[first] |= (lane_bytes_t) mask;
+					if(instr->operation == LD) {
+						g->registers[(unsigned char) instr->operand1] = (g->registers[(unsigned char) instr->operand1] & ~(lane_bytes_t) mask)
+							| (g->memory[first] & (lane_bytes_t) mask);
+					} else {
+						g->memory[first] = (g->memory[first] & ~(lane_bytes_t) mask)
+							| (g->registers[(unsigned char) instr->operand2] & (lane_bytes_t) mask);
+						if(config->write == WRITE_THROUGH) {
+							g->count_clock_cycles += (lane_words_t) words & config->write_cycles;
+						} else {
+							g->dirty[first] |= (lane_bytes_t) mask;
+						}
+					}
+					break;
+				}
+
+				// Every lane has its own address, and without a flat cache its own cache model
+				for(l = 0; l < LOCKSTEP_LANES; l++) {
+					if(mask[l]) {
+						struct machine_t * m = g->machines[l];
+						unsigned char mem_address = addresses[l];
+						int hit;
+
+						if(g->flat) {
+							hit = g->valid[mem_address][l] != 0;
+							g->count_clock_cycles[l] += hit ? config->hit_cycles : config->miss_cycles;
+							g->valid[mem_address][l] = 0xFF;
+						} else {
+							g->count_clock_cycles[l] += cache_access(&m->cache, mem_address, instr->operation == ST, &hit);
+						}
+						g->count_hits_to_local_memory[l] += hit;
+						if(instr->operation == LD) {
+							g->registers[(unsigned char) instr->operand1][l] = g->flat ? g->memory[mem_address][l] : m->memory[mem_address];
+						} else if(g->flat) {
+							g->memory[mem_address][l] = g->registers[(unsigned char) instr->operand2][l];
+							if(config->write == WRITE_THROUGH) {
+								g->count_clock_cycles[l] += config->write_cycles;
+							} else {
+								g->dirty[mem_address][l] = 0xFF;
+							}
+						} else {
+							m->memory[mem_address] = g->registers[(unsigned char) instr->operand2][l];
+						}
+					}
+				}
+				break;
+			}
+		}
+
+		if(next > count) {
+			next = count;
+		}
+		if(converged) {
+			if(next == count) {
+				break;
+			}
+			pc = next;
+		} else {
+			for(l = 0; l < LOCKSTEP_LANES; l++) {
+				if(mask[l]) {
+					g->pc[l] = next;
+					live[l] = next < count ? -1 : 0;
+				}
+			}
+		}
+	}
+}
+
+// Run instances [first, first + count_lanes) as one group and store their results in the machines
+static void run_instances(const struct program_t * prog, struct machine_t * machines, unsigned int first, unsigned int count_lanes)
+{
+	static struct lockstep_group_t group; // 64-byte aligned vectors, too large for comfort on the stack
+	unsigned int l;
+	unsigned int r;
+	unsigned int a;
+
+	memset(&group, 0, sizeof(group));
+	group.count_lanes = count_lanes;
+	group.flat = cache_is_flat(&machines[first].cache);
+	for(l = 0; l < count_lanes; l++) {
+		struct machine_t * m = &machines[first + l];
+
+		group.machines[l] = m;
+		for(r = 0; r < NO_REGISTERS; r++) {
+			group.registers[r][l] = m->registers[r];
+		}
+		group.CMP_VAL[l] = m->CMP_VAL;
+		group.count_executed_instructions[l] = m->count_executed_instructions;
+		group.count_clock_cycles[l] = m->count_clock_cycles;
+		group.count_hits_to_local_memory[l] = m->count_hits_to_local_memory;
+		group.count_memory_accesses[l] = m->count_memory_accesses;
+		if(group.flat) {
+			cache_refresh(&m->cache, MAIN_MEMORY_SIZE); // dirty flags of empty lines are now 0
+		}
+		for(a = 0; a < MAIN_MEMORY_SIZE && group.flat; a++) {
+			group.memory[a][l] = m->memory[a];
+			group.valid[a][l] = cache_line_valid(&m->cache, a) ? 0xFF : 0;
+			group.dirty[a][l] = m->cache.dirty[a] ? 0xFF : 0;
+		}
+	}
+	run_group(prog, &group);
+	for(l = 0; l < count_lanes; l++) {
+		struct machine_t * m = &machines[first + l];
+
+		for(r = 0; r < NO_REGISTERS; r++) {
+			m->registers[r] = group.registers[r][l];
+		}
+		m->CMP_VAL = group.CMP_VAL[l];
+		m->count_executed_instructions = group.count_executed_instructions[l];
+		m->count_clock_cycles = group.count_clock_cycles[l];
+		m->count_hits_to_local_memory = group.count_hits_to_local_memory[l];
+		m->count_memory_accesses = group.count_memory_accesses[l];
+		// A flat cache has one line per address with tag 0; its FIFO stamps decide nothing
+		for(a = 0; a < MAIN_MEMORY_SIZE && group.flat; a++) {
+			m->memory[a] = group.memory[a][l];
+			m->cache.tags[a] = 0;
+			cache_set_valid(&m->cache, a, group.valid[a][l] != 0);
+			m->cache.dirty[a] = group.dirty[a][l] != 0;
+		}
+	}
+}
+
+// One R<register>=<value> or M<address>=<value> token, registers numbered R1 to R6 as in the
+// assembly language
+static int parse_seed(const char * token, struct lockstep_seed_t * seed)
+{
+	char * end;
+	long target;
+	long value;
+
+	if((token[0] != 'R' && token[0] != 'M') || !isdigit((unsigned char) token[1])) {
+		return -1;
+	}
+	seed->is_memory = token[0] == 'M';
+	target = strtol(token + 1, &end, 10);
+	if(*end != '=' || !(isdigit((unsigned char) end[1]) || (end[1] == '-' && isdigit((unsigned char) end[2])))) {
+		return -1;
+	}
+	value = strtol(end + 1, &end, 10);
+	if(*end != '\0' || value < -128 || value > 255) {
+		return -1;
+	}
+	if(seed->is_memory ? target >= MAIN_MEMORY_SIZE : (target < 1 || target > NO_REGISTERS)) {
+		return -1;
+	}
+	seed->target = seed->is_memory ? target : target - 1;
+	seed->value = (char) value;
+	return 0;
+}
+
+// Seed file: one instance per line, as R<register>=<value> and M<address>=<value> tokens.
+// Empty lines and lines starting with # are skipped; an instance without tokens starts from zero.
+static int parse_seeds(const char * path, struct lockstep_seed_t ** seeds, unsigned int * count_seeds, unsigned int * count_instances)
+{
+	FILE * fptr = fopen(path, "r");
+	char line[4096];
+	unsigned int capacity = 0;
+	unsigned int number = 0;
+
+	*seeds = NULL;
+	*count_seeds = 0;
+	*count_instances = 0;
+	if(fptr == NULL) {
+		printf("Error: Could not open %s\n", path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), fptr) != NULL) {
+		char * token;
+
+		++number;
+		token = strtok(line, " \t\r\n");
+		if(token != NULL && token[0] == '#') {
+			continue;
+		}
+		if(token == NULL) {
+			continue;
+		}
+		for(; token != NULL; token = strtok(NULL, " \t\r\n")) {
+			struct lockstep_seed_t seed;
+
+			seed.instance = *count_instances;
+			if(parse_seed(token, &seed) != 0) {
+				printf("Error: %s:%u: bad seed %s, expected R<1-%d>=<value> or M<0-%d>=<value>\n", path, number, token,
+					NO_REGISTERS, MAIN_MEMORY_SIZE - 1);
+				fclose(fptr);
+				free(*seeds);
+				return -1;
+			}
+			if(*count_seeds == capacity) {
+				struct lockstep_seed_t * grown;
+
+				capacity = capacity == 0 ? 256 : 2 * capacity;
+				grown = realloc(*seeds, capacity * sizeof(*grown));
+				if(grown == NULL) {
+					printf("Error: Out of memory reading seeds\n");
+					fclose(fptr);
+					free(*seeds);
+					return -1;
+				}
+				*seeds = grown;
+			}
+			(*seeds)[(*count_seeds)++] = seed;
+		}
+		++*count_instances;
+	}
+	fclose(fptr);
+	if(*count_instances == 0) {
+		printf("Error: No instances in %s\n", path);
+		free(*seeds);
+		return -1;
+	}
+	return 0;
+}
+
+// Fresh machine for an instance with its seeds applied
+static int init_instance(struct machine_t * m, const struct memory_config_t * config, const struct lockstep_seed_t * seeds,
+	unsigned int count_seeds, unsigned int instance)
+{
+	unsigned int i;
+
+	if(init_machine(m, config) != 0) {
+		return -1;
+	}
+	for(i = 0; i < count_seeds; i++) {
+		if(seeds[i].instance == instance) {
+			if(seeds[i].is_memory) {
+				m->memory[seeds[i].target] = seeds[i].value;
+			} else {
+				m->registers[seeds[i].target] = seeds[i].value;
+			}
+		}
+	}
+	return 0;
+}
+
+int run_lockstep(const struct program_t * prog, const struct memory_config_t * config, const char * seeds_path, int json, int verify)
+{
+	struct lockstep_seed_t * seeds;
+	struct machine_t * machines;
+	unsigned int count_seeds;
+	unsigned int count_instances;
+	unsigned int count_ready = 0;
+	unsigned int first;
+	unsigned int i;
+	double start;
+	double lockstep_seconds;
+	int status = 0;
+
+	if(parse_seeds(seeds_path, &seeds, &count_seeds, &count_instances) != 0) {
+		return -1;
+	}
+	machines = calloc(count_instances, sizeof(*machines));
+	if(machines == NULL) {
+		printf("Error: Out of memory allocating instances\n");
+		free(seeds);
+		return -1;
+	}
+	for(count_ready = 0; count_ready < count_instances; count_ready++) {
+		if(init_instance(&machines[count_ready], config, seeds, count_seeds, count_ready) != 0) {
+			status = -1;
+			break;
+		}
+	}
+
+	if(status == 0) {
+		start = seconds_now();
+		for(first = 0; first < count_instances; first += LOCKSTEP_LANES) {
+			run_instances(prog, machines, first, count_instances - first < LOCKSTEP_LANES ? count_instances - first : LOCKSTEP_LANES);
+		}
+		lockstep_seconds = seconds_now() - start;
+
+		if(!json) {
+			printf("instance,instructions,cycles,hits,accesses\n");
+		}
+		for(i = 0; i < count_instances; i++) {
+			const struct machine_t * m = &machines[i];
+
+			if(json) {
+				printf("{\"instance\": %u, \"instructions\": %u, \"cycles\": %u, \"hits\": %u, \"accesses\": %u}\n", i,
+					m->count_executed_instructions, m->count_clock_cycles, m->count_hits_to_local_memory, m->count_memory_accesses);
+			} else {
+				printf("%u,%u,%u,%u,%u\n", i, m->count_executed_instructions, m->count_clock_cycles,
+					m->count_hits_to_local_memory, m->count_memory_accesses);
+			}
+		}
+		fprintf(stderr, "%u instances in %u lockstep groups in %.3f s\n", count_instances,
+			(count_instances + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES, lockstep_seconds);
+	}
+
+	// Cross-check every instance against the reference switch loop
+	if(status == 0 && verify) {
+		struct machine_t reference;
+		double scalar_seconds = 0.0;
+
+		for(i = 0; i < count_instances && status == 0; i++) {
+			const struct machine_t * m = &machines[i];
+
+			if(init_instance(&reference, config, seeds, count_seeds, i) != 0) {
+				status = -1;
+				break;
+			}
+			start = seconds_now();
+			execute_switch(prog, &reference);
+			scalar_seconds += seconds_now() - start;
+			if(reference.count_executed_instructions != m->count_executed_instructions
+					|| reference.count_clock_cycles != m->count_clock_cycles
+					|| reference.count_hits_to_local_memory != m->count_hits_to_local_memory
+					|| reference.count_memory_accesses != m->count_memory_accesses
+					|| reference.l2.hits != m->l2.hits
+					|| reference.l2.misses != m->l2.misses
+					|| reference.CMP_VAL != m->CMP_VAL
+					|| memcmp(reference.registers, m->registers, sizeof(m->registers)) != 0
+					|| memcmp(reference.memory, m->memory, sizeof(m->memory)) != 0) {
+				printf("Error: instance %u differs from the switch interpreter\n", i);
+				status = -1;
+			}
+			free_machine(&reference);
+		}
+		if(status == 0) {
+			fprintf(stderr, "switch loop one by one: %.3f s, speedup %.2fx\n", scalar_seconds,
+				lockstep_seconds > 0 ? scalar_seconds / lockstep_seconds : 0.0);
+		}
+	}
+
+	for(i = 0; i < count_ready; i++) {
+		free_machine(&machines[i]);
+	}
+	free(machines);
+	free(seeds);
+	return status;
+}
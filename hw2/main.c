@@ -0,0 +1,394 @@
+// Description: Command line front end of the simple instruction set simulator.
+
+#include "simpleISS.h"
+
+static struct program_t program;
+static struct machine_t machine;
+
+// The four summary lines followed by the per-level breakdown
+static void print_statistics(const struct machine_t * m)
+{
+	printf("Total number of executed instructions: %d\n", m->count_executed_instructions); 
+	printf("Total number of clock cycles: %d\n", m->count_clock_cycles);
+	printf("Number of hits to local memory: %d\n", m->count_hits_to_local_memory);
+	printf("Total number of executed LD/ST instructions: %d\n", m->count_memory_accesses); 
+	print_memory_statistics(m);
+}
+
+// Replay a trace with one configuration, or every configuration of the sweep grid
+static int run_trace(const char * path, const struct memory_config_t * config, struct sweep_t * sweep)
+{
+	struct trace_t trace;
+	int status = 0;
+
+	if(map_trace(path, &trace) != 0) {
+		return -1;
+	}
+	if(sweep->count_dimensions > 0) {
+		sweep->trace = &trace;
+		status = run_sweep(NULL, config, sweep, NULL);
+	} else if(init_machine(&machine, config) == 0) {
+		replay_trace(&trace, &machine);
+		print_statistics(&machine);
+		free_machine(&machine);
+	} else {
+		status = -1;
+	}
+	unmap_trace(&trace);
+	return status;
+}
+
+static void usage(void)
+{
+	printf("Error: ./simpleISS [--engine=switch|threaded|fused|jit|fastforward|optimized] [--parser=scan|sscanf] [--image-cache] [--emit-image=<file>] [cache options] [sweep options] [--miss-ratio-curve] [--profile] [--profile-folded=<file>] [--trace=<file> [--trace-compress]] [--checkpoint=<file> --checkpoint-at=<instructions>|--checkpoint-pc=<address>] [--restore=<file>] [--sample [sample options]] [--lockstep=<seed file>] [--cores=<program>,<program>,... [--quantum=<instructions>] [--coherence=msi|mesi]] [--batch=<list file or directory>] [--serve=<socket> [--program-cache=<programs>] [--max-instructions=<per job>]] [--verify] [--bench-parse] [--bench-reset] [--perf-counters] [--benchmark=<runs> [--baseline=<file>] [--save-baseline=<file>]] [Assembly Input, image or trace]\n"
+		"Cache options: --cache-size=<bytes> --line-size=<bytes> --assoc=<ways, 0 = fully associative>\n"
+		"  --replacement=lru|fifo|random|plru --write-policy=wb|wt --hit-cycles=<n> --miss-cycles=<n> --write-cycles=<n>\n"
+		"  --l2-size=<bytes, 0 = no L2> --l2-line-size=<bytes> --l2-assoc=<ways> --l2-hit-cycles=<n>\n"
+		"Sweep options: --sweep=<cache option>=<v1>,<v2>,... (repeatable) --threads=<n> --format=csv|json\n"
+		"Sample options: --sample-interval=<instructions> --sample-clusters=<max> --sample-warmup=<intervals> --sample-per-cluster=<n>\n"
+		"Lockstep seed files hold one instance per line: R<1-6>=<value> M<0-255>=<value> ...\n"
+		"Batch mode uses --threads and --format too, server mode --threads, lockstep mode --format and --verify\n"
+		"A restored run takes its cache configuration from the checkpoint; checkpointing and restoring run the switch engine only\n");
+	exit(-1);
+}
+
+int main(int argc, char * argv[])
+{
+	unsigned int i = 0;
+	const char * input = NULL;
+	void (*execute)(const struct program_t *, struct machine_t *) = execute_switch;
+	int (*load)(const char *, struct program_t *) = load_program;
+	int verify = 0;
+	int perf_counters = 0;
+	struct perf_counters_t counters;
+	struct perf_sample_t parse_sample;
+	struct perf_sample_t execute_sample;
+	int bench_parse = 0;
+	int bench_reset = 0;
+	int image_cache = 0;
+	int miss_ratio_curve = 0;
+	int profiling = 0;
+	const char * folded_profile = NULL;
+	struct profile_t profile;
+	const char * trace = NULL;
+	const char * batch = NULL;
+	unsigned int benchmark_runs = 0;
+	const char * baseline = NULL;
+	const char * save_baseline = NULL;
+	int trace_compress = 0;
+	struct trace_writer_t trace_writer;
+	const char * emit_image = NULL;
+	const char * checkpoint = NULL;
+	const char * restore = NULL;
+	struct checkpoint_trigger_t trigger;
+	int sampling = 0;
+	const char * lockstep = NULL;
+	char * cores = NULL;
+	const char * serve = NULL;
+	unsigned int count_programs = 64;
+	unsigned int max_instructions = 1000000000; // per server job
+	unsigned int quantum = 1000;
+	int mesi = 1;
+	struct sample_config_t sample = {100000, 10, 1, 2};
+	unsigned int index;
+	int consumed;
+	struct memory_config_t memory_config;
+	struct sweep_t sweep;
+
+	default_memory_config(&memory_config);
+	memset(&sweep, 0, sizeof(sweep));
+	memset(&trigger, 0, sizeof(trigger));
+
+	// Parse command line options
+	for(i = 1; i < (unsigned int) argc; i++) {
+		if(strcmp(argv[i], "--engine=switch") == 0) {
+			execute = execute_switch;
+		} else if(strcmp(argv[i], "--engine=threaded") == 0) {
+			execute = execute_threaded;
+		} else if(strcmp(argv[i], "--engine=fused") == 0) {
+			execute = execute_fused;
+		} else if(strcmp(argv[i], "--engine=jit") == 0) {
+			execute = execute_jit;
+		} else if(strcmp(argv[i], "--engine=fastforward") == 0) {
+			execute = execute_fast_forward;
+		} else if(strcmp(argv[i], "--engine=optimized") == 0) {
+			execute = execute_optimized;
+		} else if(strcmp(argv[i], "--parser=sscanf") == 0) {
+			load = load_program_sscanf;
+		} else if(strcmp(argv[i], "--parser=scan") == 0) {
+			load = load_program;
+		} else if(strcmp(argv[i], "--image-cache") == 0) {
+			image_cache = 1;
+		} else if(strncmp(argv[i], "--emit-image=", 13) == 0) {
+			emit_image = argv[i] + 13;
+		} else if(strcmp(argv[i], "--bench-parse") == 0) {
+			bench_parse = 1;
+		} else if(strcmp(argv[i], "--bench-reset") == 0) {
+			bench_reset = 1;
+		} else if(strcmp(argv[i], "--profile") == 0) {
+			profiling = 1;
+		} else if(strncmp(argv[i], "--profile-folded=", 17) == 0) {
+			profiling = 1;
+			folded_profile = argv[i] + 17;
+		} else if(strncmp(argv[i], "--batch=", 8) == 0) {
+			batch = argv[i] + 8;
+		} else if(strncmp(argv[i], "--trace=", 8) == 0) {
+			trace = argv[i] + 8;
+		} else if(strcmp(argv[i], "--trace-compress") == 0) {
+			trace_compress = 1;
+		} else if(strncmp(argv[i], "--checkpoint=", 13) == 0) {
+			checkpoint = argv[i] + 13;
+		} else if(strncmp(argv[i], "--checkpoint-at=", 16) == 0) {
+			trigger.count_instructions = strtoul(argv[i] + 16, NULL, 10);
+		} else if(strncmp(argv[i], "--checkpoint-pc=", 16) == 0) {
+			trigger.pc = strtoul(argv[i] + 16, NULL, 10);
+			trigger.has_pc = 1;
+		} else if(strncmp(argv[i], "--restore=", 10) == 0) {
+			restore = argv[i] + 10;
+		} else if(strncmp(argv[i], "--serve=", 8) == 0) {
+			serve = argv[i] + 8;
+		} else if(strncmp(argv[i], "--program-cache=", 16) == 0) {
+			count_programs = strtoul(argv[i] + 16, NULL, 10);
+		} else if(strncmp(argv[i], "--max-instructions=", 19) == 0) {
+			max_instructions = strtoul(argv[i] + 19, NULL, 10);
+		} else if(strncmp(argv[i], "--cores=", 8) == 0) {
+			cores = argv[i] + 8;
+		} else if(strncmp(argv[i], "--quantum=", 10) == 0) {
+			quantum = strtoul(argv[i] + 10, NULL, 10);
+		} else if(strcmp(argv[i], "--coherence=msi") == 0) {
+			mesi = 0;
+		} else if(strcmp(argv[i], "--coherence=mesi") == 0) {
+			mesi = 1;
+		} else if(strncmp(argv[i], "--lockstep=", 11) == 0) {
+			lockstep = argv[i] + 11;
+		} else if(strcmp(argv[i], "--sample") == 0) {
+			sampling = 1;
+		} else if(strncmp(argv[i], "--sample-interval=", 18) == 0) {
+			sample.interval = strtoul(argv[i] + 18, NULL, 10);
+		} else if(strncmp(argv[i], "--sample-clusters=", 18) == 0) {
+			sample.max_clusters = strtoul(argv[i] + 18, NULL, 10);
+		} else if(strncmp(argv[i], "--sample-warmup=", 16) == 0) {
+			sample.warmup = strtoul(argv[i] + 16, NULL, 10);
+		} else if(strncmp(argv[i], "--sample-per-cluster=", 21) == 0) {
+			sample.per_cluster = strtoul(argv[i] + 21, NULL, 10);
+		} else if(strcmp(argv[i], "--miss-ratio-curve") == 0) {
+			miss_ratio_curve = 1;
+		} else if(strncmp(argv[i], "--benchmark=", 12) == 0) {
+			benchmark_runs = strtoul(argv[i] + 12, NULL, 10);
+		} else if(strncmp(argv[i], "--baseline=", 11) == 0) {
+			baseline = argv[i] + 11;
+		} else if(strncmp(argv[i], "--save-baseline=", 16) == 0) {
+			save_baseline = argv[i] + 16;
+		} else if(strcmp(argv[i], "--perf-counters") == 0) {
+			perf_counters = 1;
+		} else if(strcmp(argv[i], "--verify") == 0) {
+			verify = 1;
+		} else if((consumed = parse_cache_option(argv[i], &memory_config)) != 0) {
+			if(consumed < 0) {
+				exit(-1);
+			}
+		} else if((consumed = parse_sweep_option(argv[i], &sweep)) != 0) {
+			if(consumed < 0) {
+				exit(-1);
+			}
+		} else if(strncmp(argv[i], "--threads=", 10) == 0) {
+			sweep.count_threads = strtoul(argv[i] + 10, NULL, 10);
+		} else if(strcmp(argv[i], "--format=csv") == 0) {
+			sweep.json = 0;
+		} else if(strcmp(argv[i], "--format=json") == 0) {
+			sweep.json = 1;
+		} else if(argv[i][0] != '-' && input == NULL) {
+			input = argv[i];
+		} else {
+			usage();
+		}
+	}
+	// Many programs, each with a fresh machine, on a thread pool
+	if(batch != NULL) {
+		return run_batch(batch, &memory_config, execute, sweep.count_threads, sweep.json) == 0 ? 0 : -1;
+	}
+	// Jobs from clients of a Unix domain socket, on a worker pool
+	if(serve != NULL) {
+		return run_server(serve, &memory_config, sweep.count_threads, count_programs, max_instructions) == 0 ? 0 : -1;
+	}
+	// One program per core, each core on its own thread
+	if(cores != NULL) {
+		return run_multicore(cores, &memory_config, quantum, mesi) == 0 ? 0 : -1;
+	}
+	if(input == NULL || (checkpoint != NULL && trigger.count_instructions == 0 && !trigger.has_pc)) {
+		usage();
+	}
+	// Checkpointing and restoring use their own step loops, which the profiling and tracing loops
+	// and the other engines know nothing of
+	if((checkpoint != NULL || restore != NULL) && (profiling || trace != NULL || execute != execute_switch)) {
+		printf("Error: --checkpoint and --restore can't be combined with --profile, --trace or an --engine other than switch\n");
+		exit(-1);
+	}
+	if(checkpoint != NULL && restore != NULL) {
+		printf("Error: --checkpoint and --restore can't be combined\n");
+		exit(-1);
+	}
+
+	if(bench_parse) {
+		return benchmark_parsers(input) == 0 ? 0 : -1;
+	}
+	if(bench_reset) {
+		return benchmark_reset(input, &memory_config) == 0 ? 0 : -1;
+	}
+	if(benchmark_runs > 0) {
+		return run_benchmark(input, benchmark_runs, &memory_config, baseline, save_baseline);
+	}
+
+	// A recorded trace only drives the cache model
+	if(is_trace_file(input)) {
+		return run_trace(input, &memory_config, &sweep);
+	}
+
+	// Parse assembly file for instructions, or map a previously saved image of it
+	if(is_image_file(input)) {
+		load = map_image;
+	} else if(image_cache) {
+		load = load_cached_program;
+	}
+	memset(&parse_sample, 0, sizeof(parse_sample));
+	memset(&execute_sample, 0, sizeof(execute_sample));
+	if(perf_counters) {
+		if(open_perf_counters(&counters) != 0) {
+			exit(-1);
+		}
+		start_perf_counters(&counters);
+	}
+	if(load(input, &program) != 0) {
+		exit(-1);
+	}
+	if(perf_counters) {
+		stop_perf_counters(&counters, &parse_sample);
+	}
+	if(emit_image != NULL && write_image(emit_image, &program) != 0) {
+		exit(-1);
+	}
+
+	// Hits of every fully associative LRU capacity from one run
+	if(miss_ratio_curve) {
+		int status = analyze_stack_distances(&program, &memory_config);
+
+		free_program(&program);
+		return status == 0 ? 0 : -1;
+	}
+
+	// Detailed simulation of representative intervals only, extrapolated to the whole run
+	if(sampling) {
+		int status = run_sampled(&program, &memory_config, &sample);
+
+		free_program(&program);
+		return status == 0 ? 0 : -1;
+	}
+
+	// The same program from many initial states, in vector lanes
+	if(lockstep != NULL) {
+		int status = run_lockstep(&program, &memory_config, lockstep, sweep.json, verify);
+
+		free_program(&program);
+		return status == 0 ? 0 : -1;
+	}
+
+	// Simulate every configuration of the grid instead of a single run
+	if(sweep.count_dimensions > 0) {
+		int status = run_sweep(&program, &memory_config, &sweep, execute);
+
+		free_program(&program);
+		return status == 0 ? 0 : -1;
+	}
+
+	// Initialize Local memory, or pick up the state and configuration of a checkpoint
+	if(restore != NULL) {
+		if(read_checkpoint(restore, &program, &machine, &index) != 0) {
+			exit(-1);
+		}
+		memory_config.l1 = machine.cache.config;
+		memory_config.l2 = machine.l2.config;
+	} else if(init_machine(&machine, &memory_config) != 0) {
+		exit(-1);
+	}
+
+	// Execute CPU instructions, with the profiling, tracing or checkpointing loop when asked for;
+	// the execute counters cover whichever loop runs
+	if(profiling && init_profile(&program, &profile) != 0) {
+		exit(-1);
+	}
+	if(!profiling && trace != NULL && open_trace(&trace_writer, trace, trace_compress) != 0) {
+		exit(-1);
+	}
+	if(perf_counters) {
+		start_perf_counters(&counters);
+	}
+	if(profiling) {
+		execute_profiled(&program, &machine, &profile);
+	} else if(trace != NULL) {
+		execute_traced(&program, &machine, &trace_writer);
+		if(close_trace(&trace_writer, machine.count_executed_instructions) != 0) {
+			exit(-1);
+		}
+	} else if(checkpoint != NULL) {
+		index = execute_until(&program, &machine, &trigger);
+		if(index >= program.count_instructions) {
+			printf("Error: program finished before the checkpoint trigger\n");
+			exit(-1);
+		}
+		if(write_checkpoint(checkpoint, &program, &machine, index) != 0) {
+			exit(-1);
+		}
+		fprintf(stderr, "Checkpoint %s at address %u after %u instructions\n", checkpoint,
+			program.first_address + index, machine.count_executed_instructions);
+		resume_switch(&program, &machine, index);
+	} else if(restore != NULL) {
+		// The engines start at the first instruction; the switch loop picks up at any index
+		resume_switch(&program, &machine, index);
+	} else {
+		execute(&program, &machine);
+	}
+	if(perf_counters) {
+		stop_perf_counters(&counters, &execute_sample);
+	}
+
+	// Cross-check the selected engine against the reference switch loop
+	if(verify) {
+		struct machine_t reference;
+
+		init_machine(&reference, &memory_config);
+		execute_switch(&program, &reference);
+		if(reference.count_executed_instructions != machine.count_executed_instructions
+				|| reference.count_clock_cycles != machine.count_clock_cycles
+				|| reference.count_hits_to_local_memory != machine.count_hits_to_local_memory
+				|| reference.count_memory_accesses != machine.count_memory_accesses
+				|| reference.l2.hits != machine.l2.hits
+				|| reference.l2.misses != machine.l2.misses
+				|| reference.CMP_VAL != machine.CMP_VAL
+				|| memcmp(reference.registers, machine.registers, sizeof(machine.registers)) != 0
+				|| memcmp(reference.memory, machine.memory, sizeof(machine.memory)) != 0) {
+			printf("Error: engine results differ from the switch interpreter\n");
+			exit(-1);
+		}
+		free_machine(&reference);
+	}
+
+	print_statistics(&machine);
+
+	if(perf_counters) {
+		close_perf_counters(&counters);
+		print_perf_sample("parse", &parse_sample, machine.count_executed_instructions);
+		print_perf_sample("execute", &execute_sample, machine.count_executed_instructions);
+	}
+
+	if(profiling) {
+		print_profile(&program, &profile);
+		if(folded_profile != NULL && write_folded_profile(folded_profile, &program, &profile) != 0) {
+			exit(-1);
+		}
+		free_profile(&profile);
+	}
+
+	free_machine(&machine);
+	free_program(&program);
+	return 0;
+}
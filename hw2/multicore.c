@@ -0,0 +1,467 @@
+// Description: Multi-core mode: one program per core, each with a private write-back cache,
+// kept coherent over a shared main memory with MSI or MESI.
+// Every core runs on its own host thread, in quanta of a fixed number of instructions. Within
+// a quantum a core only touches its own machine: it sees its own stores at once and the other
+// cores' stores from the next quantum on. The coherence state a core gives a fill (E or S)
+// comes from the states all cores had at the last barrier, which nobody writes during a
+// quantum. Each core logs its bus requests (BusRd, BusRdX, BusUpgr, silent E->M upgrades and
+// evictions) with the instruction count they were issued at. At the barrier one thread replays
+// all logs in (instruction count, core) order against the shared states, invalidates and
+// cleans the lines other cores lost, and merges the stores into main memory, the latest store
+// to an address winning. A silent upgrade whose line another core read in the meantime becomes
+// a BusUpgr there, and its cycles are charged to its core then. No step depends on host timing, so runs are deterministic for any
+// number of host cores.
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include "simpleISS.h"
+
+#define MAX_CORES 64
+
+enum coherence_state {STATE_I, STATE_S, STATE_E, STATE_M};
+enum bus_event {BUS_READ, BUS_READ_EXCLUSIVE, BUS_UPGRADE, SILENT_UPGRADE, EVICTION};
+
+struct bus_request_t {
+	unsigned int time; // executed instructions of the core when it was issued
+	unsigned char type; // enum bus_event
+	unsigned char line;
+};
+
+struct core_t {
+	const char * path;
+	struct program_t * program;
+	struct machine_t machine; // memory is the core's view of main memory
+	unsigned int index; // next instruction
+	int finished;
+	unsigned char state[MAIN_MEMORY_SIZE]; // coherence state of each line as the core sees it
+	unsigned int last_store[MAIN_MEMORY_SIZE]; // 1 + time of the last store to each address this quantum, 0 for none
+	struct bus_request_t * requests; // this quantum, in time order
+	unsigned int count_requests;
+	unsigned int * set_tags; // the set before a miss, INVALID_TAG for empty ways, to find the evicted line
+	unsigned char invalidated[MAIN_MEMORY_SIZE]; // line lost to another core and not refilled since
+	unsigned int upgrades; // BusUpgr issued
+	unsigned int invalidations; // lines taken away by other cores
+	unsigned int flushes; // modified lines written back for other cores
+	unsigned int coherence_misses; // misses to lines another core had invalidated
+};
+
+struct multicore_t {
+	struct core_t * cores;
+	unsigned int count_cores;
+	unsigned int quantum;
+	int mesi;
+	unsigned int limit; // executed instructions at which the current quantum ends
+	int done;
+	pthread_barrier_t barrier;
+	pthread_mutex_t start_lock;
+	pthread_cond_t start_ready;
+	int start; // 0 until every core thread exists, then 1 to run or -1 to give up
+	unsigned char published[MAX_CORES][MAIN_MEMORY_SIZE]; // line states at the last barrier
+	char memory[MAIN_MEMORY_SIZE]; // shared main memory
+	unsigned int count_quanta;
+	unsigned int bus_reads;
+	unsigned int bus_read_exclusives;
+	unsigned int bus_upgrades;
+	unsigned int invalidations;
+	unsigned int flushes;
+};
+
+struct core_worker_t {
+	struct multicore_t * mc;
+	struct core_t * core;
+};
+
+static void log_request(struct core_t * core, enum bus_event type, unsigned int line)
+{
+	struct bus_request_t * request = &core->requests[core->count_requests++];
+
+	request->time = core->machine.count_executed_instructions;
+	request->type = type;
+	request->line = line;
+}
+
+// LD/ST through the private cache, with the coherence actions it needs
+static unsigned int coherent_access(const struct multicore_t * mc, struct core_t * core, unsigned int index)
+{
+	const struct instruction_t * instr = &core->program->instructions[index];
+	struct machine_t * m = &core->machine;
+	struct cache_t * cache = &m->cache;
+	int is_store = instr->operation == ST;
+	unsigned char address = (unsigned char) m->registers[(unsigned char) (is_store ? instr->operand1 : instr->operand2)];
+	unsigned int line = address >> cache->line_shift;
+	unsigned int set = line & cache->set_mask;
+	unsigned int * tags = cache->tags + set * cache->ways;
+	unsigned int way;
+	unsigned int c;
+	int hit;
+
+	for(way = 0; way < cache->ways; way++) {
+		core->set_tags[way] = cache_line_valid(cache, set * cache->ways + way) ? tags[way] : INVALID_TAG;
+	}
+	++m->count_memory_accesses;
+	m->count_clock_cycles += cache_access(cache, address, is_store, &hit);
+	m->count_hits_to_local_memory += hit;
+
+	if(hit) {
+		if(is_store && core->state[line] == STATE_S) {
+			m->count_clock_cycles += UPGRADE_CYCLES;
+			++core->upgrades;
+			log_request(core, BUS_UPGRADE, line);
+			core->state[line] = STATE_M;
+		} else if(is_store && core->state[line] == STATE_E) {
+			log_request(core, SILENT_UPGRADE, line);
+			core->state[line] = STATE_M;
+		}
+	} else {
+		// The fill replaced at most one way
+		for(way = 0; way < cache->ways; way++) {
+			if(core->set_tags[way] != tags[way]) {
+				if(core->set_tags[way] != INVALID_TAG) {
+					unsigned int evicted = (core->set_tags[way] << cache->set_shift) | set;
+
+					core->state[evicted] = STATE_I;
+					log_request(core, EVICTION, evicted);
+				}
+				break;
+			}
+		}
+		if(core->invalidated[line]) {
+			++core->coherence_misses;
+			core->invalidated[line] = 0;
+		}
+		if(is_store) {
+			core->state[line] = STATE_M;
+			log_request(core, BUS_READ_EXCLUSIVE, line);
+		} else {
+			core->state[line] = mc->mesi ? STATE_E : STATE_S;
+			for(c = 0; c < mc->count_cores && core->state[line] == STATE_E; c++) {
+				if(&mc->cores[c] != core && mc->published[c][line] != STATE_I) {
+					core->state[line] = STATE_S;
+				}
+			}
+			log_request(core, BUS_READ, line);
+		}
+	}
+
+	if(is_store) {
+		m->memory[address] = m->registers[(unsigned char) instr->operand2];
+		core->last_store[address] = m->count_executed_instructions + 1;
+	} else {
+		m->registers[(unsigned char) instr->operand1] = m->memory[address];
+	}
+	++m->count_executed_instructions;
+	return index + 1;
+}
+
+static void run_quantum(const struct multicore_t * mc, struct core_t * core)
+{
+	const struct program_t * prog = core->program;
+
+	while(!core->finished && core->machine.count_executed_instructions < mc->limit) {
+		const struct instruction_t * instr = &prog->instructions[core->index];
+
+		if(instr->operation == LD || instr->operation == ST) {
+			core->index = coherent_access(mc, core, core->index);
+		} else {
+			core->index = step_instruction(prog, &core->machine, core->index);
+		}
+		core->finished = core->index >= prog->count_instructions;
+	}
+}
+
+// Every other core loses the line; modified copies are written back first
+static void invalidate_others(struct multicore_t * mc, unsigned int requester, unsigned int line)
+{
+	unsigned int c;
+
+	for(c = 0; c < mc->count_cores; c++) {
+		if(c != requester && mc->published[c][line] != STATE_I) {
+			++mc->invalidations;
+			if(mc->published[c][line] == STATE_M) {
+				++mc->flushes;
+				++mc->cores[c].flushes;
+			}
+			mc->published[c][line] = STATE_I;
+		}
+	}
+}
+
+static void apply_request(struct multicore_t * mc, unsigned int requester, const struct bus_request_t * request)
+{
+	unsigned char * state = &mc->published[requester][request->line];
+	int shared = 0;
+	unsigned int c;
+
+	switch(request->type) {
+		case BUS_READ:
+			++mc->bus_reads;
+			for(c = 0; c < mc->count_cores; c++) {
+				unsigned char * other = &mc->published[c][request->line];
+
+				if(c == requester || *other == STATE_I) {
+					continue;
+				}
+				if(*other == STATE_M) {
+					++mc->flushes;
+					++mc->cores[c].flushes;
+				}
+				*other = STATE_S;
+				shared = 1;
+			}
+			*state = mc->mesi && !shared ? STATE_E : STATE_S;
+			break;
+		case BUS_READ_EXCLUSIVE:
+			++mc->bus_read_exclusives;
+			invalidate_others(mc, requester, request->line);
+			*state = STATE_M;
+			break;
+		case SILENT_UPGRADE:
+			// Another core read the line earlier in the quantum, so the upgrade needs the bus after
+			// all. The core is charged for it now, as it would have been at the store.
+			if(*state == STATE_E) {
+				*state = STATE_M;
+				break;
+			}
+			mc->cores[requester].machine.count_clock_cycles += UPGRADE_CYCLES;
+			++mc->cores[requester].upgrades;
+			/* fall through */
+		case BUS_UPGRADE:
+			++mc->bus_upgrades;
+			invalidate_others(mc, requester, request->line);
+			*state = STATE_M;
+			break;
+		case EVICTION:
+			*state = STATE_I;
+			break;
+	}
+}
+
+// Serial part of the barrier: replay the bus requests, update the caches and merge memory
+static void resolve_quantum(struct multicore_t * mc)
+{
+	unsigned int cursors[MAX_CORES];
+	unsigned int c;
+	unsigned int a;
+
+	memset(cursors, 0, sizeof(cursors));
+	while(1) {
+		unsigned int next = mc->count_cores;
+
+		for(c = 0; c < mc->count_cores; c++) {
+			if(cursors[c] < mc->cores[c].count_requests
+					&& (next == mc->count_cores || mc->cores[c].requests[cursors[c]].time < mc->cores[next].requests[cursors[next]].time)) {
+				next = c;
+			}
+		}
+		if(next == mc->count_cores) {
+			break;
+		}
+		apply_request(mc, next, &mc->cores[next].requests[cursors[next]++]);
+	}
+
+	for(c = 0; c < mc->count_cores; c++) {
+		struct core_t * core = &mc->cores[c];
+		struct cache_t * cache = &core->machine.cache;
+		unsigned int lines = MAIN_MEMORY_SIZE >> cache->line_shift;
+		unsigned int line;
+
+		for(line = 0; line < lines; line++) {
+			unsigned char state = mc->published[c][line];
+
+			if(state == STATE_I && core->state[line] != STATE_I) {
+				cache_invalidate(cache, line << cache->line_shift);
+				++core->invalidations;
+				core->invalidated[line] = 1;
+			} else if(state == STATE_S && core->state[line] == STATE_M) {
+				cache_clean(cache, line << cache->line_shift);
+			}
+			core->state[line] = state;
+		}
+		core->count_requests = 0;
+	}
+
+	// The latest store to each address wins; at equal times the higher core stored last
+	for(a = 0; a < MAIN_MEMORY_SIZE; a++) {
+		unsigned int latest = 0;
+		unsigned int writer = mc->count_cores;
+
+		for(c = 0; c < mc->count_cores; c++) {
+			if(mc->cores[c].last_store[a] != 0 && mc->cores[c].last_store[a] >= latest) {
+				latest = mc->cores[c].last_store[a];
+				writer = c;
+			}
+		}
+		if(writer < mc->count_cores) {
+			mc->memory[a] = mc->cores[writer].machine.memory[a];
+		}
+	}
+	mc->done = 1;
+	for(c = 0; c < mc->count_cores; c++) {
+		memcpy(mc->cores[c].machine.memory, mc->memory, sizeof(mc->memory));
+		memset(mc->cores[c].last_store, 0, sizeof(mc->cores[c].last_store));
+		mc->done &= mc->cores[c].finished;
+	}
+	mc->limit += mc->quantum;
+	++mc->count_quanta;
+}
+
+static void * core_thread(void * arg)
+{
+	struct core_worker_t * worker = arg;
+	struct multicore_t * mc = worker->mc;
+	int start;
+
+	// The barrier only opens once every core has a thread
+	pthread_mutex_lock(&mc->start_lock);
+	while(mc->start == 0) {
+		pthread_cond_wait(&mc->start_ready, &mc->start_lock);
+	}
+	start = mc->start;
+	pthread_mutex_unlock(&mc->start_lock);
+	if(start < 0) {
+		return NULL;
+	}
+	while(1) {
+		run_quantum(mc, worker->core);
+		if(pthread_barrier_wait(&mc->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			resolve_quantum(mc);
+		}
+		pthread_barrier_wait(&mc->barrier);
+		if(mc->done) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void print_core(const struct core_t * core, unsigned int c)
+{
+	const struct machine_t * m = &core->machine;
+
+	printf("Core %u: %s\n", c, core->path);
+	printf("Total number of executed instructions: %u\n", m->count_executed_instructions);
+	printf("Total number of clock cycles: %u\n", m->count_clock_cycles);
+	printf("Number of hits to local memory: %u\n", m->count_hits_to_local_memory);
+	printf("Total number of executed LD/ST instructions: %u\n", m->count_memory_accesses);
+	printf("Upgrades: %u, invalidations received: %u, flushes: %u, coherence misses: %u\n",
+		core->upgrades, core->invalidations, core->flushes, core->coherence_misses);
+}
+
+static void free_cores(struct multicore_t * mc, unsigned int count_ready)
+{
+	unsigned int c;
+
+	for(c = 0; c < count_ready; c++) {
+		free_machine(&mc->cores[c].machine);
+		free_program(mc->cores[c].program);
+		free(mc->cores[c].program);
+		free(mc->cores[c].requests);
+		free(mc->cores[c].set_tags);
+	}
+	free(mc->cores);
+}
+
+int run_multicore(char * paths, const struct memory_config_t * config, unsigned int quantum, int mesi)
+{
+	static struct multicore_t mc;
+	struct core_worker_t workers[MAX_CORES];
+	pthread_t threads[MAX_CORES];
+	unsigned int count_ready = 0;
+	unsigned int count_started = 0;
+	char * path;
+	double start;
+	unsigned int c;
+	int status = 0;
+
+	if(config->l1.write != WRITE_BACK || config->l2.size != 0) {
+		printf("Error: multi-core mode needs write-back private caches without an L2\n");
+		return -1;
+	}
+	if(quantum == 0) {
+		printf("Error: --quantum needs a positive number of instructions\n");
+		return -1;
+	}
+	memset(&mc, 0, sizeof(mc));
+	mc.quantum = quantum;
+	mc.limit = quantum;
+	mc.mesi = mesi;
+	mc.cores = calloc(MAX_CORES, sizeof(*mc.cores));
+	if(mc.cores == NULL) {
+		printf("Error: Out of memory allocating cores\n");
+		return -1;
+	}
+	for(path = strtok(paths, ","); path != NULL && status == 0; path = strtok(NULL, ",")) {
+		struct core_t * core = &mc.cores[mc.count_cores];
+
+		if(mc.count_cores == MAX_CORES) {
+			printf("Error: At most %d cores\n", MAX_CORES);
+			status = -1;
+			break;
+		}
+		core->path = path;
+		core->program = calloc(1, sizeof(*core->program));
+		if(core->program == NULL || init_machine(&core->machine, config) != 0) {
+			free(core->program);
+			status = -1;
+			break;
+		}
+		++count_ready;
+		++mc.count_cores;
+		core->requests = malloc(2 * (size_t) quantum * sizeof(*core->requests));
+		core->set_tags = malloc(core->machine.cache.ways * sizeof(*core->set_tags));
+		if(core->requests == NULL || core->set_tags == NULL) {
+			printf("Error: Out of memory allocating cores\n");
+			status = -1;
+		} else if(load_program(path, core->program) != 0) {
+			status = -1;
+		}
+		core->finished = core->program->count_instructions == 0;
+	}
+	if(status == 0 && mc.count_cores == 0) {
+		printf("Error: --cores needs at least one program\n");
+		status = -1;
+	}
+	if(status != 0) {
+		free_cores(&mc, count_ready);
+		return -1;
+	}
+
+	start = seconds_now();
+	pthread_barrier_init(&mc.barrier, NULL, mc.count_cores);
+	pthread_mutex_init(&mc.start_lock, NULL);
+	pthread_cond_init(&mc.start_ready, NULL);
+	for(c = 0; c < mc.count_cores; c++) {
+		workers[c].mc = &mc;
+		workers[c].core = &mc.cores[c];
+		if(pthread_create(&threads[c], NULL, core_thread, &workers[c]) != 0) {
+			break;
+		}
+		++count_started;
+	}
+	pthread_mutex_lock(&mc.start_lock);
+	mc.start = count_started == mc.count_cores ? 1 : -1;
+	pthread_cond_broadcast(&mc.start_ready);
+	pthread_mutex_unlock(&mc.start_lock);
+	for(c = 0; c < count_started; c++) {
+		pthread_join(threads[c], NULL);
+	}
+	pthread_barrier_destroy(&mc.barrier);
+	pthread_mutex_destroy(&mc.start_lock);
+	pthread_cond_destroy(&mc.start_ready);
+	if(count_started < mc.count_cores) {
+		printf("Error: Could not start a thread per core\n");
+		free_cores(&mc, count_ready);
+		return -1;
+	}
+
+	for(c = 0; c < mc.count_cores; c++) {
+		print_core(&mc.cores[c], c);
+	}
+	printf("Bus reads: %u, read-exclusives: %u, upgrades: %u, invalidations: %u, flushes: %u\n",
+		mc.bus_reads, mc.bus_read_exclusives, mc.bus_upgrades, mc.invalidations, mc.flushes);
+	fprintf(stderr, "%u cores on %u host threads, %u quanta of %u instructions in %.3f s\n", mc.count_cores, count_started,
+		mc.count_quanta, quantum, seconds_now() - start);
+
+	free_cores(&mc, count_ready);
+	return 0;
+}
@@ -0,0 +1,751 @@
+// Description: Optimizing execution engine (--engine=optimized).
+// Before running, the program is split into basic blocks and rewritten:
+// - constant propagation over the control flow graph, starting from the machine's registers,
+//   folds register arithmetic and comparisons and decides JEs whose outcome is fixed
+//   (conditional constant propagation: code behind a JE that never goes that way stays
+//   unreachable)
+// - instructions that change nothing (ADD Rn, 0, a MOV of the value already held) and
+//   instructions whose result is overwritten before any use (liveness, every register and
+//   CMP_VAL are live at the end of the program) are removed
+// - jumps to blocks that do nothing but jump on are threaded to the final target
+// - blocks that can no longer be reached are dropped
+// Only MOV, ADD, CMP, JE and JMP are ever removed, and each of them costs one cycle, so every
+// kept instruction carries the number of removed instructions before it and a threaded jump
+// the number it skips when taken. The interpreter adds those to both the instruction and the
+// cycle count, so every statistic, register and memory byte matches the switch engine.
+
+#include "simpleISS.h"
+
+#define COUNT_VALUES (NO_REGISTERS + 1) // registers, then CMP_VAL
+#define CMP_INDEX NO_REGISTERS
+#define ALL_LIVE ((1u << COUNT_VALUES) - 1)
+#define NO_BLOCK UINT32_MAX
+
+// Optimized operations. The first entries match enum Operation.
+enum optimized_op {OPT_MOV, OPT_ADD_REG, OPT_ADD_NUM, OPT_CMP, OPT_JE, OPT_JMP, OPT_LD, OPT_ST,
+	OPT_SET_CMP, // CMP whose result is known: CMP_VAL = number
+	OPT_CHARGE // nothing but the charge of removed instructions at the end of a block
+};
+
+struct optimized_t {
+	unsigned char op; // enum optimized_op
+	unsigned char reg1; // destination/first register index
+	unsigned char reg2; // source/second register index
+	char number; // immediate operand
+	unsigned int target; // jump target, an index in the optimized code or count_ops to stop
+	unsigned int charge; // removed one-cycle instructions just before this one
+	unsigned int taken_charge; // one-cycle instructions skipped by a threaded jump when taken
+};
+
+// Constant propagation lattice
+enum value_kind {VALUE_UNDEFINED, VALUE_CONSTANT, VALUE_VARYING};
+
+struct value_t {
+	unsigned char kind; // enum value_kind
+	char constant;
+};
+
+struct block_t {
+	unsigned int first; // instruction range [first, end)
+	unsigned int end;
+	unsigned int taken; // block of the JE/JMP target, NO_BLOCK without a jump
+	unsigned int fallthrough; // next block, NO_BLOCK after a JMP
+	int executable;
+	int taken_executable; // edges found executable by constant propagation
+	int fallthrough_executable;
+	struct value_t in[COUNT_VALUES];
+	unsigned int live_out; // bit per value
+	int reachable; // after jump threading
+	unsigned int first_op; // index in the optimized code
+};
+
+// Optimized program and the analysis behind it. Block count_blocks is the exit.
+struct optimizer_t {
+	const struct program_t * prog;
+	struct block_t * blocks;
+	unsigned int count_blocks;
+	unsigned int * block_of; // block starting at each instruction index, count_instructions + 1 entries
+	struct optimized_t * rewritten; // one per instruction
+	unsigned char * kept;
+	unsigned int * worklist;
+	unsigned char * queued;
+	struct optimized_t * code;
+	unsigned int count_ops;
+};
+
+static void * allocate(size_t count, size_t size)
+{
+	void * p = calloc(count > 0 ? count : 1, size);
+
+	if(p == NULL) {
+		printf("Error: Out of memory optimizing program\n");
+	}
+	return p;
+}
+
+static unsigned int target_block(const struct optimizer_t * o, unsigned int address)
+{
+	unsigned int index = address - o->prog->first_address;
+
+	return o->block_of[index > o->prog->count_instructions ? o->prog->count_instructions : index];
+}
+
+static int build_blocks(struct optimizer_t * o)
+{
+	const struct program_t * prog = o->prog;
+	unsigned char * is_leader = allocate(prog->count_instructions + 1, 1);
+	unsigned int i;
+
+	if(is_leader == NULL) {
+		return -1;
+	}
+	mark_block_leaders(prog, is_leader);
+	for(i = 0; i < prog->count_instructions; i++) {
+		o->count_blocks += is_leader[i];
+	}
+	o->blocks = allocate(o->count_blocks, sizeof(*o->blocks));
+	o->block_of = allocate(prog->count_instructions + 1, sizeof(*o->block_of));
+	if(o->blocks == NULL || o->block_of == NULL) {
+		free(is_leader);
+		return -1;
+	}
+	o->count_blocks = 0;
+	for(i = 0; i < prog->count_instructions; i++) {
+		if(is_leader[i]) {
+			o->blocks[o->count_blocks].first = i;
+			o->block_of[i] = o->count_blocks++;
+		}
+		o->blocks[o->count_blocks - 1].end = i + 1;
+	}
+	o->block_of[prog->count_instructions] = o->count_blocks;
+	free(is_leader);
+
+	for(i = 0; i < o->count_blocks; i++) {
+		struct block_t * block = &o->blocks[i];
+		const struct instruction_t * last = &prog->instructions[block->end - 1];
+
+		block->taken = NO_BLOCK;
+		block->fallthrough = i + 1;
+		if(last->operation == JE || last->operation == JMP) {
+			block->taken = target_block(o, last->target);
+		}
+		if(last->operation == JMP) {
+			block->fallthrough = NO_BLOCK;
+		}
+	}
+	return 0;
+}
+
+static struct value_t constant(char c)
+{
+	struct value_t value = {VALUE_CONSTANT, c};
+
+	return value;
+}
+
+static struct value_t varying(void)
+{
+	struct value_t value = {VALUE_VARYING, 0};
+
+	return value;
+}
+
+// a + b for register arithmetic
+static struct value_t add_values(struct value_t a, struct value_t b)
+{
+	if(a.kind == VALUE_CONSTANT && b.kind == VALUE_CONSTANT) {
+		return constant((char) (a.constant + b.constant));
+	}
+	if(a.kind == VALUE_UNDEFINED || b.kind == VALUE_UNDEFINED) {
+		struct value_t undefined = {VALUE_UNDEFINED, 0};
+
+		return undefined;
+	}
+	return varying();
+}
+
+static struct value_t compare_values(const struct value_t * state, const struct instruction_t * instr)
+{
+	struct value_t a = state[(unsigned char) instr->operand1];
+	struct value_t b = state[(unsigned char) instr->operand2];
+
+	if(instr->operand1 == instr->operand2) {
+		return constant(1);
+	}
+	if(a.kind == VALUE_CONSTANT && b.kind == VALUE_CONSTANT) {
+		return constant(a.constant == b.constant);
+	}
+	return varying();
+}
+
+// Effect of one instruction on the values
+static void transfer(struct value_t * state, const struct instruction_t * instr)
+{
+	struct value_t * destination = &state[(unsigned char) instr->operand1];
+
+	switch(instr->operation) {
+		case MOV:
+			*destination = constant(instr->operand2);
+			break;
+		case ADD_NUM:
+			*destination = add_values(*destination, constant(instr->operand2));
+			break;
+		case ADD_REG:
+			*destination = add_values(*destination, state[(unsigned char) instr->operand2]);
+			break;
+		case CMP:
+			state[CMP_INDEX] = compare_values(state, instr);
+			break;
+		case LD:
+			*destination = varying();
+			break;
+	}
+}
+
+// Merge the values of a new path into a block; 1 if they changed
+static int meet(struct value_t * into, const struct value_t * from)
+{
+	int changed = 0;
+	unsigned int i;
+
+	for(i = 0; i < COUNT_VALUES; i++) {
+		struct value_t merged = into[i];
+
+		if(from[i].kind == VALUE_UNDEFINED || into[i].kind == VALUE_VARYING) {
+			continue;
+		}
+		if(into[i].kind == VALUE_UNDEFINED) {
+			merged = from[i];
+		} else if(from[i].kind == VALUE_VARYING || from[i].constant != into[i].constant) {
+			merged = varying();
+		}
+		if(merged.kind != into[i].kind || merged.constant != into[i].constant) {
+			into[i] = merged;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+static void follow_edge(struct optimizer_t * o, unsigned int successor, const struct value_t * state, unsigned int * count_queued)
+{
+	struct block_t * block;
+
+	if(successor >= o->count_blocks) {
+		return; // the exit
+	}
+	block = &o->blocks[successor];
+	if((meet(block->in, state) || !block->executable) && !o->queued[successor]) {
+		o->queued[successor] = 1;
+		o->worklist[(*count_queued)++] = successor;
+	}
+	block->executable = 1;
+}
+
+// Conditional constant propagation: only edges that can be taken carry values
+static void propagate_constants(struct optimizer_t * o, const struct machine_t * m)
+{
+	unsigned int count_queued = 0;
+	unsigned int i;
+
+	for(i = 0; i < NO_REGISTERS; i++) {
+		o->blocks[0].in[i] = constant(m->registers[i]);
+	}
+	o->blocks[0].in[CMP_INDEX] = constant(m->CMP_VAL);
+	o->blocks[0].executable = 1;
+	o->worklist[count_queued++] = 0;
+	o->queued[0] = 1;
+
+	while(count_queued > 0) {
+		unsigned int b = o->worklist[--count_queued];
+		struct block_t * block = &o->blocks[b];
+		struct value_t state[COUNT_VALUES];
+		const struct instruction_t * last = &o->prog->instructions[block->end - 1];
+		int taken = block->taken != NO_BLOCK;
+		int fallthrough = block->fallthrough != NO_BLOCK;
+
+		o->queued[b] = 0;
+		memcpy(state, block->in, sizeof(state));
+		for(i = block->first; i < block->end; i++) {
+			transfer(state, &o->prog->instructions[i]);
+		}
+		if(last->operation == JE && state[CMP_INDEX].kind == VALUE_CONSTANT) {
+			taken = state[CMP_INDEX].constant != 0;
+			fallthrough = !taken;
+		}
+		if(taken) {
+			block->taken_executable = 1;
+			follow_edge(o, block->taken, state, &count_queued);
+		}
+		if(fallthrough) {
+			block->fallthrough_executable = 1;
+			follow_edge(o, block->fallthrough, state, &count_queued);
+		}
+	}
+}
+
+static struct optimized_t make_op(unsigned char op, char reg1, char reg2)
+{
+	struct optimized_t code;
+
+	memset(&code, 0, sizeof(code));
+	code.op = op;
+	code.reg1 = (unsigned char) reg1;
+	code.reg2 = (unsigned char) reg2;
+	code.number = reg2;
+	return code;
+}
+
+// Fold what the constants decide into each instruction of the executable blocks
+static void rewrite(struct optimizer_t * o)
+{
+	unsigned int b;
+	unsigned int i;
+
+	for(b = 0; b < o->count_blocks; b++) {
+		const struct block_t * block = &o->blocks[b];
+		struct value_t state[COUNT_VALUES];
+
+		if(!block->executable) {
+			continue;
+		}
+		memcpy(state, block->in, sizeof(state));
+		for(i = block->first; i < block->end; i++) {
+			const struct instruction_t * instr = &o->prog->instructions[i];
+			struct value_t before = state[(unsigned char) instr->operand1];
+			struct value_t source = state[(unsigned char) instr->operand2];
+			struct value_t compared = state[CMP_INDEX];
+			struct optimized_t * code = &o->rewritten[i];
+			int keep = 1;
+
+			transfer(state, instr);
+			*code = make_op(instr->operation, instr->operand1, instr->operand2);
+			switch(instr->operation) {
+				case MOV:
+					keep = !(before.kind == VALUE_CONSTANT && before.constant == instr->operand2);
+					break;
+				case ADD_NUM:
+				case ADD_REG:
+					if(instr->operation == ADD_REG && source.kind != VALUE_CONSTANT) {
+						break;
+					}
+					if((instr->operation == ADD_NUM ? instr->operand2 : source.constant) == 0) {
+						keep = 0;
+					} else if(state[(unsigned char) instr->operand1].kind == VALUE_CONSTANT) {
+						*code = make_op(OPT_MOV, instr->operand1, state[(unsigned char) instr->operand1].constant);
+					} else {
+						*code = make_op(OPT_ADD_NUM, instr->operand1, instr->operation == ADD_NUM ? instr->operand2 : source.constant);
+					}
+					break;
+				case CMP:
+					if(state[CMP_INDEX].kind == VALUE_CONSTANT) {
+						keep = !(compared.kind == VALUE_CONSTANT && compared.constant == state[CMP_INDEX].constant);
+						*code = make_op(OPT_SET_CMP, 0, state[CMP_INDEX].constant);
+					}
+					break;
+				case JE:
+					if(state[CMP_INDEX].kind == VALUE_CONSTANT) {
+						keep = state[CMP_INDEX].constant != 0;
+						*code = make_op(OPT_JMP, 0, 0);
+					}
+					break;
+			}
+			if(instr->operation == JE || instr->operation == JMP) {
+				code->target = o->blocks[b].taken;
+			}
+			o->kept[i] = keep;
+		}
+	}
+}
+
+// Values an operation reads and writes, as bits; 1 if it can be removed when nothing reads
+// what it writes
+static int uses_and_defines(const struct optimized_t * code, unsigned int * uses, unsigned int * defines)
+{
+	unsigned int reg1 = 1u << code->reg1;
+	unsigned int reg2 = 1u << code->reg2;
+	unsigned int cmp = 1u << CMP_INDEX;
+
+	*uses = 0;
+	*defines = 0;
+	switch(code->op) {
+		case OPT_MOV:
+			*defines = reg1;
+			return 1;
+		case OPT_ADD_NUM:
+			*uses = reg1;
+			*defines = reg1;
+			return 1;
+		case OPT_ADD_REG:
+			*uses = reg1 | reg2;
+			*defines = reg1;
+			return 1;
+		case OPT_CMP:
+			*uses = reg1 | reg2;
+			*defines = cmp;
+			return 1;
+		case OPT_SET_CMP:
+			*defines = cmp;
+			return 1;
+		case OPT_JE:
+			*uses = cmp;
+			return 0;
+		case OPT_LD:
+			*uses = reg2; // the access itself is never removable
+			*defines = reg1;
+			return 0;
+		case OPT_ST:
+			*uses = reg1 | reg2;
+			return 0;
+	}
+	return 0;
+}
+
+static unsigned int live_in(const struct optimizer_t * o, unsigned int successor)
+{
+	const struct block_t * block;
+	unsigned int live;
+	unsigned int i;
+
+	if(successor >= o->count_blocks) {
+		return ALL_LIVE; // the final state is the program's result
+	}
+	block = &o->blocks[successor];
+	live = block->live_out;
+	for(i = block->end; i-- > block->first;) {
+		unsigned int uses;
+		unsigned int defines;
+
+		if(o->kept[i]) {
+			uses_and_defines(&o->rewritten[i], &uses, &defines);
+			live = (live & ~defines) | uses;
+		}
+	}
+	return live;
+}
+
+// Liveness to a fixed point, then drop kept instructions whose results are never read; repeat
+// while that frees more
+static void remove_dead_code(struct optimizer_t * o)
+{
+	int removed = 1;
+
+	while(removed) {
+		int changed = 1;
+		unsigned int b;
+
+		while(changed) {
+			changed = 0;
+			for(b = o->count_blocks; b-- > 0;) {
+				struct block_t * block = &o->blocks[b];
+				unsigned int live = 0;
+
+				if(!block->executable) {
+					continue;
+				}
+				if(block->taken_executable) {
+					live |= live_in(o, block->taken);
+				}
+				if(block->fallthrough_executable) {
+					live |= live_in(o, block->fallthrough);
+				}
+				if(live != block->live_out) {
+					block->live_out = live;
+					changed = 1;
+				}
+			}
+		}
+
+		removed = 0;
+		for(b = 0; b < o->count_blocks; b++) {
+			const struct block_t * block = &o->blocks[b];
+			unsigned int live = block->live_out;
+			unsigned int i;
+
+			if(!block->executable) {
+				continue;
+			}
+			for(i = block->end; i-- > block->first;) {
+				unsigned int uses;
+				unsigned int defines;
+
+				if(!o->kept[i]) {
+					continue;
+				}
+				if(uses_and_defines(&o->rewritten[i], &uses, &defines) && (live & defines) == 0) {
+					o->kept[i] = 0;
+					removed = 1;
+					continue;
+				}
+				live = (live & ~defines) | uses;
+			}
+		}
+	}
+}
+
+// The block control reaches from b, following the only way out of b
+static unsigned int only_successor(const struct optimizer_t * o, unsigned int b)
+{
+	const struct block_t * block = &o->blocks[b];
+
+	return block->taken_executable ? block->taken : block->fallthrough;
+}
+
+// A block with nothing left to do but, at most, an unconditional jump
+static int is_empty_block(const struct optimizer_t * o, unsigned int b)
+{
+	const struct block_t * block = &o->blocks[b];
+	unsigned int i;
+
+	if(block->taken_executable && block->fallthrough_executable) {
+		return 0;
+	}
+	for(i = block->first; i < block->end; i++) {
+		if(o->kept[i] && !(i == block->end - 1 && o->rewritten[i].op == OPT_JMP)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Redirect a jump past empty blocks, adding their instructions to what the jump charges when
+// taken. A loop of empty blocks (a program that spins forever) is left alone.
+static void thread_jump(const struct optimizer_t * o, struct optimized_t * code)
+{
+	unsigned int target = code->target;
+	unsigned int skipped = 0;
+	unsigned int steps;
+
+	for(steps = 0; target < o->count_blocks && is_empty_block(o, target); steps++) {
+		if(steps == o->count_blocks) {
+			return;
+		}
+		skipped += o->blocks[target].end - o->blocks[target].first;
+		target = only_successor(o, target);
+	}
+	code->target = target;
+	code->taken_charge = skipped;
+}
+
+static void mark_reachable(struct optimizer_t * o)
+{
+	unsigned int count_queued = 0;
+
+	o->blocks[0].reachable = 1;
+	o->worklist[count_queued++] = 0;
+	while(count_queued > 0) {
+		const struct block_t * block = &o->blocks[o->worklist[--count_queued]];
+		unsigned int successors[2] = {NO_BLOCK, NO_BLOCK};
+		unsigned int i;
+
+		if(block->fallthrough_executable) {
+			successors[0] = block->fallthrough;
+		}
+		if(block->taken_executable && o->kept[block->end - 1]) {
+			successors[1] = o->rewritten[block->end - 1].target;
+		}
+		for(i = 0; i < 2; i++) {
+			if(successors[i] < o->count_blocks && !o->blocks[successors[i]].reachable) {
+				o->blocks[successors[i]].reachable = 1;
+				o->worklist[count_queued++] = successors[i];
+			}
+		}
+	}
+}
+
+static void emit(struct optimizer_t * o, struct optimized_t code)
+{
+	o->code[o->count_ops++] = code;
+}
+
+// Lay out the kept instructions of reachable blocks in program order
+static int emit_program(struct optimizer_t * o)
+{
+	unsigned int b;
+	unsigned int i;
+
+	o->code = allocate(o->prog->count_instructions + o->count_blocks, sizeof(*o->code));
+	if(o->code == NULL) {
+		return -1;
+	}
+	for(b = 0; b < o->count_blocks; b++) {
+		struct block_t * block = &o->blocks[b];
+		unsigned int charge = 0;
+
+		if(!block->reachable) {
+			continue;
+		}
+		block->first_op = o->count_ops;
+		for(i = block->first; i < block->end; i++) {
+			if(!o->kept[i]) {
+				charge++;
+				continue;
+			}
+			o->rewritten[i].charge = charge;
+			emit(o, o->rewritten[i]);
+			charge = 0;
+		}
+		if(charge > 0) {
+			struct optimized_t code = make_op(OPT_CHARGE, 0, 0);
+
+			code.charge = charge;
+			emit(o, code);
+		}
+	}
+	for(i = 0; i < o->count_ops; i++) {
+		struct optimized_t * code = &o->code[i];
+
+		if(code->op == OPT_JE || code->op == OPT_JMP) {
+			code->target = code->target < o->count_blocks ? o->blocks[code->target].first_op : o->count_ops;
+		}
+	}
+	return 0;
+}
+
+// Returns -1 when out of memory; free_optimizer releases whatever was allocated
+static int optimize_program(struct optimizer_t * o, const struct program_t * prog, const struct machine_t * m)
+{
+	unsigned int b;
+	unsigned int i;
+
+	memset(o, 0, sizeof(*o));
+	o->prog = prog;
+	if(prog->count_instructions == 0) {
+		return 0;
+	}
+	if(build_blocks(o) != 0) {
+		return -1;
+	}
+	o->rewritten = allocate(prog->count_instructions, sizeof(*o->rewritten));
+	o->kept = allocate(prog->count_instructions, sizeof(*o->kept));
+	o->worklist = allocate(o->count_blocks, sizeof(*o->worklist));
+	o->queued = allocate(o->count_blocks, sizeof(*o->queued));
+	if(o->rewritten == NULL || o->kept == NULL || o->worklist == NULL || o->queued == NULL) {
+		return -1;
+	}
+
+	propagate_constants(o, m);
+	rewrite(o);
+	remove_dead_code(o);
+	for(b = 0; b < o->count_blocks; b++) {
+		const struct block_t * block = &o->blocks[b];
+
+		for(i = block->first; block->executable && i < block->end; i++) {
+			if(o->kept[i] && (o->rewritten[i].op == OPT_JE || o->rewritten[i].op == OPT_JMP)) {
+				thread_jump(o, &o->rewritten[i]);
+			}
+		}
+	}
+	mark_reachable(o);
+	return emit_program(o);
+}
+
+static void free_optimizer(struct optimizer_t * o)
+{
+	free(o->blocks);
+	free(o->block_of);
+	free(o->rewritten);
+	free(o->kept);
+	free(o->worklist);
+	free(o->queued);
+	free(o->code);
+}
+
+void execute_optimized(const struct program_t * prog, struct machine_t * m)
+{
+	struct optimizer_t o;
+	register const struct optimized_t * code;
+	register unsigned int ip = 0;
+	register unsigned int count_ops;
+	register unsigned int count_executed_instructions = m->count_executed_instructions;
+	register unsigned int count_clock_cycles = m->count_clock_cycles;
+	register unsigned int count_hits_to_local_memory = m->count_hits_to_local_memory;
+	register unsigned int count_memory_accesses = m->count_memory_accesses;
+	unsigned char CMP_VAL = m->CMP_VAL;
+	char * registers = m->registers;
+	char * memory = m->memory;
+	struct cache_t * cache = &m->cache;
+
+	// Without memory for the optimizer the program still runs, unoptimized
+	if(optimize_program(&o, prog, m) != 0) {
+		free_optimizer(&o);
+		execute_switch(prog, m);
+		return;
+	}
+	code = o.code;
+	count_ops = o.count_ops;
+
+	while(ip < count_ops) {
+		const struct optimized_t * op = &code[ip];
+		unsigned char mem_address;
+		int hit;
+
+		// Removed instructions each cost one cycle
+		count_executed_instructions += op->charge + 1;
+		count_clock_cycles += op->charge;
+		++ip;
+		switch(op->op) {
+			case OPT_MOV:
+				registers[op->reg1] = op->number;
+				++count_clock_cycles;
+				break;
+			case OPT_ADD_REG:
+				registers[op->reg1] += registers[op->reg2];
+				++count_clock_cycles;
+				break;
+			case OPT_ADD_NUM:
+				registers[op->reg1] += op->number;
+				++count_clock_cycles;
+				break;
+			case OPT_CMP:
+				CMP_VAL = (registers[op->reg1] == registers[op->reg2]);
+				++count_clock_cycles;
+				break;
+			case OPT_SET_CMP:
+				CMP_VAL = op->number;
+				++count_clock_cycles;
+				break;
+			case OPT_JE:
+				if(CMP_VAL) {
+					ip = op->target;
+					count_executed_instructions += op->taken_charge;
+					count_clock_cycles += op->taken_charge;
+				}
+				++count_clock_cycles;
+				break;
+			case OPT_JMP:
+				ip = op->target;
+				count_executed_instructions += op->taken_charge;
+				count_clock_cycles += op->taken_charge + 1;
+				break;
+			case OPT_LD:
+				++count_memory_accesses;
+				mem_address = (unsigned char) registers[op->reg2];
+
+				count_clock_cycles += cache_access(cache, mem_address, 0, &hit);
+				count_hits_to_local_memory += hit;
+
+				registers[op->reg1] = memory[mem_address];
+				break;
+			case OPT_ST:
+				++count_memory_accesses;
+				mem_address = (unsigned char) registers[op->reg1];
+
+				count_clock_cycles += cache_access(cache, mem_address, 1, &hit);
+				count_hits_to_local_memory += hit;
+
+				memory[mem_address] = registers[op->reg2];
+				break;
+			case OPT_CHARGE:
+				--count_executed_instructions; // not an instruction itself
+				break;
+		}
+	}
+
+	m->count_executed_instructions = count_executed_instructions;
+	m->count_clock_cycles = count_clock_cycles;
+	m->count_hits_to_local_memory = count_hits_to_local_memory;
+	m->count_memory_accesses = count_memory_accesses;
+	m->CMP_VAL = CMP_VAL;
+	free_optimizer(&o);
+}
@@ -0,0 +1,459 @@
+// Description: Assembly loaders.
+// load_program() maps the input file and decodes every line in a single left-to-right scan.
+// load_program_sscanf() is the original loader that tries one sscanf pattern per instruction
+// form; it is kept for comparison by the --bench-parse load-throughput benchmark.
+// Load errors are reported on stderr, so callers that print results on stdout, such as batch
+// mode, keep it clean.
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+void clear_program(struct program_t * prog)
+{
+	if(prog->mapping != NULL) {
+		free_program(prog);
+	}
+	if(prog->instructions == NULL) {
+		prog->instructions = prog->initial_store;
+		prog->capacity = INITIAL_NO_INSTRUCTIONS;
+	}
+	prog->count_instructions = 0;
+	prog->first_address = 0;
+}
+
+int append_instruction(struct program_t * prog, const struct instruction_t * instr)
+{
+	if(prog->count_instructions == prog->capacity) {
+		struct instruction_t * grown;
+
+		if(prog->capacity > 0x7FFFFFFF) {
+			fprintf(stderr, "Error: too many instructions\n");
+			return -1;
+		}
+		if(prog->instructions == prog->initial_store) {
+			grown = malloc(2 * (size_t) prog->capacity * sizeof(*grown));
+			if(grown != NULL) {
+				memcpy(grown, prog->instructions, prog->count_instructions * sizeof(*grown));
+			}
+		} else {
+			grown = realloc(prog->instructions, 2 * (size_t) prog->capacity * sizeof(*grown));
+		}
+		if(grown == NULL) {
+			fprintf(stderr, "Error: Out of memory storing program\n");
+			return -1;
+		}
+		prog->instructions = grown;
+		prog->capacity *= 2;
+	}
+	prog->instructions[prog->count_instructions++] = *instr;
+	return 0;
+}
+
+void free_program(struct program_t * prog)
+{
+	if(prog->mapping != NULL) {
+		munmap(prog->mapping, prog->mapping_size);
+		prog->mapping = NULL;
+	} else if(prog->instructions != prog->initial_store) {
+		free(prog->instructions);
+	}
+	prog->instructions = NULL;
+	prog->count_instructions = 0;
+	prog->capacity = 0;
+}
+
+// Hand the instructions of from over to to, releasing what to held; from is left empty
+void move_program(struct program_t * to, struct program_t * from)
+{
+	free_program(to);
+	*to = *from;
+	if(from->instructions == from->initial_store) {
+		to->instructions = to->initial_store;
+	}
+	from->instructions = NULL;
+	from->count_instructions = 0;
+	from->capacity = 0;
+	from->mapping = NULL;
+}
+
+// Cursor over the line being decoded
+struct scanner_t {
+	const char * p;
+	const char * end;
+	unsigned int line;
+};
+
+static void skip_blanks(struct scanner_t * s)
+{
+	while(s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\r')) {
+		++s->p;
+	}
+}
+
+static int parse_error(const struct scanner_t * s, const char * msg)
+{
+	fprintf(stderr, "Error: line %u: %s\n", s->line, msg);
+	return -1;
+}
+
+// Consume the character c, allowing blanks in front of it
+static int expect(struct scanner_t * s, char c)
+{
+	skip_blanks(s);
+	if(s->p < s->end && *s->p == c) {
+		++s->p;
+		return 0;
+	}
+	return -1;
+}
+
+// Optionally signed decimal number
+static int scan_number(struct scanner_t * s, long * value)
+{
+	int negative = 0;
+	long n = 0;
+
+	skip_blanks(s);
+	if(s->p < s->end && (*s->p == '-' || *s->p == '+')) {
+		negative = (*s->p == '-');
+		++s->p;
+	}
+	if(s->p >= s->end || *s->p < '0' || *s->p > '9') {
+		return -1;
+	}
+	while(s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+		if(n < 0x7FFFFFFF) {
+			n = n * 10 + (*s->p - '0');
+		}
+		++s->p;
+	}
+	*value = negative ? -n : n;
+	return 0;
+}
+
+// Rn, returned as a register index
+static int scan_register(struct scanner_t * s, char * reg)
+{
+	long n;
+
+	if(expect(s, 'R') != 0) {
+		return parse_error(s, "expected a register");
+	}
+	if(scan_number(s, &n) != 0 || n < 1 || n > NO_REGISTERS) {
+		return parse_error(s, "register must be R1 to R6");
+	}
+	*reg = (char) (n - 1);
+	return 0;
+}
+
+// Immediate operand, anything that fits in a byte
+static int scan_immediate(struct scanner_t * s, char * number)
+{
+	long n;
+
+	if(scan_number(s, &n) != 0) {
+		return parse_error(s, "expected a number");
+	}
+	if(n < -128 || n > 255) {
+		return parse_error(s, "immediate does not fit in 8 bits");
+	}
+	*number = (char) n;
+	return 0;
+}
+
+static int scan_comma(struct scanner_t * s)
+{
+	return expect(s, ',') == 0 ? 0 : parse_error(s, "expected ','");
+}
+
+// Decode the instruction on one line. Returns 0 on success, 1 for a blank line, -1 on error.
+static int decode_line(struct scanner_t * s, struct instruction_t * instr, unsigned int * address)
+{
+	const char * opcode;
+	size_t length;
+	long n;
+
+	skip_blanks(s);
+	if(s->p == s->end) {
+		return 1;
+	}
+	if(scan_number(s, &n) != 0 || n < 0) {
+		return parse_error(s, "expected an instruction address");
+	}
+	*address = (unsigned int) n;
+
+	skip_blanks(s);
+	opcode = s->p;
+	while(s->p < s->end && *s->p >= 'A' && *s->p <= 'Z') {
+		++s->p;
+	}
+	length = s->p - opcode;
+
+	instr->operand1 = 0;
+	instr->operand2 = 0;
+	instr->reserved = 0;
+	instr->target = 0;
+	if(length == 3 && memcmp(opcode, "MOV", 3) == 0) {
+		// MOV Rn, <num>
+		instr->operation = MOV;
+		if(scan_register(s, &instr->operand1) || scan_comma(s) || scan_immediate(s, &instr->operand2)) {
+			return -1;
+		}
+	} else if(length == 3 && memcmp(opcode, "ADD", 3) == 0) {
+		// ADD Rn, Rm or ADD Rn, <num>
+		if(scan_register(s, &instr->operand1) || scan_comma(s)) {
+			return -1;
+		}
+		skip_blanks(s);
+		if(s->p < s->end && *s->p == 'R') {
+			instr->operation = ADD_REG;
+			if(scan_register(s, &instr->operand2)) {
+				return -1;
+			}
+		} else {
+			instr->operation = ADD_NUM;
+			if(scan_immediate(s, &instr->operand2)) {
+				return -1;
+			}
+		}
+	} else if(length == 3 && memcmp(opcode, "CMP", 3) == 0) {
+		// CMP Rn, Rm
+		instr->operation = CMP;
+		if(scan_register(s, &instr->operand1) || scan_comma(s) || scan_register(s, &instr->operand2)) {
+			return -1;
+		}
+	} else if((length == 2 && memcmp(opcode, "JE", 2) == 0) || (length == 3 && memcmp(opcode, "JMP", 3) == 0)) {
+		// JE <address> / JMP <address>
+		instr->operation = length == 2 ? JE : JMP;
+		if(scan_number(s, &n) != 0 || n < 0) {
+			return parse_error(s, "expected a jump address");
+		}
+		instr->target = (unsigned int) n;
+	} else if(length == 2 && memcmp(opcode, "LD", 2) == 0) {
+		// LD Rn, [Rm]
+		instr->operation = LD;
+		if(scan_register(s, &instr->operand1) || scan_comma(s)) {
+			return -1;
+		}
+		if(expect(s, '[') || scan_register(s, &instr->operand2) || expect(s, ']')) {
+			return parse_error(s, "expected [Rm]");
+		}
+	} else if(length == 2 && memcmp(opcode, "ST", 2) == 0) {
+		// ST [Rm], Rn
+		instr->operation = ST;
+		if(expect(s, '[') || scan_register(s, &instr->operand1) || expect(s, ']')) {
+			return parse_error(s, "expected [Rm]");
+		}
+		if(scan_comma(s) || scan_register(s, &instr->operand2)) {
+			return -1;
+		}
+	} else {
+		return parse_error(s, "unknown instruction");
+	}
+
+	skip_blanks(s);
+	if(s->p != s->end) {
+		return parse_error(s, "unexpected text after instruction");
+	}
+	return 0;
+}
+
+// Decode a whole assembly text held in memory
+int parse_program(const char * text, size_t size, struct program_t * prog)
+{
+	struct scanner_t s;
+	const char * end = text + size;
+	const char * next;
+
+	clear_program(prog);
+	s.line = 0;
+
+	for(s.p = text; s.p < end; s.p = next) {
+		struct instruction_t instr;
+		unsigned int address;
+		int status;
+
+		s.end = memchr(s.p, '\n', end - s.p);
+		if(s.end == NULL) {
+			s.end = end;
+		}
+		next = s.end + 1;
+		++s.line;
+
+		status = decode_line(&s, &instr, &address);
+		if(status < 0) {
+			return -1;
+		} else if(status > 0) {
+			continue;
+		}
+
+		// Store the value of the first instruction address, the rest must follow it
+		if(prog->count_instructions == 0) {
+			prog->first_address = address;
+		} else if(address != prog->first_address + prog->count_instructions) {
+			return parse_error(&s, "instruction address is out of sequence");
+		}
+		if(append_instruction(prog, &instr) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Map the assembly file and decode it
+int load_program(const char * path, struct program_t * prog)
+{
+	struct stat st;
+	void * text;
+	int status;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error: Assembly input file can't be open for reading\n");
+		if(fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return parse_program("", 0, prog);
+	}
+
+	text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(text == MAP_FAILED) {
+		fprintf(stderr, "Error: Assembly input file can't be mapped\n");
+		return -1;
+	}
+	madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+	status = parse_program(text, st.st_size, prog);
+	munmap(text, st.st_size);
+	return status;
+}
+
+// Original loader: try each instruction pattern with sscanf in turn
+int load_program_sscanf(const char * path, struct program_t * prog)
+{
+	FILE * restrict fptr; // file pointer for assembly input text file
+	struct instruction_t instr;
+	char line[256];
+
+	// Open assembly file
+	fptr = fopen(path, "r");
+	if(fptr == NULL) {
+		fprintf(stderr, "Error: Assembly input file can't be open for reading\n");
+		return -1;
+	}
+
+	clear_program(prog);
+	while(fgets(line, sizeof(line), fptr)) {
+		unsigned int address;
+		unsigned int reg1;
+		unsigned int reg2;
+		int number;
+
+		memset(&instr, 0, sizeof(instr));
+
+		// Mov Rn, <num>
+		if(sscanf(line, "%d MOV R%d, %d", &address, &reg1, &number) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = number;
+			instr.operation = MOV;
+		// ADD Rn, Rm
+		} else if(sscanf(line, "%d ADD R%d, R%d", &address, &reg1, &reg2) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = reg2 - 1;
+			instr.operation = ADD_REG;
+		// ADD Rn, <num>
+		} else if(sscanf(line, "%d ADD R%d, %d", &address, &reg1, &number) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = number;
+			instr.operation = ADD_NUM;
+			// CMP Rn, Rm
+		} else if(sscanf(line, "%d CMP R%d, R%d", &address, &reg1, &reg2) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = reg2 - 1;
+			instr.operation = CMP;
+
+		// JE <address>
+		} else if (sscanf(line, "%d JE %d", &address, &number) == 2) {
+			instr.target = number;
+			instr.operation = JE;
+		// JMP <address>
+		} else if (sscanf(line, "%d JMP %d", &address, &number) == 2) {
+			instr.target = number;
+			instr.operation = JMP;
+		// LD Rn, [Rm]
+		} else if(sscanf(line, "%d LD R%d, [R%d]", &address, &reg1, &reg2) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = reg2 - 1;
+			instr.operation = LD;
+		// ST [Rm], Rn
+		} else if(sscanf(line, "%d ST [R%d], R%d", &address, &reg1, &reg2) == 3) {
+			instr.operand1 = reg1 - 1;
+			instr.operand2 = reg2 - 1;
+			instr.operation = ST;
+		} else {
+			fprintf(stderr, "Unknown instruction: \"%s\" ", line);
+			fclose(fptr);
+			return -1;
+		}
+
+		// Store the value of the first instruction address
+		if(prog->count_instructions == 0) {
+			prog->first_address = address;
+		}
+		if(append_instruction(prog, &instr) != 0) {
+			fclose(fptr);
+			return -1;
+		}
+	}
+
+	fclose(fptr); // close file
+	return 0;
+}
+
+// Load the file repeatedly for at least half a second and set *rate to the lines loaded per second
+static int measure_loader(int (*load)(const char *, struct program_t *), const char * path, struct program_t * prog, double * rate)
+{
+	double start = seconds_now();
+	double elapsed;
+	unsigned long lines = 0;
+
+	do {
+		if(load(path, prog) != 0) {
+			return -1;
+		}
+		lines += prog->count_instructions;
+		elapsed = seconds_now() - start;
+	} while(elapsed < 0.5);
+
+	*rate = lines / elapsed;
+	return 0;
+}
+
+// Compare load throughput of the sscanf cascade and the single-pass scanner
+int benchmark_parsers(const char * path)
+{
+	static struct program_t prog;
+	double sscanf_rate;
+	double scanner_rate;
+
+	if(measure_loader(load_program_sscanf, path, &prog, &sscanf_rate) != 0
+			|| measure_loader(load_program, path, &prog, &scanner_rate) != 0) {
+		free_program(&prog);
+		return -1;
+	}
+	printf("Program: %s (%u instructions)\n", path, prog.count_instructions);
+	printf("sscanf loader: %.0f lines/s\n", sscanf_rate);
+	printf("single-pass loader: %.0f lines/s\n", scanner_rate);
+	printf("Speedup: %.2fx\n", scanner_rate / sscanf_rate);
+	free_program(&prog);
+	return 0;
+}
@@ -0,0 +1,104 @@
+// Description: Host hardware counters for the simulator's own parse and execute phases.
+// Each event is opened on its own through perf_event_open, user space only, so an event the
+// host or its permissions do not support is reported as n/a without losing the others.
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+static const struct {
+	const char * name;
+	unsigned int type;
+	unsigned long long config;
+} perf_events[COUNT_PERF_EVENTS] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"L1d-misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}, // also on hosts without a PMU
+};
+
+int open_perf_counters(struct perf_counters_t * p)
+{
+	unsigned int count_open = 0;
+	unsigned int i;
+
+	for(i = 0; i < COUNT_PERF_EVENTS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		p->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		count_open += p->fds[i] >= 0;
+	}
+	if(count_open == 0) {
+		printf("Error: No host performance counters available (check perf_event_paranoid)\n");
+		return -1;
+	}
+	return 0;
+}
+
+void start_perf_counters(struct perf_counters_t * p)
+{
+	unsigned int i;
+
+	for(i = 0; i < COUNT_PERF_EVENTS; i++) {
+		if(p->fds[i] >= 0) {
+			ioctl(p->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(p->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void stop_perf_counters(struct perf_counters_t * p, struct perf_sample_t * sample)
+{
+	unsigned int i;
+
+	for(i = 0; i < COUNT_PERF_EVENTS; i++) {
+		sample->valid[i] = 0;
+		if(p->fds[i] >= 0) {
+			ioctl(p->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			sample->valid[i] = read(p->fds[i], &sample->values[i], sizeof(sample->values[i])) == sizeof(sample->values[i]);
+		}
+	}
+}
+
+void close_perf_counters(struct perf_counters_t * p)
+{
+	unsigned int i;
+
+	for(i = 0; i < COUNT_PERF_EVENTS; i++) {
+		if(p->fds[i] >= 0) {
+			close(p->fds[i]);
+		}
+		p->fds[i] = -1;
+	}
+}
+
+void print_perf_sample(const char * phase, const struct perf_sample_t * sample, unsigned int count_simulated_instructions)
+{
+	unsigned int i;
+
+	printf("Host %s:", phase);
+	for(i = 0; i < COUNT_PERF_EVENTS; i++) {
+		if(sample->valid[i]) {
+			printf(" %s %llu%s", perf_events[i].name, (unsigned long long) sample->values[i], i + 1 < COUNT_PERF_EVENTS ? "," : "");
+		} else {
+			printf(" %s n/a%s", perf_events[i].name, i + 1 < COUNT_PERF_EVENTS ? "," : "");
+		}
+	}
+	printf("\n");
+	if(sample->valid[PERF_CYCLES] && count_simulated_instructions > 0) {
+		printf("Host %s cycles per simulated instruction: %.2f\n", phase,
+			(double) sample->values[PERF_CYCLES] / count_simulated_instructions);
+	}
+}
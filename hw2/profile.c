@@ -0,0 +1,192 @@
+// Description: Per-instruction and per-basic-block execution profiler.
+// execute_profiled is a separate engine: it steps through the program and charges the
+// instruction count, cycles and LD/ST hits/misses of every step to its instruction. The other
+// engines are untouched, so profiling costs nothing unless it is selected. Blocks are
+// aggregated afterwards for a hotspot report or a folded-stack file for flamegraph.pl.
+
+#include "simpleISS.h"
+
+#define PROFILE_TOP_ENTRIES 20 // rows of each hotspot table
+
+static const char * const mnemonics[] = {"MOV", "ADD", "ADD", "CMP", "JE", "JMP", "LD", "ST"};
+
+// Totals of one basic block, instructions first..last
+struct profile_block_t {
+	unsigned int first;
+	unsigned int last;
+	struct profile_entry_t total;
+};
+
+int init_profile(const struct program_t * prog, struct profile_t * profile)
+{
+	profile->count_entries = prog->count_instructions;
+	profile->entries = calloc(prog->count_instructions + 1, sizeof(*profile->entries));
+	if(profile->entries == NULL) {
+		printf("Error: Out of memory allocating profile\n");
+		return -1;
+	}
+	return 0;
+}
+
+void free_profile(struct profile_t * profile)
+{
+	free(profile->entries);
+	profile->entries = NULL;
+	profile->count_entries = 0;
+}
+
+void execute_profiled(const struct program_t * prog, struct machine_t * m, struct profile_t * profile)
+{
+	unsigned int index = 0;
+
+	while(index < prog->count_instructions) {
+		struct profile_entry_t * entry = &profile->entries[index];
+		unsigned int cycles = m->count_clock_cycles;
+		unsigned int hits = m->count_hits_to_local_memory;
+		unsigned int accesses = m->count_memory_accesses;
+
+		index = step_instruction(prog, m, index);
+
+		++entry->count_executions;
+		entry->count_clock_cycles += m->count_clock_cycles - cycles;
+		entry->count_hits += m->count_hits_to_local_memory - hits;
+		entry->count_misses += (m->count_memory_accesses - accesses) - (m->count_hits_to_local_memory - hits);
+	}
+}
+
+static void add_entry(struct profile_entry_t * total, const struct profile_entry_t * entry)
+{
+	total->count_executions += entry->count_executions;
+	total->count_clock_cycles += entry->count_clock_cycles;
+	total->count_hits += entry->count_hits;
+	total->count_misses += entry->count_misses;
+}
+
+// Block totals; the executions of a block are those of its first instruction
+static struct profile_block_t * profile_blocks(const struct program_t * prog, const struct profile_t * profile, unsigned int * count_blocks)
+{
+	unsigned char * is_leader = calloc(prog->count_instructions + 1, 1);
+	struct profile_block_t * blocks = malloc((prog->count_instructions + 1) * sizeof(*blocks));
+	unsigned int i;
+
+	*count_blocks = 0;
+	if(is_leader == NULL || blocks == NULL) {
+		printf("Error: Out of memory building profile\n");
+		free(is_leader);
+		free(blocks);
+		return NULL;
+	}
+	mark_block_leaders(prog, is_leader);
+	for(i = 0; i < prog->count_instructions; i++) {
+		struct profile_block_t * block = &blocks[*count_blocks - (is_leader[i] ? 0 : 1)];
+
+		if(is_leader[i]) {
+			block->first = i;
+			memset(&block->total, 0, sizeof(block->total));
+			block->total.count_executions = profile->entries[i].count_executions;
+			++*count_blocks;
+		}
+		block->last = i;
+		block->total.count_clock_cycles += profile->entries[i].count_clock_cycles;
+		block->total.count_hits += profile->entries[i].count_hits;
+		block->total.count_misses += profile->entries[i].count_misses;
+	}
+	free(is_leader);
+	return blocks;
+}
+
+static int compare_blocks(const void * a, const void * b)
+{
+	unsigned int cycles_a = ((const struct profile_block_t *) a)->total.count_clock_cycles;
+	unsigned int cycles_b = ((const struct profile_block_t *) b)->total.count_clock_cycles;
+
+	return cycles_a < cycles_b ? 1 : cycles_a > cycles_b ? -1 : 0;
+}
+
+static double percent(unsigned int part, unsigned int total)
+{
+	return total == 0 ? 0.0 : 100.0 * part / total;
+}
+
+void print_profile(const struct program_t * prog, const struct profile_t * profile)
+{
+	struct profile_entry_t total;
+	struct profile_block_t * blocks;
+	struct profile_block_t * instructions;
+	unsigned int count_blocks;
+	unsigned int i;
+
+	blocks = profile_blocks(prog, profile, &count_blocks);
+	instructions = malloc((prog->count_instructions + 1) * sizeof(*instructions));
+	if(blocks == NULL || instructions == NULL) {
+		free(blocks);
+		free(instructions);
+		return;
+	}
+	memset(&total, 0, sizeof(total));
+	for(i = 0; i < prog->count_instructions; i++) {
+		add_entry(&total, &profile->entries[i]);
+		instructions[i].first = i;
+		instructions[i].last = i;
+		instructions[i].total = profile->entries[i];
+	}
+	qsort(blocks, count_blocks, sizeof(*blocks), compare_blocks);
+	qsort(instructions, prog->count_instructions, sizeof(*instructions), compare_blocks);
+
+	printf("\nHottest basic blocks by clock cycles:\n");
+	printf("%10s %10s %12s %12s %7s %10s %10s\n", "first", "last", "executions", "cycles", "%", "hits", "misses");
+	for(i = 0; i < count_blocks && i < PROFILE_TOP_ENTRIES && blocks[i].total.count_clock_cycles > 0; i++) {
+		printf("%10u %10u %12u %12u %6.2f%% %10u %10u\n", prog->first_address + blocks[i].first, prog->first_address + blocks[i].last,
+			blocks[i].total.count_executions, blocks[i].total.count_clock_cycles,
+			percent(blocks[i].total.count_clock_cycles, total.count_clock_cycles),
+			blocks[i].total.count_hits, blocks[i].total.count_misses);
+	}
+
+	printf("\nHottest instructions by clock cycles:\n");
+	printf("%10s %4s %12s %12s %7s %10s %10s\n", "address", "op", "executions", "cycles", "%", "hits", "misses");
+	for(i = 0; i < prog->count_instructions && i < PROFILE_TOP_ENTRIES && instructions[i].total.count_clock_cycles > 0; i++) {
+		const struct profile_entry_t * entry = &instructions[i].total;
+
+		printf("%10u %4s %12u %12u %6.2f%% %10u %10u\n", prog->first_address + instructions[i].first,
+			mnemonics[prog->instructions[instructions[i].first].operation], entry->count_executions,
+			entry->count_clock_cycles, percent(entry->count_clock_cycles, total.count_clock_cycles),
+			entry->count_hits, entry->count_misses);
+	}
+
+	free(blocks);
+	free(instructions);
+}
+
+// One "simpleISS;block_<first>;<address>_<op> <cycles>" line per executed instruction
+int write_folded_profile(const char * path, const struct program_t * prog, const struct profile_t * profile)
+{
+	FILE * file = fopen(path, "w");
+	unsigned char * is_leader = calloc(prog->count_instructions + 1, 1);
+	unsigned int block = 0;
+	unsigned int i;
+
+	if(file == NULL || is_leader == NULL) {
+		printf("Error: Could not write profile %s\n", path);
+		if(file != NULL) {
+			fclose(file);
+		}
+		free(is_leader);
+		return -1;
+	}
+	mark_block_leaders(prog, is_leader);
+	for(i = 0; i < prog->count_instructions; i++) {
+		if(is_leader[i]) {
+			block = prog->first_address + i;
+		}
+		if(profile->entries[i].count_clock_cycles > 0) {
+			fprintf(file, "simpleISS;block_%u;%u_%s %u\n", block, prog->first_address + i,
+				mnemonics[prog->instructions[i].operation], profile->entries[i].count_clock_cycles);
+		}
+	}
+	free(is_leader);
+	if(fclose(file) != 0) {
+		printf("Error: Could not write profile %s\n", path);
+		return -1;
+	}
+	return 0;
+}
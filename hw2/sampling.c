@@ -0,0 +1,710 @@
+// Description: Sampled simulation with basic-block vectors (SimPoint).
+// A functional pass runs the program without the cache model. For every interval of a fixed
+// number of instructions it records how often each basic block executed and the architectural
+// state at the interval start. Registers, CMP_VAL and memory fit in a few hundred bytes, so
+// every interval can be restarted later. The block vectors are randomly projected to a few
+// dimensions and clustered with k-means; k is the smallest whose BIC reaches 90% of the best
+// score. Each cluster is simulated in detail on the interval nearest its centroid and on
+// further members drawn at random, each after warmup intervals that fill the caches. The
+// per-instruction cycle and hit rates are scaled by the instructions of each cluster
+// (stratified sampling), and the spread of the rates within the clusters gives a 95% error
+// bound. That bound says nothing about cache state a too short warmup misses, so the warmup is
+// raised until its LD/STs, at the program's average rate, could fill every cache line.
+// Instruction and LD/ST counts come from the functional pass and are exact.
+
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include "simpleISS.h"
+
+#define SAMPLE_DIMENSIONS 15 // projected dimensions, as in SimPoint
+#define SAMPLE_KMEANS_SEEDS 3 // k-means++ initializations tried per k
+#define SAMPLE_KMEANS_ITERATIONS 100
+#define SAMPLE_BIC_THRESHOLD 0.9
+
+// Architectural state at the start of an interval
+struct sample_state_t {
+	unsigned int index;
+	char registers[NO_REGISTERS];
+	unsigned char CMP_VAL;
+	char memory[MAIN_MEMORY_SIZE];
+};
+
+// Functional pass results, one entry per interval
+struct sample_run_t {
+	struct sample_state_t * states;
+	double * vectors; // SAMPLE_DIMENSIONS per interval, normalized by the interval length
+	unsigned int * lengths; // executed instructions
+	unsigned int count_intervals;
+	unsigned int capacity;
+	unsigned int count_executed_instructions;
+	unsigned int count_memory_accesses;
+};
+
+struct sample_clusters_t {
+	unsigned int k;
+	unsigned int * assignment; // cluster of each interval
+	double * centroids; // SAMPLE_DIMENSIONS per cluster
+	double sse; // sum of squared distances to the centroids
+};
+
+static unsigned int next_random(unsigned int * state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static int grow_run(struct sample_run_t * run)
+{
+	unsigned int capacity = run->capacity == 0 ? 64 : 2 * run->capacity;
+	struct sample_state_t * states = realloc(run->states, capacity * sizeof(*states));
+	double * vectors = states == NULL ? NULL : realloc(run->vectors, capacity * SAMPLE_DIMENSIONS * sizeof(*vectors));
+	unsigned int * lengths = vectors == NULL ? NULL : realloc(run->lengths, capacity * sizeof(*lengths));
+
+	// Keep whatever was moved so free_run releases it
+	if(states != NULL) {
+		run->states = states;
+	}
+	if(vectors != NULL) {
+		run->vectors = vectors;
+	}
+	if(lengths == NULL) {
+		printf("Error: Out of memory recording sample intervals\n");
+		return -1;
+	}
+	run->lengths = lengths;
+	run->capacity = capacity;
+	return 0;
+}
+
+static void free_run(struct sample_run_t * run)
+{
+	free(run->states);
+	free(run->vectors);
+	free(run->lengths);
+}
+
+// Fixed pseudo-random projection weight in [-1, 1] of block b onto dimension d
+static double projection(unsigned int b, unsigned int d)
+{
+	unsigned int state = (b * SAMPLE_DIMENSIONS + d) * 2654435761u + 1;
+
+	next_random(&state);
+	next_random(&state);
+	return (double) next_random(&state) / 2147483647.5 - 1.0;
+}
+
+// Project the block counts of the interval just finished and clear them
+static void close_interval(struct sample_run_t * run, unsigned int * counts, unsigned int * touched, unsigned int count_touched,
+	const double * weights)
+{
+	unsigned int interval = run->count_intervals - 1;
+	double * vector = run->vectors + (size_t) interval * SAMPLE_DIMENSIONS;
+	unsigned int i;
+	unsigned int d;
+
+	memset(vector, 0, SAMPLE_DIMENSIONS * sizeof(*vector));
+	for(i = 0; i < count_touched; i++) {
+		unsigned int b = touched[i];
+
+		for(d = 0; d < SAMPLE_DIMENSIONS; d++) {
+			vector[d] += counts[b] * weights[(size_t) b * SAMPLE_DIMENSIONS + d];
+		}
+		counts[b] = 0;
+	}
+	for(d = 0; d < SAMPLE_DIMENSIONS; d++) {
+		vector[d] /= run->lengths[interval];
+	}
+}
+
+// Execute the program without caches, cutting it into intervals
+static int functional_pass(const struct program_t * prog, unsigned int interval, struct sample_run_t * run)
+{
+	unsigned char * is_leader = calloc(prog->count_instructions + 1, 1);
+	unsigned int * block_of = malloc((prog->count_instructions + 1) * sizeof(*block_of));
+	unsigned int * counts = calloc(prog->count_instructions + 1, sizeof(*counts));
+	unsigned int * touched = malloc((prog->count_instructions + 1) * sizeof(*touched));
+	double * weights;
+	unsigned int count_blocks = 0;
+	unsigned int count_touched = 0;
+	unsigned int boundary = 0;
+	unsigned int index = 0;
+	unsigned int executed = 0;
+	unsigned int accesses = 0;
+	unsigned char CMP_VAL = 0;
+	char registers[NO_REGISTERS];
+	char memory[MAIN_MEMORY_SIZE];
+	unsigned int i;
+
+	if(is_leader == NULL || block_of == NULL || counts == NULL || touched == NULL) {
+		printf("Error: Out of memory collecting basic-block vectors\n");
+		free(is_leader);
+		free(block_of);
+		free(counts);
+		free(touched);
+		return -1;
+	}
+	mark_block_leaders(prog, is_leader);
+	for(i = 0; i < prog->count_instructions; i++) {
+		count_blocks += is_leader[i];
+		block_of[i] = count_blocks - 1;
+	}
+	free(is_leader);
+	weights = malloc(((size_t) count_blocks + 1) * SAMPLE_DIMENSIONS * sizeof(*weights));
+	if(weights == NULL) {
+		printf("Error: Out of memory collecting basic-block vectors\n");
+		free(block_of);
+		free(counts);
+		free(touched);
+		return -1;
+	}
+	for(i = 0; i < count_blocks * SAMPLE_DIMENSIONS; i++) {
+		weights[i] = projection(i / SAMPLE_DIMENSIONS, i % SAMPLE_DIMENSIONS);
+	}
+
+	memset(registers, 0, sizeof(registers));
+	memset(memory, 0, sizeof(memory));
+	while(index < prog->count_instructions) {
+		const struct instruction_t * instr = &prog->instructions[index];
+		unsigned int next = index + 1;
+		unsigned int b = block_of[index];
+
+		// Start a new interval: finish the previous one and remember where this one begins
+		if(executed == boundary) {
+			struct sample_state_t * state;
+
+			if(run->count_intervals > 0) {
+				run->lengths[run->count_intervals - 1] = executed - (boundary - interval);
+				close_interval(run, counts, touched, count_touched, weights);
+				count_touched = 0;
+			}
+			if(run->count_intervals == run->capacity && grow_run(run) != 0) {
+				free(block_of);
+				free(counts);
+				free(touched);
+				free(weights);
+				return -1;
+			}
+			state = &run->states[run->count_intervals];
+			state->index = index;
+			memcpy(state->registers, registers, sizeof(registers));
+			state->CMP_VAL = CMP_VAL;
+			memcpy(state->memory, memory, sizeof(memory));
+			++run->count_intervals;
+			boundary += interval;
+		}
+
+		if(counts[b]++ == 0) {
+			touched[count_touched++] = b;
+		}
+		switch(instr->operation) {
+			case MOV:
+				registers[(unsigned char) instr->operand1] = instr->operand2;
+				break;
+			case ADD_REG:
+				registers[(unsigned char) instr->operand1] += registers[(unsigned char) instr->operand2];
+				break;
+			case ADD_NUM:
+				registers[(unsigned char) instr->operand1] += instr->operand2;
+				break;
+			case CMP:
+				CMP_VAL = registers[(unsigned char) instr->operand1] == registers[(unsigned char) instr->operand2];
+				break;
+			case JE:
+				if(CMP_VAL) {
+					next = instr->target - prog->first_address;
+				}
+				break;
+			case JMP:
+				next = instr->target - prog->first_address;
+				break;
+			case LD:
+				registers[(unsigned char) instr->operand1] = memory[(unsigned char) registers[(unsigned char) instr->operand2]];
+				++accesses;
+				break;
+			case ST:
+				memory[(unsigned char) registers[(unsigned char) instr->operand1]] = registers[(unsigned char) instr->operand2];
+				++accesses;
+				break;
+		}
+		++executed;
+		index = next > prog->count_instructions ? prog->count_instructions : next;
+	}
+	if(run->count_intervals > 0) {
+		run->lengths[run->count_intervals - 1] = executed - (boundary - interval);
+		close_interval(run, counts, touched, count_touched, weights);
+	}
+	run->count_executed_instructions = executed;
+	run->count_memory_accesses = accesses;
+
+	free(block_of);
+	free(counts);
+	free(touched);
+	free(weights);
+	return 0;
+}
+
+static double distance2(const double * a, const double * b)
+{
+	double sum = 0.0;
+	unsigned int d;
+
+	for(d = 0; d < SAMPLE_DIMENSIONS; d++) {
+		sum += (a[d] - b[d]) * (a[d] - b[d]);
+	}
+	return sum;
+}
+
+// One k-means run from a k-means++ start; fills c->assignment, c->centroids and c->sse
+static void kmeans(const struct sample_run_t * run, unsigned int k, unsigned int * seed, struct sample_clusters_t * c,
+	double * nearest, unsigned int * sizes)
+{
+	unsigned int n = run->count_intervals;
+	unsigned int iteration;
+	unsigned int i;
+	unsigned int j;
+
+	// k-means++: each further centroid is an interval drawn with probability ~ squared distance
+	memcpy(c->centroids, run->vectors + (size_t) (next_random(seed) % n) * SAMPLE_DIMENSIONS, SAMPLE_DIMENSIONS * sizeof(double));
+	for(i = 0; i < n; i++) {
+		nearest[i] = distance2(run->vectors + (size_t) i * SAMPLE_DIMENSIONS, c->centroids);
+	}
+	for(j = 1; j < k; j++) {
+		double total = 0.0;
+		double pick;
+		unsigned int chosen = n - 1;
+
+		for(i = 0; i < n; i++) {
+			total += nearest[i];
+		}
+		pick = total * (next_random(seed) / 4294967296.0);
+		for(i = 0; i < n; i++) {
+			if(pick < nearest[i]) {
+				chosen = i;
+				break;
+			}
+			pick -= nearest[i];
+		}
+		memcpy(c->centroids + (size_t) j * SAMPLE_DIMENSIONS, run->vectors + (size_t) chosen * SAMPLE_DIMENSIONS, SAMPLE_DIMENSIONS * sizeof(double));
+		for(i = 0; i < n; i++) {
+			double d = distance2(run->vectors + (size_t) i * SAMPLE_DIMENSIONS, c->centroids + (size_t) j * SAMPLE_DIMENSIONS);
+
+			if(d < nearest[i]) {
+				nearest[i] = d;
+			}
+		}
+	}
+
+	for(i = 0; i < n; i++) {
+		c->assignment[i] = k;
+	}
+	for(iteration = 0; iteration < SAMPLE_KMEANS_ITERATIONS; iteration++) {
+		int changed = 0;
+
+		c->sse = 0.0;
+		for(i = 0; i < n; i++) {
+			unsigned int best = 0;
+			double best_distance = distance2(run->vectors + (size_t) i * SAMPLE_DIMENSIONS, c->centroids);
+
+			for(j = 1; j < k; j++) {
+				double d = distance2(run->vectors + (size_t) i * SAMPLE_DIMENSIONS, c->centroids + (size_t) j * SAMPLE_DIMENSIONS);
+
+				if(d < best_distance) {
+					best = j;
+					best_distance = d;
+				}
+			}
+			changed |= c->assignment[i] != best;
+			c->assignment[i] = best;
+			c->sse += best_distance;
+		}
+		if(!changed) {
+			break;
+		}
+		// Empty clusters keep their previous centroid
+		memset(sizes, 0, k * sizeof(*sizes));
+		for(i = 0; i < n; i++) {
+			++sizes[c->assignment[i]];
+		}
+		for(j = 0; j < k; j++) {
+			if(sizes[j] > 0) {
+				memset(c->centroids + (size_t) j * SAMPLE_DIMENSIONS, 0, SAMPLE_DIMENSIONS * sizeof(double));
+			}
+		}
+		for(i = 0; i < n; i++) {
+			double * centroid = c->centroids + (size_t) c->assignment[i] * SAMPLE_DIMENSIONS;
+			unsigned int d;
+
+			for(d = 0; d < SAMPLE_DIMENSIONS; d++) {
+				centroid[d] += run->vectors[(size_t) i * SAMPLE_DIMENSIONS + d] / sizes[c->assignment[i]];
+			}
+		}
+	}
+}
+
+// Bayesian information criterion of a clustering under the spherical Gaussian model of X-means
+static double bic(const struct sample_clusters_t * c, unsigned int n, const unsigned int * sizes)
+{
+	double variance = n > c->k ? c->sse / (n - c->k) : 0.0;
+	double likelihood = 0.0;
+	double parameters = (c->k - 1) + (double) SAMPLE_DIMENSIONS * c->k + 1;
+	unsigned int j;
+
+	if(variance < 1e-12) {
+		variance = 1e-12;
+	}
+	for(j = 0; j < c->k; j++) {
+		double r = sizes[j];
+
+		if(r > 0) {
+			likelihood += -r / 2 * log(2 * M_PI) - r * SAMPLE_DIMENSIONS / 2 * log(variance) - (r - c->k) / 2
+				+ r * log(r) - r * log(n);
+		}
+	}
+	return likelihood - parameters / 2 * log(n);
+}
+
+// Cluster the intervals for k = 1..max_k and keep the smallest k that scores well enough
+static int choose_clusters(const struct sample_run_t * run, unsigned int max_k, struct sample_clusters_t * chosen)
+{
+	unsigned int n = run->count_intervals;
+	struct sample_clusters_t * all;
+	struct sample_clusters_t trial;
+	double * scores;
+	double * nearest = malloc(n * sizeof(*nearest));
+	unsigned int * sizes = malloc((max_k + 1) * sizeof(*sizes));
+	unsigned int seed = 2463534242u;
+	int status = 0;
+	double best_score;
+	double worst_score;
+	unsigned int k;
+	unsigned int i;
+
+	if(max_k > n) {
+		max_k = n;
+	}
+	all = calloc(max_k + 1, sizeof(*all));
+	scores = malloc((max_k + 1) * sizeof(*scores));
+	trial.assignment = malloc(n * sizeof(*trial.assignment));
+	trial.centroids = malloc((size_t) max_k * SAMPLE_DIMENSIONS * sizeof(*trial.centroids));
+	if(nearest == NULL || sizes == NULL || all == NULL || scores == NULL || trial.assignment == NULL || trial.centroids == NULL) {
+		printf("Error: Out of memory clustering sample intervals\n");
+		free(nearest);
+		free(sizes);
+		free(all);
+		free(scores);
+		free(trial.assignment);
+		free(trial.centroids);
+		return -1;
+	}
+
+	for(k = 1; k <= max_k; k++) {
+		unsigned int attempt;
+
+		all[k].k = k;
+		all[k].assignment = malloc(n * sizeof(*all[k].assignment));
+		all[k].centroids = malloc((size_t) k * SAMPLE_DIMENSIONS * sizeof(*all[k].centroids));
+		if(all[k].assignment == NULL || all[k].centroids == NULL) {
+			printf("Error: Out of memory clustering sample intervals\n");
+			status = -1;
+			break;
+		}
+		for(attempt = 0; attempt < SAMPLE_KMEANS_SEEDS; attempt++) {
+			trial.k = k;
+			kmeans(run, k, &seed, &trial, nearest, sizes);
+			if(attempt == 0 || trial.sse < all[k].sse) {
+				memcpy(all[k].assignment, trial.assignment, n * sizeof(*trial.assignment));
+				memcpy(all[k].centroids, trial.centroids, (size_t) k * SAMPLE_DIMENSIONS * sizeof(*trial.centroids));
+				all[k].sse = trial.sse;
+			}
+		}
+		memset(sizes, 0, k * sizeof(*sizes));
+		for(i = 0; i < n; i++) {
+			++sizes[all[k].assignment[i]];
+		}
+		scores[k] = bic(&all[k], n, sizes);
+	}
+
+	if(status == 0) {
+		best_score = worst_score = scores[1];
+		for(k = 2; k <= max_k; k++) {
+			best_score = scores[k] > best_score ? scores[k] : best_score;
+			worst_score = scores[k] < worst_score ? scores[k] : worst_score;
+		}
+		for(k = 1; k < max_k; k++) {
+			if(scores[k] >= worst_score + SAMPLE_BIC_THRESHOLD * (best_score - worst_score)) {
+				break;
+			}
+		}
+		*chosen = all[k];
+	} else {
+		k = 0;
+	}
+	for(i = 1; i <= max_k; i++) {
+		if(i != k) {
+			free(all[i].assignment);
+			free(all[i].centroids);
+		}
+	}
+	free(all);
+	free(scores);
+	free(nearest);
+	free(sizes);
+	free(trial.assignment);
+	free(trial.centroids);
+	return status;
+}
+
+// Warmup intervals whose LD/STs, at the program's average rate, reach lines
+static unsigned int filling_warmup(const struct sample_run_t * run, unsigned int interval, unsigned int lines)
+{
+	double per_interval = (double) interval * run->count_memory_accesses / run->count_executed_instructions;
+
+	if(per_interval <= 0.0) {
+		return 0; // no LD/ST, nothing to warm
+	}
+	return (unsigned int) ceil(lines / per_interval);
+}
+
+// Lines a cold start has to fill: those of every cache level, at most one per block of memory
+static unsigned int cache_lines(const struct machine_t * m)
+{
+	const struct cache_t * c;
+	unsigned int lines = 0;
+
+	for(c = &m->cache; c != NULL; c = c->next) {
+		unsigned int blocks = MAIN_MEMORY_SIZE >> c->line_shift;
+
+		lines += c->sets * c->ways < blocks ? c->sets * c->ways : blocks;
+	}
+	return lines;
+}
+
+// Detailed simulation of one interval after up to warmup earlier intervals; returns its cycles and hits
+static void simulate_interval(const struct program_t * prog, const struct sample_run_t * run, struct machine_t * m,
+	unsigned int interval, unsigned int warmup, unsigned int * cycles, unsigned int * hits)
+{
+	unsigned int first = interval > warmup ? interval - warmup : 0;
+	const struct sample_state_t * state = &run->states[first];
+	unsigned int warm_instructions = 0;
+	unsigned int index = state->index;
+	unsigned int start_cycles;
+	unsigned int start_hits;
+	unsigned int i;
+
+	for(i = first; i < interval; i++) {
+		warm_instructions += run->lengths[i];
+	}
+	reset_machine(m);
+	memcpy(m->registers, state->registers, sizeof(m->registers));
+	m->CMP_VAL = state->CMP_VAL;
+	memcpy(m->memory, state->memory, sizeof(m->memory));
+
+	while(m->count_executed_instructions < warm_instructions) {
+		index = step_instruction(prog, m, index);
+	}
+	start_cycles = m->count_clock_cycles;
+	start_hits = m->count_hits_to_local_memory;
+	while(m->count_executed_instructions < warm_instructions + run->lengths[interval]) {
+		index = step_instruction(prog, m, index);
+	}
+	*cycles = m->count_clock_cycles - start_cycles;
+	*hits = m->count_hits_to_local_memory - start_hits;
+}
+
+// Stratified estimate of a total from per-instruction rates sampled in every cluster
+struct sample_estimate_t {
+	double total;
+	double variance;
+	unsigned int degrees_of_freedom;
+	int bounded; // every cluster with unsampled members had at least two samples
+};
+
+static void add_stratum(struct sample_estimate_t * e, const double * rates, unsigned int count_samples,
+	unsigned int count_members, double instructions)
+{
+	double mean = 0.0;
+	double squares = 0.0;
+	unsigned int i;
+
+	for(i = 0; i < count_samples; i++) {
+		mean += rates[i];
+	}
+	mean /= count_samples;
+	for(i = 0; i < count_samples; i++) {
+		squares += (rates[i] - mean) * (rates[i] - mean);
+	}
+	e->total += instructions * mean;
+	if(count_samples < count_members) {
+		if(count_samples < 2) {
+			e->bounded = 0;
+			return;
+		}
+		e->variance += instructions * instructions * (1.0 - (double) count_samples / count_members)
+			* squares / (count_samples - 1) / count_samples;
+		e->degrees_of_freedom += count_samples - 1;
+	}
+}
+
+static void print_estimate(const char * name, const struct sample_estimate_t * e)
+{
+	if(!e->bounded) {
+		printf("%s: %.0f +- n/a (needs --sample-per-cluster=2 or more)\n", name, e->total);
+	} else {
+		double bound = e->degrees_of_freedom > 0 ? t_quantile(e->degrees_of_freedom) * sqrt(e->variance) : 0.0;
+
+		printf("%s: %.0f +- %.0f (95%%, %.2f%%)\n", name, e->total, bound, e->total > 0 ? 100.0 * bound / e->total : 0.0);
+	}
+}
+
+int run_sampled(const struct program_t * prog, const struct memory_config_t * config, const struct sample_config_t * sample)
+{
+	struct sample_run_t run;
+	struct sample_clusters_t clusters;
+	struct sample_estimate_t cycles_estimate;
+	struct sample_estimate_t hits_estimate;
+	struct machine_t machine;
+	unsigned int * order = NULL;
+	double * distances = NULL;
+	double * cycle_rates = NULL;
+	double * hit_rates = NULL;
+	unsigned int detailed_instructions = 0;
+	unsigned int count_detailed = 0;
+	unsigned int seed = 88172645u;
+	unsigned int warmup;
+	unsigned int n;
+	unsigned int j;
+	unsigned int i;
+
+	memset(&run, 0, sizeof(run));
+	if(sample->interval == 0 || sample->max_clusters == 0 || sample->per_cluster == 0) {
+		printf("Error: sampling needs a positive interval, cluster limit and samples per cluster\n");
+		return -1;
+	}
+	if(functional_pass(prog, sample->interval, &run) != 0) {
+		free_run(&run);
+		return -1;
+	}
+	n = run.count_intervals;
+	if(n == 0) {
+		printf("Error: sampling needs a program that executes instructions\n");
+		free_run(&run);
+		return -1;
+	}
+	if(choose_clusters(&run, sample->max_clusters, &clusters) != 0) {
+		free_run(&run);
+		return -1;
+	}
+	if(init_machine(&machine, config) != 0) {
+		free(clusters.assignment);
+		free(clusters.centroids);
+		free_run(&run);
+		return -1;
+	}
+	order = malloc(n * sizeof(*order));
+	distances = malloc(n * sizeof(*distances));
+	cycle_rates = malloc(sample->per_cluster * sizeof(*cycle_rates));
+	hit_rates = malloc(sample->per_cluster * sizeof(*hit_rates));
+	if(order == NULL || distances == NULL || cycle_rates == NULL || hit_rates == NULL) {
+		printf("Error: Out of memory simulating sample intervals\n");
+		free(order);
+		free(distances);
+		free(cycle_rates);
+		free(hit_rates);
+		free(clusters.assignment);
+		free(clusters.centroids);
+		free_machine(&machine);
+		free_run(&run);
+		return -1;
+	}
+
+	memset(&cycles_estimate, 0, sizeof(cycles_estimate));
+	memset(&hits_estimate, 0, sizeof(hits_estimate));
+	cycles_estimate.bounded = hits_estimate.bounded = 1;
+	// No sample can be preceded by more than the n intervals there are
+	warmup = filling_warmup(&run, sample->interval, cache_lines(&machine));
+	if(warmup > n) {
+		warmup = n;
+	}
+	if(warmup < sample->warmup) {
+		warmup = sample->warmup;
+	}
+	printf("Sampled simulation: %u intervals of %u instructions, %u clusters, warmup %u intervals",
+		n, sample->interval, clusters.k, warmup);
+	if(warmup > sample->warmup) {
+		printf(" (raised from %u to fill %u cache lines)", sample->warmup, cache_lines(&machine));
+	}
+	printf("\n");
+	for(j = 0; j < clusters.k; j++) {
+		unsigned int count_members = 0;
+		unsigned int count_samples;
+		double instructions = 0.0;
+		unsigned int nearest = 0;
+
+		// Members of the cluster, the one nearest the centroid first
+		for(i = 0; i < n; i++) {
+			if(clusters.assignment[i] == j) {
+				distances[count_members] = distance2(run.vectors + (size_t) i * SAMPLE_DIMENSIONS, clusters.centroids + (size_t) j * SAMPLE_DIMENSIONS);
+				order[count_members] = i;
+				if(distances[count_members] < distances[nearest]) {
+					nearest = count_members;
+				}
+				instructions += run.lengths[i];
+				++count_members;
+			}
+		}
+		if(count_members == 0) {
+			continue;
+		}
+		i = order[0];
+		order[0] = order[nearest];
+		order[nearest] = i;
+		// The rest of the samples are drawn at random from the other members
+		count_samples = sample->per_cluster < count_members ? sample->per_cluster : count_members;
+		for(i = 1; i < count_samples; i++) {
+			unsigned int pick = i + next_random(&seed) % (count_members - i);
+			unsigned int swap = order[i];
+
+			order[i] = order[pick];
+			order[pick] = swap;
+		}
+
+		printf("Cluster %u: %u intervals, weight %.4f, simulated", j, count_members, instructions / run.count_executed_instructions);
+		for(i = 0; i < count_samples; i++) {
+			unsigned int cycles;
+			unsigned int hits;
+
+			simulate_interval(prog, &run, &machine, order[i], warmup, &cycles, &hits);
+			cycle_rates[i] = (double) cycles / run.lengths[order[i]];
+			hit_rates[i] = (double) hits / run.lengths[order[i]];
+			detailed_instructions += run.lengths[order[i]];
+			++count_detailed;
+			printf(" %u", order[i]);
+		}
+		printf("\n");
+		add_stratum(&cycles_estimate, cycle_rates, count_samples, count_members, instructions);
+		add_stratum(&hits_estimate, hit_rates, count_samples, count_members, instructions);
+	}
+
+	// Every hit is a LD/ST, whatever the rates of the samples suggest
+	if(hits_estimate.total > run.count_memory_accesses) {
+		hits_estimate.total = run.count_memory_accesses;
+	}
+	printf("Total number of executed instructions: %u\n", run.count_executed_instructions);
+	print_estimate("Estimated total number of clock cycles", &cycles_estimate);
+	print_estimate("Estimated number of hits to local memory", &hits_estimate);
+	printf("Total number of executed LD/ST instructions: %u\n", run.count_memory_accesses);
+	printf("Simulated in detail: %u intervals, %.2f%% of executed instructions\n", count_detailed,
+		100.0 * detailed_instructions / run.count_executed_instructions);
+
+	free(order);
+	free(distances);
+	free(cycle_rates);
+	free(hit_rates);
+	free(clusters.assignment);
+	free(clusters.centroids);
+	free_machine(&machine);
+	free_run(&run);
+	return 0;
+}
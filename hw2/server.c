@@ -0,0 +1,742 @@
+// Description: Simulator daemon serving jobs over a Unix domain socket (--serve=<socket>).
+// A client writes one JSON object per line and may send many before reading any result:
+//   {"id": 7, "program": "<path>" or "source": "<assembly text>", "options": "--assoc=2 ...",
+//    "engine": "switch|threaded|fused|jit|fastforward|optimized", "max_instructions": <n>}
+// Every field but one of program and source is optional; options are cache options applied on
+// top of the server's own configuration. Each connection has a reader thread that splits lines
+// into jobs on a shared queue; a fixed pool of workers parses and runs them and writes one JSON
+// line per job back to its connection, in completion order, tagged with the request id.
+// Decoded programs stay in an LRU cache keyed by a 64-bit hash of their source text, so a
+// program sent again is not parsed again. Each entry keeps a copy of the text, and a hash
+// match only counts once the texts compare equal, since FNV-1a collisions are easy to make.
+// A request line longer than SERVER_MAX_LINE is answered with an error and skipped.
+// Every job runs under the server's instruction limit (--max-instructions), which a request's
+// max_instructions may lower but not lift, so a looping program can't hold a worker for good.
+// Programs that can loop run on the step interpreter to honor it; the others finish within
+// their length and run on the requested engine. Each worker keeps its machine_t and only
+// reallocates the caches when a job asks for a different configuration.
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+#define SERVER_BACKLOG 128
+#define SERVER_READ_SIZE 65536
+#define SERVER_RESPONSE_SIZE 512
+#define SERVER_MAX_LINE (64u << 20) // longest request, enough for a 20 MB program sent inline
+
+// One client socket, shared by its reader thread and the jobs it queued
+struct server_connection_t {
+	int fd;
+	pthread_mutex_t write_lock; // whole responses only, so lines never interleave
+	pthread_mutex_t lock;
+	unsigned int references; // reader plus queued or running jobs; the last one closes fd
+};
+
+struct server_job_t {
+	struct server_connection_t * connection;
+	char * line; // request text without the newline
+	struct server_job_t * next;
+};
+
+// Decoded program shared by every job that sends the same source
+struct program_entry_t {
+	uint64_t hash;
+	size_t size;
+	char * source; // copy of the text, compared on a hash match
+	struct program_t * prog; // NULL for an empty slot
+	int loops; // has a backward jump, so it may run past any limit on an engine
+	unsigned long long last_use;
+	unsigned int references; // running jobs; an entry is only evicted when 0
+	int evicted; // dropped from the cache while in use, freed by its last job
+};
+
+struct server_t {
+	struct memory_config_t config; // base configuration of every job
+	unsigned int max_instructions; // limit of every job; a request may only lower it
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_ready;
+	struct server_job_t * head;
+	struct server_job_t * tail;
+	pthread_mutex_t cache_lock;
+	struct program_entry_t * entries;
+	unsigned int count_entries;
+	unsigned long long clock; // cache lookups, for LRU
+};
+
+// Fields of one request
+struct server_request_t {
+	double id; // echoed back, -1 when missing
+	char * program; // path, or NULL
+	char * source; // inline assembly, or NULL
+	char * options; // cache options separated by spaces, or NULL
+	char * engine;
+	unsigned long long max_instructions; // 0 for no limit
+};
+
+static const char * socket_path;
+
+// FNV-1a, 64-bit
+static uint64_t hash64(const char * data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		hash = (hash ^ (unsigned char) data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static void remove_socket(int signal_number)
+{
+	(void) signal_number;
+	unlink(socket_path);
+	_exit(0);
+}
+
+static void release_connection(struct server_connection_t * connection)
+{
+	unsigned int references;
+
+	pthread_mutex_lock(&connection->lock);
+	references = --connection->references;
+	pthread_mutex_unlock(&connection->lock);
+	if(references == 0) {
+		close(connection->fd);
+		pthread_mutex_destroy(&connection->lock);
+		pthread_mutex_destroy(&connection->write_lock);
+		free(connection);
+	}
+}
+
+static void send_response(struct server_connection_t * connection, const char * text, size_t length)
+{
+	pthread_mutex_lock(&connection->write_lock);
+	while(length > 0) {
+		ssize_t written = write(connection->fd, text, length);
+
+		if(written <= 0) {
+			break; // client went away; its remaining results are dropped
+		}
+		text += written;
+		length -= written;
+	}
+	pthread_mutex_unlock(&connection->write_lock);
+}
+
+static void send_error(struct server_connection_t * connection, double id, const char * message)
+{
+	char response[SERVER_RESPONSE_SIZE];
+	int length = snprintf(response, sizeof(response), "{\"id\": %.17g, \"status\": \"error\", \"message\": \"%s\"}\n", id, message);
+
+	send_response(connection, response, length);
+}
+
+// JSON parsing, enough for a flat object of strings, numbers and booleans
+
+static const char * skip_space(const char * p)
+{
+	while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+		p++;
+	}
+	return p;
+}
+
+// Decode the string starting after the opening quote in place; returns the character after
+// the closing quote or NULL when malformed
+static char * json_string(char * p, char ** value)
+{
+	char * out = p;
+
+	*value = p;
+	while(*p != '"') {
+		if(*p == '\0') {
+			return NULL;
+		}
+		if(*p == '\\') {
+			p++;
+			switch(*p) {
+			case 'n': *out++ = '\n'; break;
+			case 't': *out++ = '\t'; break;
+			case 'r': *out++ = '\r'; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case '"': case '\\': case '/': *out++ = *p; break;
+			case 'u': {
+				unsigned int code;
+
+				if(sscanf(p + 1, "%4x", &code) != 1 || code > 0x7f) {
+					return NULL; // assembly is plain ASCII
+				}
+				*out++ = code;
+				p += 4;
+				break;
+			}
+			default:
+				return NULL;
+			}
+			p++;
+		} else {
+			*out++ = *p++;
+		}
+	}
+	*out = '\0';
+	return p + 1;
+}
+
+static int parse_request(char * line, struct server_request_t * request)
+{
+	char * p = (char *) skip_space(line);
+
+	memset(request, 0, sizeof(*request));
+	request->id = -1;
+	if(*p++ != '{') {
+		return -1;
+	}
+	p = (char *) skip_space(p);
+	while(*p != '}') {
+		char * key;
+		char * string = NULL;
+		double number = 0.0;
+
+		if(*p != '"' || (p = json_string(p + 1, &key)) == NULL) {
+			return -1;
+		}
+		p = (char *) skip_space(p);
+		if(*p++ != ':') {
+			return -1;
+		}
+		p = (char *) skip_space(p);
+		if(*p == '"') {
+			if((p = json_string(p + 1, &string)) == NULL) {
+				return -1;
+			}
+		} else if(strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0 || strncmp(p, "null", 4) == 0) {
+			p += *p == 'f' ? 5 : 4;
+		} else {
+			char * end;
+
+			number = strtod(p, &end);
+			if(end == p) {
+				return -1;
+			}
+			p = end;
+		}
+
+		if(strcmp(key, "id") == 0) {
+			request->id = number;
+		} else if(strcmp(key, "program") == 0) {
+			request->program = string;
+		} else if(strcmp(key, "source") == 0) {
+			request->source = string;
+		} else if(strcmp(key, "options") == 0) {
+			request->options = string;
+		} else if(strcmp(key, "engine") == 0) {
+			request->engine = string;
+		} else if(strcmp(key, "max_instructions") == 0) {
+			request->max_instructions = number > 0 ? (unsigned long long) number : 0;
+		}
+		// unknown keys are ignored, so clients can tag requests
+
+		p = (char *) skip_space(p);
+		if(*p == ',') {
+			p = (char *) skip_space(p + 1);
+		} else if(*p != '}') {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int apply_options(char * options, struct memory_config_t * config)
+{
+	char * token;
+	char * save;
+
+	if(options == NULL) {
+		return 0;
+	}
+	for(token = strtok_r(options, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save)) {
+		if(parse_cache_option(token, config) != 1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void (*engine_function(const char * engine))(const struct program_t *, struct machine_t *)
+{
+	if(engine == NULL || strcmp(engine, "switch") == 0) {
+		return execute_switch;
+	} else if(strcmp(engine, "threaded") == 0) {
+		return execute_threaded;
+	} else if(strcmp(engine, "fused") == 0) {
+		return execute_fused;
+	} else if(strcmp(engine, "jit") == 0) {
+		return execute_jit;
+	} else if(strcmp(engine, "fastforward") == 0) {
+		return execute_fast_forward;
+	} else if(strcmp(engine, "optimized") == 0) {
+		return execute_optimized;
+	}
+	return NULL;
+}
+
+static char * read_file(const char * path, size_t * size)
+{
+	FILE * fptr = fopen(path, "rb");
+	char * text = NULL;
+	long length;
+
+	if(fptr == NULL) {
+		return NULL;
+	}
+	if(fseek(fptr, 0, SEEK_END) == 0 && (length = ftell(fptr)) >= 0 && fseek(fptr, 0, SEEK_SET) == 0
+			&& (text = malloc(length + 1)) != NULL) {
+		if(fread(text, 1, length, fptr) != (size_t) length) {
+			free(text);
+			text = NULL;
+		} else {
+			*size = length;
+		}
+	}
+	fclose(fptr);
+	return text;
+}
+
+static void free_entry_program(struct program_t * prog)
+{
+	free_program(prog);
+	free(prog);
+}
+
+// Whether any JE/JMP goes back to itself or an earlier instruction
+static int has_backward_jump(const struct program_t * prog)
+{
+	unsigned int i;
+
+	for(i = 0; i < prog->count_instructions; i++) {
+		const struct instruction_t * instr = &prog->instructions[i];
+
+		if((instr->operation == JE || instr->operation == JMP) && instr->target - prog->first_address <= i) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int same_source(const struct program_entry_t * entry, uint64_t hash, const char * source, size_t size)
+{
+	return entry->prog != NULL && entry->hash == hash && entry->size == size && memcmp(entry->source, source, size) == 0;
+}
+
+// Find the decoded program of source, parsing and caching it on a miss. The entry is pinned
+// until release_program.
+static struct program_entry_t * acquire_program(struct server_t * server, const char * source, size_t size, int * cached)
+{
+	uint64_t hash = hash64(source, size);
+	struct program_entry_t * entry;
+	struct program_entry_t * victim = NULL;
+	struct program_t * prog;
+	char * copy;
+	unsigned int i;
+
+	pthread_mutex_lock(&server->cache_lock);
+	server->clock++;
+	for(i = 0; i < server->count_entries; i++) {
+		entry = &server->entries[i];
+		if(same_source(entry, hash, source, size)) {
+			entry->last_use = server->clock;
+			entry->references++;
+			pthread_mutex_unlock(&server->cache_lock);
+			*cached = 1;
+			return entry;
+		}
+	}
+	pthread_mutex_unlock(&server->cache_lock);
+
+	// Parse outside the lock; two jobs missing on the same source both parse, the second
+	// insert finds the first and keeps it
+	*cached = 0;
+	prog = calloc(1, sizeof(*prog));
+	copy = malloc(size > 0 ? size : 1);
+	if(prog == NULL || copy == NULL || parse_program(source, size, prog) != 0) {
+		if(prog != NULL) {
+			free_entry_program(prog);
+		}
+		free(copy);
+		return NULL;
+	}
+	memcpy(copy, source, size);
+
+	pthread_mutex_lock(&server->cache_lock);
+	for(i = 0; i < server->count_entries; i++) {
+		entry = &server->entries[i];
+		if(same_source(entry, hash, source, size)) {
+			entry->references++;
+			pthread_mutex_unlock(&server->cache_lock);
+			free_entry_program(prog);
+			free(copy);
+			return entry;
+		}
+		if(entry->prog == NULL) {
+			if(victim == NULL || victim->prog != NULL) {
+				victim = entry;
+			}
+		} else if(entry->references == 0 && (victim == NULL || (victim->prog != NULL && entry->last_use < victim->last_use))) {
+			victim = entry;
+		}
+	}
+	if(victim == NULL) {
+		// Every entry is running; this program is used once and not cached
+		victim = malloc(sizeof(*victim));
+		if(victim == NULL) {
+			pthread_mutex_unlock(&server->cache_lock);
+			free_entry_program(prog);
+			free(copy);
+			return NULL;
+		}
+		victim->evicted = 1;
+	} else {
+		if(victim->prog != NULL) {
+			free_entry_program(victim->prog);
+			free(victim->source);
+		}
+		victim->evicted = 0;
+	}
+	victim->hash = hash;
+	victim->size = size;
+	victim->source = copy;
+	victim->prog = prog;
+	victim->loops = has_backward_jump(prog);
+	victim->last_use = server->clock;
+	victim->references = 1;
+	pthread_mutex_unlock(&server->cache_lock);
+	return victim;
+}
+
+static void release_program(struct server_t * server, struct program_entry_t * entry)
+{
+	pthread_mutex_lock(&server->cache_lock);
+	entry->references--;
+	pthread_mutex_unlock(&server->cache_lock);
+	if(entry->evicted) {
+		free_entry_program(entry->prog);
+		free(entry->source);
+		free(entry);
+	}
+}
+
+// Per-worker machine, reallocated only when the configuration changes
+struct server_worker_t {
+	struct server_t * server;
+	struct machine_t machine;
+	struct memory_config_t config;
+	int ready;
+};
+
+static void run_job(struct server_worker_t * worker, struct server_job_t * job)
+{
+	struct server_t * server = worker->server;
+	struct machine_t * m = &worker->machine;
+	struct server_request_t request;
+	struct memory_config_t config = server->config;
+	void (*execute)(const struct program_t *, struct machine_t *);
+	struct program_entry_t * entry;
+	char * text = NULL;
+	size_t size = 0;
+	int cached;
+	int limited = 0;
+	unsigned int limit;
+	char response[SERVER_RESPONSE_SIZE];
+	int length;
+
+	if(parse_request(job->line, &request) != 0) {
+		send_error(job->connection, -1, "malformed request");
+		return;
+	}
+	if(apply_options(request.options, &config) != 0) {
+		send_error(job->connection, request.id, "unknown cache option");
+		return;
+	}
+	if((execute = engine_function(request.engine)) == NULL) {
+		send_error(job->connection, request.id, "unknown engine");
+		return;
+	}
+	if(request.source != NULL) {
+		entry = acquire_program(server, request.source, strlen(request.source), &cached);
+	} else if(request.program != NULL && (text = read_file(request.program, &size)) != NULL) {
+		entry = acquire_program(server, text, size, &cached);
+	} else {
+		send_error(job->connection, request.id, request.program != NULL ? "can't read program" : "no program");
+		return;
+	}
+	free(text);
+	if(entry == NULL) {
+		send_error(job->connection, request.id, "program does not parse");
+		return;
+	}
+
+	if(worker->ready && memcmp(&config, &worker->config, sizeof(config)) == 0) {
+		reset_machine(m);
+	} else {
+		if(worker->ready) {
+			free_machine(m);
+			worker->ready = 0;
+		}
+		if(init_machine(m, &config) != 0) {
+			release_program(server, entry);
+			send_error(job->connection, request.id, "invalid cache configuration");
+			return;
+		}
+		worker->config = config;
+		worker->ready = 1;
+	}
+
+	limit = server->max_instructions;
+	if(request.max_instructions > 0 && request.max_instructions < limit) {
+		limit = request.max_instructions;
+	}
+	if(!entry->loops && entry->prog->count_instructions <= limit) {
+		execute(entry->prog, m);
+	} else {
+		struct checkpoint_trigger_t trigger;
+		unsigned int index;
+
+		// A limit runs on the step interpreter, whatever the engine
+		memset(&trigger, 0, sizeof(trigger));
+		trigger.count_instructions = limit;
+		index = execute_until(entry->prog, m, &trigger);
+		limited = index < entry->prog->count_instructions;
+	}
+	release_program(server, entry);
+
+	length = snprintf(response, sizeof(response),
+		"{\"id\": %.17g, \"status\": \"%s\", \"instructions\": %u, \"cycles\": %u, \"hits\": %u, \"accesses\": %u, \"l2_hits\": %u, \"l2_misses\": %u, \"cached\": %s}\n",
+		request.id, limited ? "limit" : "ok", m->count_executed_instructions, m->count_clock_cycles,
+		m->count_hits_to_local_memory, m->count_memory_accesses, m->l2.hits, m->l2.misses, cached ? "true" : "false");
+	send_response(job->connection, response, length);
+}
+
+static void * server_worker(void * argument)
+{
+	struct server_worker_t * worker = argument;
+	struct server_t * server = worker->server;
+
+	for(;;) {
+		struct server_job_t * job;
+
+		pthread_mutex_lock(&server->queue_lock);
+		while(server->head == NULL) {
+			pthread_cond_wait(&server->queue_ready, &server->queue_lock);
+		}
+		job = server->head;
+		server->head = job->next;
+		if(server->head == NULL) {
+			server->tail = NULL;
+		}
+		pthread_mutex_unlock(&server->queue_lock);
+
+		run_job(worker, job);
+		release_connection(job->connection);
+		free(job->line);
+		free(job);
+	}
+	return NULL;
+}
+
+static int queue_job(struct server_t * server, struct server_connection_t * connection, const char * line, size_t length)
+{
+	struct server_job_t * job = malloc(sizeof(*job));
+	char * copy = malloc(length + 1);
+
+	if(job == NULL || copy == NULL) {
+		free(job);
+		free(copy);
+		return -1;
+	}
+	memcpy(copy, line, length);
+	copy[length] = '\0';
+	job->connection = connection;
+	job->line = copy;
+	job->next = NULL;
+
+	pthread_mutex_lock(&connection->lock);
+	connection->references++;
+	pthread_mutex_unlock(&connection->lock);
+
+	pthread_mutex_lock(&server->queue_lock);
+	if(server->tail != NULL) {
+		server->tail->next = job;
+	} else {
+		server->head = job;
+	}
+	server->tail = job;
+	pthread_cond_signal(&server->queue_ready);
+	pthread_mutex_unlock(&server->queue_lock);
+	return 0;
+}
+
+struct server_reader_t {
+	struct server_t * server;
+	struct server_connection_t * connection;
+};
+
+// Split the byte stream of one client into jobs until it closes its end
+static void * server_reader(void * argument)
+{
+	struct server_reader_t * reader = argument;
+	struct server_connection_t * connection = reader->connection;
+	size_t capacity = SERVER_READ_SIZE;
+	size_t length = 0;
+	char * buffer = malloc(capacity);
+	int skipping = 0; // inside a line that was too long, dropped up to its newline
+
+	while(buffer != NULL) {
+		ssize_t count;
+		size_t start = 0;
+		size_t i;
+
+		if(capacity - length < SERVER_READ_SIZE / 2) {
+			char * grown = realloc(buffer, capacity * 2);
+
+			if(grown == NULL) {
+				break;
+			}
+			buffer = grown;
+			capacity *= 2;
+		}
+		count = read(connection->fd, buffer + length, capacity - length);
+		if(count <= 0) {
+			break;
+		}
+		for(i = length; i < length + count; i++) {
+			if(buffer[i] == '\n') {
+				if(skipping) {
+					skipping = 0;
+				} else if(i > start && queue_job(reader->server, connection, buffer + start, i - start) != 0) {
+					send_error(connection, -1, "out of memory");
+				}
+				start = i + 1;
+			}
+		}
+		length += count;
+		if(skipping) {
+			start = length;
+		} else if(length - start > SERVER_MAX_LINE) {
+			send_error(connection, -1, "request line too long");
+			skipping = 1;
+			start = length;
+		}
+		memmove(buffer, buffer + start, length - start);
+		length -= start;
+	}
+	free(buffer);
+	release_connection(connection);
+	free(reader);
+	return NULL;
+}
+
+int run_server(const char * path, const struct memory_config_t * config, unsigned int count_threads, unsigned int count_programs,
+	unsigned int max_instructions)
+{
+	struct server_t server;
+	struct sockaddr_un address;
+	struct server_worker_t * workers;
+	pthread_attr_t detached;
+	unsigned int i;
+	int listener;
+
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		printf("Error: Socket path %s is too long\n", path);
+		return -1;
+	}
+	if(count_threads == 0) {
+		count_threads = default_thread_count();
+	}
+	if(count_programs == 0) {
+		count_programs = 1;
+	}
+	if(max_instructions == 0) {
+		max_instructions = 1;
+	}
+	memset(&server, 0, sizeof(server));
+	server.config = *config;
+	server.max_instructions = max_instructions;
+	server.count_entries = count_programs;
+	server.entries = calloc(count_programs, sizeof(*server.entries));
+	workers = calloc(count_threads, sizeof(*workers));
+	if(server.entries == NULL || workers == NULL) {
+		printf("Error: Out of memory starting the server\n");
+		free(server.entries);
+		free(workers);
+		return -1;
+	}
+	pthread_mutex_init(&server.queue_lock, NULL);
+	pthread_cond_init(&server.queue_ready, NULL);
+	pthread_mutex_init(&server.cache_lock, NULL);
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	unlink(path); // left behind by a server that was killed
+	if(listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0
+			|| listen(listener, SERVER_BACKLOG) != 0) {
+		printf("Error: Can't listen on %s\n", path);
+		return -1;
+	}
+	socket_path = path;
+	signal(SIGPIPE, SIG_IGN); // a client that disconnects early must not kill the server
+	signal(SIGINT, remove_socket);
+	signal(SIGTERM, remove_socket);
+
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+	for(i = 0; i < count_threads; i++) {
+		pthread_t thread;
+
+		workers[i].server = &server;
+		if(pthread_create(&thread, &detached, server_worker, &workers[i]) != 0) {
+			printf("Error: Can't start server workers\n");
+			unlink(path);
+			return -1;
+		}
+	}
+	fprintf(stderr, "Serving on %s with %u workers and %u cached programs\n", path, count_threads, count_programs);
+
+	for(;;) {
+		struct server_connection_t * connection;
+		struct server_reader_t * reader;
+		pthread_t thread;
+		int fd = accept(listener, NULL, NULL);
+
+		if(fd < 0) {
+			continue;
+		}
+		connection = calloc(1, sizeof(*connection));
+		reader = malloc(sizeof(*reader));
+		if(connection == NULL || reader == NULL) {
+			free(connection);
+			free(reader);
+			close(fd);
+			continue;
+		}
+		connection->fd = fd;
+		connection->references = 1;
+		pthread_mutex_init(&connection->lock, NULL);
+		pthread_mutex_init(&connection->write_lock, NULL);
+		reader->server = &server;
+		reader->connection = connection;
+		if(pthread_create(&thread, &detached, server_reader, reader) != 0) {
+			release_connection(connection);
+			free(reader);
+		}
+	}
+	return 0;
+}
@@ -1,135 +1,76 @@
-#include <stdio.h>
-#include <stdlib.h>
-
-#define LOCAL_MEMORY_SIZE 256
-#define MAIN_MEMORY_SIZE 256
-#define MAX_NO_INSTRUCTIONS 1024
-
-// Defintions for CPU instructions
-
-typedef enum Operation {MOV, ADD_REG, ADD_NUM, CMP, JE, JMP, LD, ST} Operation;
-
-struct instruction_t {
-	char operand1;
-	char operand2;
-	enum Operation operation;
-};
-
-
-
-struct cache_entry_t {
-	unsigned char valid : 1;
-	char data : 8;
-};
-
-struct cache_entry_t cache[LOCAL_MEMORY_SIZE];
+#define _DEFAULT_SOURCE
+#include <time.h>
+#include <unistd.h>
+#include "simpleISS.h"
 
 // Notes:
 //We have to store every CPU instruction before executing them. (JMP/JE instructions may move PC forwards and backwards)
 
-
-int main(int argc, char * argv[])
+int init_machine(struct machine_t * m, const struct memory_config_t * config)
 {
-
-	FILE * restrict fptr; // file pointer for assembly input text file
-	struct instruction_t  instructions[MAX_NO_INSTRUCTIONS]; // array for 
-	register unsigned int first_address = 0; // address of first instruction
-	register unsigned int PC; // our fake "program counter" register
-	register unsigned int count_executed_instructions = 0;
-	register unsigned int count_clock_cycles = 0;
-	register unsigned int count_hits_to_local_memory = 0;
-	register unsigned int count_memory_accesses = 0;
-	unsigned char CMP_VAL = 0;
-	char registers[6]; // Array of registers
-	unsigned int count_instructions = 0;
-	unsigned int i = 0;
-
-	if(argc != 2) {
-		printf("Error: ./simpleISS [Assembly Input]\n");
-		exit(-1);
-	}
-
-	// Open assembly file
-	fptr = fopen(argv[1], "r");
-	if(fptr == NULL) {
-		printf("Error: Assembly input file can't be open for reading\n");
-		exit(-1);
+	if(init_hierarchy(&m->cache, &m->l2, config) != 0) {
+		return -1;
 	}
+	reset_machine(m);
+	return 0;
+}
 
-	// Initialize Local memory
-	for(i = 0; i < LOCAL_MEMORY_SIZE; i++) {
-		cache[i].valid = 0;
-	}
+void reset_machine(struct machine_t * m)
+{
+	memset(m->registers, 0, sizeof(m->registers));
+	memset(m->memory, 0, sizeof(m->memory));
+	m->CMP_VAL = 0;
+	m->count_executed_instructions = 0;
+	m->count_clock_cycles = 0;
+	m->count_hits_to_local_memory = 0;
+	m->count_memory_accesses = 0;
+	reset_cache(&m->cache);
+}
 
+void free_machine(struct machine_t * m)
+{
+	free_cache(&m->cache);
+	free_cache(&m->l2);
+}
 
-	// Parse assembly file for instructions
-	char line[256];
-	i = 0;
-
-	while(fgets(line, sizeof(line), fptr)) {
-		unsigned int address;
-		unsigned int reg1;
-		unsigned int reg2;
-		int number;
-		++count_instructions;
-
-		// Mov Rn, <num>
-		if(sscanf(line, "%d MOV R%d, %d", &address, &reg1, &number) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = number;
-			instructions[i].operation = MOV;
-		// ADD Rn, Rm
-		} else if(sscanf(line, "%d ADD R%d, R%d", &address, &reg1, &reg2) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = reg2 - 1;
-			instructions[i].operation = ADD_REG;
-		// ADD Rn, <num>
-		} else if(sscanf(line, "%d ADD R%d, %d", &address, &reg1, &number) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = number;
-			instructions[i].operation = ADD_NUM;
-			// CMP Rn, Rm
-		} else if(sscanf(line, "%d CMP R%d, R%d", &address, &reg1, &reg2) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = reg2 - 1;
-			instructions[i].operation = CMP;
-
-		// JE <address>
-		} else if (sscanf(line, "%d JE %d", &address, &number) == 2) {
-			instructions[i].operand1 = number;
-			instructions[i].operation = JE;
-		// JMP <address>
-		} else if (sscanf(line, "%d JMP %d", &address, &number) == 2) {
-			instructions[i].operand1 = number;
-			instructions[i].operation = JMP;
-		// LD Rn, [Rm]
-		} else if(sscanf(line, "%d LD R%d, [R%d]", &address, &reg1, &reg2) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = reg2 - 1;
-			instructions[i].operation = LD;
-		// ST [Rm], Rn
-		} else if(sscanf(line, "%d ST [R%d], R%d", &address, &reg1, &reg2) == 3) {
-			instructions[i].operand1 = reg1 - 1;
-			instructions[i].operand2 = reg2 - 1;
-			instructions[i].operation = ST;
-		} else {
-			printf("Unknown instruction: \"%s\" ", line);
-			exit(-1);
-		}
+void print_memory_statistics(const struct machine_t * m)
+{
+	unsigned int l1_misses = m->count_memory_accesses - m->count_hits_to_local_memory;
+	unsigned int memory_reads = l1_misses;
 
-		// Store the value of the first instruction address
-		if(i == 0) {
-			first_address = address;
-		}
-		++i;
+	printf("L1 hits: %u, misses: %u\n", m->count_hits_to_local_memory, l1_misses);
+	if(m->cache.next != NULL) {
+		printf("L2 hits: %u, misses: %u\n", m->l2.hits, m->l2.misses);
+		memory_reads = m->l2.misses;
 	}
+	printf("Main memory reads: %u\n", memory_reads);
+}
 
+// Execute CPU instructions with the original fetch/switch loop
+void execute_switch(const struct program_t * prog, struct machine_t * m)
+{
+	resume_switch(prog, m, 0);
+}
 
-	// Execute CPU instructions:
-	PC = first_address;
-	while(PC < first_address + count_instructions) {
-		struct instruction_t instr = instructions[PC - first_address]; // get instruction
+// Continue with the switch loop from the instruction at index, e.g. after restoring a checkpoint
+void resume_switch(const struct program_t * prog, struct machine_t * m, unsigned int index)
+{
+	register unsigned int first_address = prog->first_address; // address of first instruction
+	register unsigned int PC; // our fake "program counter" register
+	register unsigned int count_executed_instructions = m->count_executed_instructions;
+	register unsigned int count_clock_cycles = m->count_clock_cycles;
+	register unsigned int count_hits_to_local_memory = m->count_hits_to_local_memory;
+	register unsigned int count_memory_accesses = m->count_memory_accesses;
+	unsigned char CMP_VAL = m->CMP_VAL;
+	char * registers = m->registers; // Array of registers
+	char * memory = m->memory;
+	struct cache_t * cache = &m->cache;
+
+	PC = first_address + index;
+	while(PC - first_address < prog->count_instructions) {
+		struct instruction_t instr = prog->instructions[PC - first_address]; // get instruction
 		unsigned char mem_address;
+		int hit;
 		switch(instr.operation) {
 			case MOV:
 				registers[(unsigned char)instr.operand1] = instr.operand2; 
@@ -149,12 +90,12 @@ int main(int argc, char * argv[])
 				break;
 			case JE:
 				if(CMP_VAL) {
-					PC = instr.operand1 - 1;
+					PC = instr.target - 1;
 				}
 				++count_clock_cycles;
 				break;
 			case JMP:
-				PC = instr.operand1 - 1;
+				PC = instr.target - 1;
 				++count_clock_cycles;
 				break;
 			case LD:
@@ -162,33 +103,20 @@ int main(int argc, char * argv[])
 				mem_address = (unsigned char) registers[(unsigned char)instr.operand2];
 
 
-				// cache hit
-				if(cache[mem_address].valid) {
-					++count_hits_to_local_memory;
-					count_clock_cycles += 2;
-				// cache miss
-				} else {
-					cache[mem_address].valid = 1;
-					count_clock_cycles += 45;
-				}
+				count_clock_cycles += cache_access(cache, mem_address, 0, &hit);
+				count_hits_to_local_memory += hit;
 
-				registers[(unsigned char)instr.operand1] = cache[mem_address].data;
+				registers[(unsigned char)instr.operand1] = memory[mem_address];
 				break;
 			case ST:
 				
 				++count_memory_accesses;
 				mem_address = (unsigned char) registers[(unsigned char)instr.operand1];
 
-				// cache hit
-				if(cache[mem_address].valid) {
-					++count_hits_to_local_memory;
-					count_clock_cycles += 2;
-				} else {
-					cache[mem_address].valid = 1;
-					count_clock_cycles +=  45;
-				}
+				count_clock_cycles += cache_access(cache, mem_address, 1, &hit);
+				count_hits_to_local_memory += hit;
 
-				cache[mem_address].data = registers[(unsigned char)instr.operand2];
+				memory[mem_address] = registers[(unsigned char)instr.operand2];
 
 				break;
 		}
@@ -197,12 +125,107 @@ int main(int argc, char * argv[])
 		++count_executed_instructions;
 	}
 
-	printf("Total number of executed instructions: %d\n", count_executed_instructions); 
-	printf("Total number of clock cycles: %d\n", count_clock_cycles);
-	printf("Number of hits to local memory: %d\n", count_hits_to_local_memory);
-	printf("Total number of executed LD/ST instructions: %d\n", count_memory_accesses); 
+	m->count_executed_instructions = count_executed_instructions;
+	m->count_clock_cycles = count_clock_cycles;
+	m->count_hits_to_local_memory = count_hits_to_local_memory;
+	m->count_memory_accesses = count_memory_accesses;
+	m->CMP_VAL = CMP_VAL;
+}
 
-	fclose(fptr); // close file
-	return 0;
+// Execute the instruction at index PC - first_address and return the index of the next one.
+// An index of count_instructions means the program has finished.
+unsigned int step_instruction(const struct program_t * prog, struct machine_t * m, unsigned int index)
+{
+	struct instruction_t instr = prog->instructions[index]; // get instruction
+	unsigned int next = index + 1;
+	unsigned char mem_address;
+	int hit;
+	char * registers = m->registers;
+
+	switch(instr.operation) {
+		case MOV:
+			registers[(unsigned char)instr.operand1] = instr.operand2;
+			++m->count_clock_cycles;
+			break;
+		case ADD_REG:
+			registers[(unsigned char)instr.operand1] += registers[(unsigned char)instr.operand2];
+			++m->count_clock_cycles;
+			break;
+		case ADD_NUM:
+			registers[(unsigned char)instr.operand1] += instr.operand2;
+			++m->count_clock_cycles;
+			break;
+		case CMP:
+			m->CMP_VAL = (registers[(unsigned char)instr.operand1] == registers[(unsigned char)instr.operand2]);
+			++m->count_clock_cycles;
+			break;
+		case JE:
+			if(m->CMP_VAL) {
+				next = instr.target - prog->first_address;
+			}
+			++m->count_clock_cycles;
+			break;
+		case JMP:
+			next = instr.target - prog->first_address;
+			++m->count_clock_cycles;
+			break;
+		case LD:
+		case ST:
+			++m->count_memory_accesses;
+			mem_address = (unsigned char) registers[(unsigned char)(instr.operation == LD ? instr.operand2 : instr.operand1)];
+
+			m->count_clock_cycles += cache_access(&m->cache, mem_address, instr.operation == ST, &hit);
+			m->count_hits_to_local_memory += hit;
+
+			if(instr.operation == LD) {
+				registers[(unsigned char)instr.operand1] = m->memory[mem_address];
+			} else {
+				m->memory[mem_address] = registers[(unsigned char)instr.operand2];
+			}
+			break;
+	}
+	++m->count_executed_instructions;
+
+	// Jumps outside the program end it
+	if(next > prog->count_instructions) {
+		next = prog->count_instructions;
+	}
+	return next;
 }
 
+// Find the basic blocks: the first instruction, jump targets and instructions after jumps.
+// is_leader must hold count_instructions + 1 zeroed entries; the last one marks the end.
+void mark_block_leaders(const struct program_t * prog, unsigned char * is_leader)
+{
+	unsigned int i;
+
+	is_leader[0] = 1;
+	is_leader[prog->count_instructions] = 1;
+	for(i = 0; i < prog->count_instructions; i++) {
+		const struct instruction_t * instr = &prog->instructions[i];
+
+		if(instr->operation == JE || instr->operation == JMP) {
+			unsigned int target = instr->target - prog->first_address;
+
+			is_leader[target > prog->count_instructions ? prog->count_instructions : target] = 1;
+			is_leader[i + 1] = 1;
+		}
+	}
+}
+
+// Monotonic wall-clock time in seconds, for timing phases of the simulator
+double seconds_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Worker threads to use when none are requested: one per online processor
+unsigned int default_thread_count(void)
+{
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return online > 0 ? (unsigned int) online : 1;
+}
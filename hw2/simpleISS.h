@@ -0,0 +1,193 @@
+// Description: Shared definitions for the simple instruction set simulator
+#ifndef __SIMPLEISS__H
+#define __SIMPLEISS__H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "trace.h"
+
+#define LOCAL_MEMORY_SIZE 256 // default cache capacity in bytes
+#define MAIN_MEMORY_SIZE 256
+#define INITIAL_NO_INSTRUCTIONS 1024 // instructions stored without allocating
+#define NO_REGISTERS 6
+#define CHECKSUM_SEED 2166136261u // FNV-1a offset basis
+
+// Default cycle costs of a LD/ST that hits/misses in local memory
+#define HIT_CYCLES 2
+#define MISS_CYCLES 45
+#define L2_HIT_CYCLES 10 // default L2 latency when an L2 is configured
+#define UPGRADE_CYCLES 10 // bus upgrade before a store to a shared line, multi-core mode
+
+// Defintions for CPU instructions
+
+typedef enum Operation {MOV, ADD_REG, ADD_NUM, CMP, JE, JMP, LD, ST} Operation;
+
+// Packed instruction, 8 bytes
+struct instruction_t {
+	unsigned char operation; // enum Operation
+	char operand1; // destination register index, address register of ST
+	char operand2; // source register index or immediate
+	unsigned char reserved;
+	unsigned int target; // JE/JMP address
+};
+
+// Parsed assembly program. Instructions are stored in address order starting at first_address.
+// Small programs live in initial_store; larger ones move to a heap array that doubles as it
+// fills. Programs loaded from a binary image point straight into the read-only mapping.
+// A zero-initialized program_t is empty and ready to use. Do not copy a program_t by
+// value, instructions may point into the struct itself; move_program does it safely.
+struct program_t {
+	struct instruction_t * instructions;
+	unsigned int count_instructions;
+	unsigned int capacity;
+	unsigned int first_address; // address of first instruction
+	void * mapping; // mapped binary image backing instructions, or NULL
+	size_t mapping_size;
+	struct instruction_t initial_store[INITIAL_NO_INSTRUCTIONS];
+};
+
+// Simulated CPU state, shared by every execution engine
+struct machine_t {
+	char registers[NO_REGISTERS]; // Array of registers
+	unsigned char CMP_VAL;
+	unsigned int count_executed_instructions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits_to_local_memory;
+	unsigned int count_memory_accesses;
+	char memory[MAIN_MEMORY_SIZE]; // data of every address, cached or not
+	struct cache_t cache; // which addresses are held in local memory (L1)
+	struct cache_t l2; // unused unless cache.next points to it; do not copy a machine_t by value
+};
+
+#define MAX_SWEEP_DIMENSIONS 8
+
+// One --sweep=<cache option>=<v1>,<v2>,... axis; values points into the command line
+struct sweep_dimension_t {
+	char name[64]; // option name without the leading --
+	const char * values;
+	unsigned int count_values;
+};
+
+// Grid of cache configurations for run_sweep
+struct sweep_t {
+	struct sweep_dimension_t dimensions[MAX_SWEEP_DIMENSIONS];
+	unsigned int count_dimensions;
+	unsigned int count_threads; // 0 for one per online core
+	int json; // JSON lines instead of CSV
+	const struct trace_t * trace; // replay this instead of executing the program when set
+};
+
+// Execution totals of one instruction in profiling mode
+struct profile_entry_t {
+	unsigned int count_executions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits;
+	unsigned int count_misses;
+};
+
+struct profile_t {
+	struct profile_entry_t * entries; // one per instruction
+	unsigned int count_entries;
+};
+
+// When --checkpoint takes its snapshot; whichever trigger is reached first
+struct checkpoint_trigger_t {
+	unsigned int count_instructions; // after this many executed instructions, 0 for none
+	unsigned int pc; // before the instruction at this address executes
+	int has_pc;
+};
+
+// SimPoint-style sampled simulation (--sample)
+struct sample_config_t {
+	unsigned int interval; // executed instructions per interval
+	unsigned int max_clusters; // largest number of clusters tried
+	unsigned int warmup; // intervals simulated before a sample to warm the caches
+	unsigned int per_cluster; // intervals simulated in detail per cluster, 2 or more for an error bound
+};
+
+// Host performance counters around a phase of the simulator (--perf-counters)
+enum perf_event {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_TASK_CLOCK, COUNT_PERF_EVENTS};
+
+struct perf_counters_t {
+	int fds[COUNT_PERF_EVENTS]; // -1 for events the host cannot count
+};
+
+struct perf_sample_t {
+	unsigned long long values[COUNT_PERF_EVENTS];
+	int valid[COUNT_PERF_EVENTS];
+};
+
+void clear_program(struct program_t * prog); // Empty a program, keeping its storage
+int append_instruction(struct program_t * prog, const struct instruction_t * instr); // Add an instruction, growing the store; -1 on overflow or OOM
+void free_program(struct program_t * prog); // Release heap storage of a program
+void move_program(struct program_t * to, struct program_t * from); // Replace to with from, leaving from empty
+int parse_program(const char * text, size_t size, struct program_t * prog); // Decode assembly text held in memory
+int load_program(const char * path, struct program_t * prog); // Map and decode an assembly file in one pass
+int load_program_sscanf(const char * path, struct program_t * prog); // Original sscanf-per-pattern loader
+int benchmark_parsers(const char * path); // Report lines/s of both loaders
+
+uint32_t checksum(const void * data, size_t size, uint32_t hash); // FNV-1a, start with CHECKSUM_SEED
+int is_image_file(const char * path); // Check for the binary image magic
+int write_image(const char * path, const struct program_t * prog); // Save a program as a binary image
+int map_image(const char * path, struct program_t * prog); // Map a binary image without copying
+int load_cached_program(const char * path, struct program_t * prog); // Use path.img, rebuilding it when stale
+
+int init_machine(struct machine_t * m, const struct memory_config_t * config); // Allocate the caches and reset
+void reset_machine(struct machine_t * m); // Clear registers, memory, cache and counters
+void free_machine(struct machine_t * m);
+unsigned int step_instruction(const struct program_t * prog, struct machine_t * m, unsigned int index); // Execute one instruction, return next index
+void execute_switch(const struct program_t * prog, struct machine_t * m); // Reference switch-based interpreter
+void resume_switch(const struct program_t * prog, struct machine_t * m, unsigned int index); // Switch loop from an instruction index
+void execute_threaded(const struct program_t * prog, struct machine_t * m); // Pre-decoded threaded-dispatch interpreter
+void execute_fused(const struct program_t * prog, struct machine_t * m); // Threaded interpreter with superinstruction fusion
+void execute_jit(const struct program_t * prog, struct machine_t * m); // Compile basic blocks to x86-64, interpret the rest
+void execute_fast_forward(const struct program_t * prog, struct machine_t * m); // Step interpreter that skips steady-state loops
+void execute_optimized(const struct program_t * prog, struct machine_t * m); // Constant-fold, thread and prune the CFG, then interpret
+void print_memory_statistics(const struct machine_t * m); // Per-level hit/miss breakdown
+void mark_block_leaders(const struct program_t * prog, unsigned char * is_leader); // Flag the first instruction of each basic block
+double seconds_now(void); // Monotonic clock in seconds
+unsigned int default_thread_count(void); // Online processors, at least 1
+
+int init_profile(const struct program_t * prog, struct profile_t * profile); // Allocate zeroed per-instruction counters
+void free_profile(struct profile_t * profile);
+void execute_profiled(const struct program_t * prog, struct machine_t * m, struct profile_t * profile); // Step interpreter that fills profile
+void print_profile(const struct program_t * prog, const struct profile_t * profile); // Hotspot blocks and instructions by cycles
+int write_folded_profile(const char * path, const struct program_t * prog, const struct profile_t * profile); // flamegraph.pl input
+
+void execute_traced(const struct program_t * prog, struct machine_t * m, struct trace_writer_t * t); // Step interpreter that records every LD/ST
+int is_trace_file(const char * path); // Check for the trace magic
+int map_trace(const char * path, struct trace_t * trace); // Map a finished trace read-only
+void unmap_trace(struct trace_t * trace);
+void replay_trace(const struct trace_t * trace, struct machine_t * m); // Run the recorded LD/STs through m's caches
+
+unsigned int execute_until(const struct program_t * prog, struct machine_t * m, const struct checkpoint_trigger_t * trigger); // Step to the trigger, return the next index
+int write_checkpoint(const char * path, const struct program_t * prog, const struct machine_t * m, unsigned int index); // Save the full machine state
+int read_checkpoint(const char * path, const struct program_t * prog, struct machine_t * m, unsigned int * index); // Initialize m from a checkpoint of prog
+
+int parse_sweep_option(const char * arg, struct sweep_t * sweep); // Add a --sweep dimension, 1 if consumed, -1 if malformed
+int run_sweep(const struct program_t * prog, const struct memory_config_t * base, const struct sweep_t * sweep,
+	void (*execute)(const struct program_t *, struct machine_t *)); // Simulate every grid point in parallel
+int run_batch(const char * source, const struct memory_config_t * config,
+	void (*execute)(const struct program_t *, struct machine_t *), unsigned int count_threads, int json); // Run a list or directory of programs
+int run_benchmark(const char * path, unsigned int runs, const struct memory_config_t * config,
+	const char * baseline, const char * save); // Time loaders and engines; 1 on a regression against baseline
+double t_quantile(unsigned int df); // Two-sided 95% Student t quantile
+int benchmark_reset(const char * path, const struct memory_config_t * config); // Reset cost against cache size
+int open_perf_counters(struct perf_counters_t * p); // -1 when no event can be counted
+void start_perf_counters(struct perf_counters_t * p);
+void stop_perf_counters(struct perf_counters_t * p, struct perf_sample_t * sample);
+void close_perf_counters(struct perf_counters_t * p);
+void print_perf_sample(const char * phase, const struct perf_sample_t * sample, unsigned int count_simulated_instructions);
+int run_sampled(const struct program_t * prog, const struct memory_config_t * config,
+	const struct sample_config_t * sample); // Estimate cycles and hits from clustered intervals
+int run_lockstep(const struct program_t * prog, const struct memory_config_t * config, const char * seeds,
+	int json, int verify); // Run one instance per seed line in vector lanes
+int run_multicore(char * paths, const struct memory_config_t * config, unsigned int quantum,
+	int mesi); // One comma-separated program per core, coherent private caches
+int run_server(const char * path, const struct memory_config_t * config, unsigned int count_threads,
+	unsigned int count_programs, unsigned int max_instructions); // Serve jobs on a Unix domain socket until killed
+int analyze_stack_distances(const struct program_t * prog, const struct memory_config_t * config); // Print the LRU miss-ratio curve
+
+#endif
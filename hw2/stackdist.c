@@ -0,0 +1,97 @@
+// Description: Single-pass LRU stack-distance analysis of the LD/ST address stream.
+// The program is run once with the step interpreter and the address of every LD/ST is pushed
+// through an LRU stack of cache lines. The depth at which a line is found is its stack
+// distance; a fully associative LRU cache of C lines hits exactly the accesses with distance
+// below C, so one pass gives the hit count of every capacity (the miss-ratio curve).
+
+#include "simpleISS.h"
+
+#define COLD_MISS 0xFFFFFFFFu
+
+struct stack_distance_t {
+	unsigned int * stack; // line numbers, most recently used first
+	unsigned int depth; // lines currently on the stack
+	unsigned int * histogram; // accesses per stack distance
+	unsigned int count_accesses;
+};
+
+// Move line to the top of the stack and return its previous depth, COLD_MISS if new
+static unsigned int stack_access(struct stack_distance_t * s, unsigned int line)
+{
+	unsigned int distance;
+
+	for(distance = 0; distance < s->depth; distance++) {
+		if(s->stack[distance] == line) {
+			break;
+		}
+	}
+	memmove(s->stack + 1, s->stack, distance * sizeof(*s->stack));
+	s->stack[0] = line;
+	if(distance == s->depth) {
+		++s->depth;
+		return COLD_MISS;
+	}
+	return distance;
+}
+
+int analyze_stack_distances(const struct program_t * prog, const struct memory_config_t * config)
+{
+	struct stack_distance_t s;
+	struct machine_t * m = malloc(sizeof(*m));
+	unsigned int line_size = config->l1.line_size;
+	unsigned int count_lines;
+	unsigned int index = 0;
+	unsigned int capacity;
+	unsigned int hits = 0;
+	unsigned int distance = 0;
+
+	if(m == NULL || line_size == 0 || line_size > MAIN_MEMORY_SIZE || (line_size & (line_size - 1)) != 0) {
+		printf("Error: stack distance analysis needs a power of two line size up to %d\n", MAIN_MEMORY_SIZE);
+		free(m);
+		return -1;
+	}
+	count_lines = MAIN_MEMORY_SIZE / line_size;
+	memset(&s, 0, sizeof(s));
+	s.stack = malloc(count_lines * sizeof(*s.stack));
+	s.histogram = calloc(count_lines, sizeof(*s.histogram));
+	if(s.stack == NULL || s.histogram == NULL || init_machine(m, config) != 0) {
+		printf("Error: Out of memory allocating stack distance analysis\n");
+		free(s.stack);
+		free(s.histogram);
+		free(m);
+		return -1;
+	}
+
+	// Record the address stream of the LD/ST cases while stepping through the program
+	while(index < prog->count_instructions) {
+		const struct instruction_t * instr = &prog->instructions[index];
+
+		if(instr->operation == LD || instr->operation == ST) {
+			unsigned char address = (unsigned char) m->registers[(unsigned char)(instr->operation == LD ? instr->operand2 : instr->operand1)];
+			unsigned int d = stack_access(&s, address / line_size);
+
+			// A first touch misses at every capacity
+			if(d != COLD_MISS) {
+				++s.histogram[d];
+			}
+			++s.count_accesses;
+		}
+		index = step_instruction(prog, m, index);
+	}
+
+	// Miss-ratio curve at every power of two number of lines
+	printf("cache-size,hits,misses,miss_ratio\n");
+	for(capacity = 1; capacity <= count_lines; capacity <<= 1) {
+		for(; distance < capacity; distance++) {
+			hits += s.histogram[distance];
+		}
+		printf("%u,%u,%u,%.6f\n", capacity * line_size, hits, s.count_accesses - hits,
+			s.count_accesses == 0 ? 0.0 : (double) (s.count_accesses - hits) / s.count_accesses);
+	}
+
+	free_machine(m);
+	free(m);
+	free(s.stack);
+	free(s.histogram);
+	return 0;
+}
@@ -0,0 +1,258 @@
+// Description: Parallel design-space sweep over cache configurations.
+// The program is parsed (or the trace mapped) once and shared read-only. Every point of the grid (the cross product
+// of the --sweep dimensions) is simulated on its own machine_t by a pool of threads that take
+// point indices from a shared counter. Results are collected per point and printed in grid
+// order once all workers are done, one CSV or JSON row per configuration.
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include "simpleISS.h"
+
+#define MAX_SWEEP_OPTION 64 // longest value, and longest option name, of a sweep dimension
+
+struct sweep_result_t {
+	int valid; // 0 when the configuration was rejected by init_machine
+	unsigned int count_executed_instructions;
+	unsigned int count_clock_cycles;
+	unsigned int count_hits_to_local_memory;
+	unsigned int count_memory_accesses;
+	unsigned int l2_hits;
+	unsigned int l2_misses;
+};
+
+struct sweep_job_t {
+	const struct program_t * prog;
+	const struct memory_config_t * base;
+	const struct sweep_t * sweep;
+	void (*execute)(const struct program_t *, struct machine_t *);
+	struct sweep_result_t * results;
+	unsigned int count_points;
+	unsigned int next_point; // taken with an atomic add
+};
+
+// Copy value number index of a comma separated list into buffer
+static void sweep_value(const char * values, unsigned int index, char * buffer, size_t size)
+{
+	size_t length;
+
+	while(index-- > 0) {
+		values = strchr(values, ',') + 1;
+	}
+	length = strcspn(values, ",");
+	if(length >= size) {
+		length = size - 1;
+	}
+	memcpy(buffer, values, length);
+	buffer[length] = '\0';
+}
+
+// Apply value number index of a dimension to config through the normal option parser
+static int apply_sweep_value(const struct sweep_dimension_t * dimension, unsigned int index, struct memory_config_t * config)
+{
+	char value[MAX_SWEEP_OPTION];
+	char option[2 * MAX_SWEEP_OPTION];
+
+	sweep_value(dimension->values, index, value, sizeof(value));
+	snprintf(option, sizeof(option), "--%s=%s", dimension->name, value);
+	return parse_cache_option(option, config);
+}
+
+int parse_sweep_option(const char * arg, struct sweep_t * sweep)
+{
+	struct sweep_dimension_t * dimension;
+	struct memory_config_t scratch;
+	const char * equals;
+	const char * p;
+	unsigned int i;
+
+	if(strncmp(arg, "--sweep=", 8) != 0) {
+		return 0;
+	}
+	arg += 8;
+	equals = strchr(arg, '=');
+	if(equals == NULL || equals == arg || equals - arg >= MAX_SWEEP_OPTION || sweep->count_dimensions == MAX_SWEEP_DIMENSIONS) {
+		printf("Error: --sweep needs <cache option>=<value>,<value>,... (at most %d dimensions)\n", MAX_SWEEP_DIMENSIONS);
+		return -1;
+	}
+
+	dimension = &sweep->dimensions[sweep->count_dimensions];
+	memcpy(dimension->name, arg, equals - arg);
+	dimension->name[equals - arg] = '\0';
+	dimension->values = equals + 1;
+	dimension->count_values = 1;
+	for(p = dimension->values; *p != '\0'; p++) {
+		dimension->count_values += *p == ',';
+	}
+
+	// Every value must be accepted by the cache option parser
+	default_memory_config(&scratch);
+	for(i = 0; i < dimension->count_values; i++) {
+		if(apply_sweep_value(dimension, i, &scratch) != 1) {
+			printf("Error: --sweep=%s is not a sweepable cache option\n", arg);
+			return -1;
+		}
+	}
+	++sweep->count_dimensions;
+	return 1;
+}
+
+// Configuration of a grid point: point is a mixed-radix number, first dimension fastest
+static void point_config(const struct sweep_job_t * job, unsigned int point, struct memory_config_t * config)
+{
+	unsigned int d;
+
+	*config = *job->base;
+	for(d = 0; d < job->sweep->count_dimensions; d++) {
+		const struct sweep_dimension_t * dimension = &job->sweep->dimensions[d];
+
+		apply_sweep_value(dimension, point % dimension->count_values, config);
+		point /= dimension->count_values;
+	}
+}
+
+static void * sweep_worker(void * argument)
+{
+	struct sweep_job_t * job = argument;
+	struct machine_t * m = malloc(sizeof(*m));
+	unsigned int point;
+
+	if(m == NULL) {
+		printf("Error: Out of memory allocating a sweep worker\n");
+		return NULL;
+	}
+	while((point = __sync_fetch_and_add(&job->next_point, 1)) < job->count_points) {
+		struct sweep_result_t * result = &job->results[point];
+		struct memory_config_t config;
+
+		point_config(job, point, &config);
+		if(init_machine(m, &config) != 0) {
+			result->valid = 0;
+			continue;
+		}
+		if(job->sweep->trace != NULL) {
+			replay_trace(job->sweep->trace, m);
+		} else {
+			job->execute(job->prog, m);
+		}
+
+		result->valid = 1;
+		result->count_executed_instructions = m->count_executed_instructions;
+		result->count_clock_cycles = m->count_clock_cycles;
+		result->count_hits_to_local_memory = m->count_hits_to_local_memory;
+		result->count_memory_accesses = m->count_memory_accesses;
+		result->l2_hits = m->l2.hits;
+		result->l2_misses = m->l2.misses;
+		free_machine(m);
+	}
+	free(m);
+	return NULL;
+}
+
+// JSON numbers are written bare, anything else (lru, wb, ...) as a string
+static int is_number(const char * s)
+{
+	if(*s == '\0') {
+		return 0;
+	}
+	while(*s >= '0' && *s <= '9') {
+		++s;
+	}
+	return *s == '\0';
+}
+
+static void print_sweep_row(const struct sweep_job_t * job, unsigned int point, int json)
+{
+	const struct sweep_result_t * result = &job->results[point];
+	unsigned int index = point;
+	unsigned int d;
+
+	if(json) {
+		printf("{");
+	}
+	for(d = 0; d < job->sweep->count_dimensions; d++) {
+		const struct sweep_dimension_t * dimension = &job->sweep->dimensions[d];
+		char value[MAX_SWEEP_OPTION];
+
+		sweep_value(dimension->values, index % dimension->count_values, value, sizeof(value));
+		index /= dimension->count_values;
+		if(!json) {
+			printf("%s,", value);
+		} else if(is_number(value)) {
+			printf("\"%s\": %s, ", dimension->name, value);
+		} else {
+			printf("\"%s\": \"%s\", ", dimension->name, value);
+		}
+	}
+	if(json) {
+		printf("\"instructions\": %u, \"cycles\": %u, \"l1_hits\": %u, \"accesses\": %u, \"l2_hits\": %u, \"l2_misses\": %u}\n",
+			result->count_executed_instructions, result->count_clock_cycles, result->count_hits_to_local_memory,
+			result->count_memory_accesses, result->l2_hits, result->l2_misses);
+	} else {
+		printf("%u,%u,%u,%u,%u,%u\n",
+			result->count_executed_instructions, result->count_clock_cycles, result->count_hits_to_local_memory,
+			result->count_memory_accesses, result->l2_hits, result->l2_misses);
+	}
+}
+
+int run_sweep(const struct program_t * prog, const struct memory_config_t * base, const struct sweep_t * sweep,
+	void (*execute)(const struct program_t *, struct machine_t *))
+{
+	struct sweep_job_t job;
+	pthread_t * threads;
+	unsigned int count_threads = sweep->count_threads;
+	unsigned int count_started;
+	unsigned int point;
+	unsigned int d;
+
+	job.prog = prog;
+	job.base = base;
+	job.sweep = sweep;
+	job.execute = execute;
+	job.next_point = 0;
+	job.count_points = 1;
+	for(d = 0; d < sweep->count_dimensions; d++) {
+		job.count_points *= sweep->dimensions[d].count_values;
+	}
+	if(count_threads == 0) {
+		count_threads = default_thread_count();
+	}
+	if(count_threads > job.count_points) {
+		count_threads = job.count_points;
+	}
+
+	job.results = calloc(job.count_points, sizeof(*job.results));
+	threads = malloc(count_threads * sizeof(*threads));
+	if(job.results == NULL || threads == NULL) {
+		printf("Error: Out of memory allocating sweep results\n");
+		free(job.results);
+		free(threads);
+		return -1;
+	}
+
+	// The calling thread works too, so one thread fewer is started
+	for(count_started = 0; count_started + 1 < count_threads; count_started++) {
+		if(pthread_create(&threads[count_started], NULL, sweep_worker, &job) != 0) {
+			break;
+		}
+	}
+	sweep_worker(&job);
+	while(count_started > 0) {
+		pthread_join(threads[--count_started], NULL);
+	}
+
+	if(!sweep->json) {
+		for(d = 0; d < sweep->count_dimensions; d++) {
+			printf("%s,", sweep->dimensions[d].name);
+		}
+		printf("instructions,cycles,l1_hits,accesses,l2_hits,l2_misses\n");
+	}
+	for(point = 0; point < job.count_points; point++) {
+		if(job.results[point].valid) {
+			print_sweep_row(&job, point, sweep->json);
+		}
+	}
+
+	free(job.results);
+	free(threads);
+	return 0;
+}
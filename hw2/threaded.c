@@ -0,0 +1,364 @@
+// Description: Pre-decoded, threaded-dispatch execution engine.
+// The parsed program is translated once into an array of decoded instructions that carry the
+// address of their handler and jump targets already resolved to array indices. Each handler
+// jumps straight to the next one (computed goto), so there is no central switch and no
+// PC - first_address subtraction per step.
+// Optionally, a fusion pass merges common sequences inside basic blocks into
+// superinstructions so loop bodies need fewer dispatches per simulated instruction.
+
+#include "simpleISS.h"
+
+// Decoded operations. The first entries match enum Operation.
+enum decoded_op {
+	OP_MOV, OP_ADD_REG, OP_ADD_NUM, OP_CMP, OP_JE, OP_JMP, OP_LD, OP_ST, OP_HALT,
+	// Superinstructions built by fuse_program()
+	OP_MOV_MOV, // MOV Rn, a; MOV Rm, b
+	OP_ADD_NUM_ADD_NUM, // ADD Rn, a; ADD Rm, b
+	OP_ADD_REG_ADD_NUM, // ADD Rn, Rm; ADD Rk, b
+	OP_ADD_NUM_ADD_REG, // ADD Rn, a; ADD Rk, Rl
+	OP_CMP_JE, // CMP Rn, Rm; JE taken
+	OP_JE_JMP, // JE taken; JMP target2
+	OP_CMP_JE_JMP, // CMP Rn, Rm; JE taken; JMP target2
+	NO_DECODED_OPS
+};
+
+// Longest chain folded into one entry, so count cannot overflow
+#define MAX_FUSED_COUNT 250
+
+struct decoded_t {
+	const void * handler; // label of the handler for this instruction
+	unsigned int target; // index of the (JE) jump target in the decoded program
+	unsigned int target2; // index of the JMP target of a fused JE/JMP pair
+	unsigned char op; // enum decoded_op
+	unsigned char count; // simulated instructions covered, not counting a skipped trailing JMP
+	unsigned char reg1; // destination/first register index
+	unsigned char reg2; // source/second register index
+	unsigned char reg3; // registers of the second half of a fused pair
+	unsigned char reg4;
+	char number; // immediate operand
+	char number2; // immediate operand of the second half of a fused pair
+};
+
+// Map a jump address to an index in the decoded program. Addresses outside the program
+// resolve to the halt slot at index count_instructions.
+static unsigned int resolve_target(const struct program_t * prog, unsigned int address)
+{
+	unsigned int index = address - prog->first_address;
+
+	if(index >= prog->count_instructions) {
+		return prog->count_instructions;
+	}
+	return index;
+}
+
+// Returns 1 for MOV/ADD_NUM, the instructions whose effect is a register set to/plus a constant
+static int is_immediate_op(unsigned char op)
+{
+	return op == OP_MOV || op == OP_ADD_NUM;
+}
+
+// Fuse common sequences into superinstructions. Only the first instruction of a fused group may
+// be a jump target, so control never enters the middle of one. The program is compacted in
+// place; the new length is returned and jump targets are remapped. Without memory for the
+// bookkeeping the program is left unfused.
+static unsigned int fuse_program(struct decoded_t * code, unsigned int count_instructions)
+{
+	unsigned char * is_target = calloc(count_instructions + 1, 1);
+	unsigned int * new_index = malloc((count_instructions + 1) * sizeof(*new_index));
+	unsigned int i = 0;
+	unsigned int j;
+	unsigned int w = 0;
+
+	if(is_target == NULL || new_index == NULL) {
+		printf("Error: Out of memory fusing program\n");
+		free(is_target);
+		free(new_index);
+		return count_instructions;
+	}
+
+	for(i = 0; i < count_instructions; i++) {
+		if(code[i].op == OP_JE || code[i].op == OP_JMP) {
+			is_target[code[i].target] = 1;
+		}
+	}
+
+	i = 0;
+	while(i < count_instructions) {
+		struct decoded_t d = code[i];
+
+		new_index[i] = w;
+		j = i + 1;
+
+		// Collapse chains of constant writes/adds to one register: MOV/ADD then MOV/ADD
+		while(is_immediate_op(d.op) && d.count < MAX_FUSED_COUNT && j < count_instructions && !is_target[j]
+				&& is_immediate_op(code[j].op) && code[j].reg1 == d.reg1) {
+			if(code[j].op == OP_MOV) {
+				d.op = OP_MOV;
+				d.number = code[j].number;
+			} else {
+				d.number = (char) (d.number + code[j].number);
+			}
+			d.count += code[j].count;
+			++j;
+		}
+
+		// Pair the result with the following instruction
+		if(j < count_instructions && !is_target[j]) {
+			const struct decoded_t * next = &code[j];
+
+			if(d.op == OP_CMP && next->op == OP_JE) {
+				d.target = next->target;
+				d.count += next->count;
+				++j;
+				if(j < count_instructions && !is_target[j] && code[j].op == OP_JMP) {
+					d.op = OP_CMP_JE_JMP;
+					d.target2 = code[j].target;
+					++j;
+				} else {
+					d.op = OP_CMP_JE;
+				}
+			} else if(d.op == OP_JE && next->op == OP_JMP) {
+				d.op = OP_JE_JMP;
+				d.target2 = next->target;
+				++j;
+			} else if(d.op == OP_MOV && next->op == OP_MOV) {
+				d.op = OP_MOV_MOV;
+				d.reg3 = next->reg1;
+				d.number2 = next->number;
+				d.count += next->count;
+				++j;
+			} else if(d.op == OP_ADD_NUM && next->op == OP_ADD_NUM) {
+				d.op = OP_ADD_NUM_ADD_NUM;
+				d.reg3 = next->reg1;
+				d.number2 = next->number;
+				d.count += next->count;
+				++j;
+			} else if(d.op == OP_ADD_REG && next->op == OP_ADD_NUM) {
+				d.op = OP_ADD_REG_ADD_NUM;
+				d.reg3 = next->reg1;
+				d.number2 = next->number;
+				d.count += next->count;
+				++j;
+			} else if(d.op == OP_ADD_NUM && next->op == OP_ADD_REG) {
+				d.op = OP_ADD_NUM_ADD_REG;
+				d.reg3 = next->reg1;
+				d.reg4 = next->reg2;
+				d.count += next->count;
+				++j;
+			}
+		}
+
+		code[w++] = d;
+		i = j;
+	}
+	new_index[count_instructions] = w;
+
+	// Remap jump targets to the compacted program
+	for(i = 0; i < w; i++) {
+		code[i].target = new_index[code[i].target];
+		code[i].target2 = new_index[code[i].target2];
+	}
+
+	free(is_target);
+	free(new_index);
+	return w;
+}
+
+static void run_threaded(const struct program_t * prog, struct machine_t * m, int fuse)
+{
+	static const void * const labels[NO_DECODED_OPS] = {
+		[OP_MOV] = &&do_mov, [OP_ADD_REG] = &&do_add_reg, [OP_ADD_NUM] = &&do_add_num,
+		[OP_CMP] = &&do_cmp, [OP_JE] = &&do_je, [OP_JMP] = &&do_jmp, [OP_LD] = &&do_ld,
+		[OP_ST] = &&do_st, [OP_HALT] = &&do_halt,
+		[OP_MOV_MOV] = &&do_mov_mov, [OP_ADD_NUM_ADD_NUM] = &&do_add_num_add_num,
+		[OP_ADD_REG_ADD_NUM] = &&do_add_reg_add_num, [OP_ADD_NUM_ADD_REG] = &&do_add_num_add_reg,
+		[OP_CMP_JE] = &&do_cmp_je, [OP_JE_JMP] = &&do_je_jmp, [OP_CMP_JE_JMP] = &&do_cmp_je_jmp
+	};
+	struct decoded_t * code;
+	register const struct decoded_t * ip;
+	register unsigned int count_executed_instructions = m->count_executed_instructions;
+	register unsigned int count_clock_cycles = m->count_clock_cycles;
+	register unsigned int count_hits_to_local_memory = m->count_hits_to_local_memory;
+	register unsigned int count_memory_accesses = m->count_memory_accesses;
+	unsigned char CMP_VAL = m->CMP_VAL;
+	char * registers = m->registers;
+	char * memory = m->memory;
+	struct cache_t * cache = &m->cache;
+	unsigned char mem_address;
+	int hit;
+	unsigned int count_decoded = prog->count_instructions;
+	unsigned int i;
+
+	// Translate the program, with one extra slot at the end to stop execution
+	code = calloc(prog->count_instructions + 1, sizeof(*code));
+	if(code == NULL) {
+		printf("Error: Out of memory decoding program\n");
+		execute_switch(prog, m);
+		return;
+	}
+
+	for(i = 0; i < prog->count_instructions; i++) {
+		const struct instruction_t * instr = &prog->instructions[i];
+
+		code[i].op = instr->operation;
+		code[i].count = 1;
+		code[i].reg1 = (unsigned char) instr->operand1;
+		code[i].reg2 = (unsigned char) instr->operand2;
+		code[i].number = instr->operand2;
+		code[i].target = prog->count_instructions;
+		code[i].target2 = prog->count_instructions;
+		if(instr->operation == JE || instr->operation == JMP) {
+			code[i].target = resolve_target(prog, instr->target);
+		}
+	}
+
+	if(fuse) {
+		count_decoded = fuse_program(code, prog->count_instructions);
+	}
+	code[count_decoded].op = OP_HALT;
+	for(i = 0; i <= count_decoded; i++) {
+		code[i].handler = labels[code[i].op];
+	}
+
+#define DISPATCH() goto *ip->handler
+
+	ip = code;
+	DISPATCH();
+
+do_mov:
+	registers[ip->reg1] = ip->number;
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_add_reg:
+	registers[ip->reg1] += registers[ip->reg2];
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_add_num:
+	registers[ip->reg1] += ip->number;
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_cmp:
+	CMP_VAL = (registers[ip->reg1] == registers[ip->reg2]);
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_je:
+	++count_clock_cycles;
+	++count_executed_instructions;
+	ip = CMP_VAL ? code + ip->target : ip + 1;
+	DISPATCH();
+
+do_jmp:
+	++count_clock_cycles;
+	++count_executed_instructions;
+	ip = code + ip->target;
+	DISPATCH();
+
+do_ld:
+	++count_memory_accesses;
+	++count_executed_instructions;
+	mem_address = (unsigned char) registers[ip->reg2];
+
+	count_clock_cycles += cache_access(cache, mem_address, 0, &hit);
+	count_hits_to_local_memory += hit;
+
+	registers[ip->reg1] = memory[mem_address];
+	++ip;
+	DISPATCH();
+
+do_st:
+	++count_memory_accesses;
+	++count_executed_instructions;
+	mem_address = (unsigned char) registers[ip->reg1];
+
+	count_clock_cycles += cache_access(cache, mem_address, 1, &hit);
+	count_hits_to_local_memory += hit;
+
+	memory[mem_address] = registers[ip->reg2];
+	++ip;
+	DISPATCH();
+
+do_mov_mov:
+	registers[ip->reg1] = ip->number;
+	registers[ip->reg3] = ip->number2;
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_add_num_add_num:
+	registers[ip->reg1] += ip->number;
+	registers[ip->reg3] += ip->number2;
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_add_reg_add_num:
+	registers[ip->reg1] += registers[ip->reg2];
+	registers[ip->reg3] += ip->number2;
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_add_num_add_reg:
+	registers[ip->reg1] += ip->number;
+	registers[ip->reg3] += registers[ip->reg4];
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	++ip;
+	DISPATCH();
+
+do_cmp_je:
+	CMP_VAL = (registers[ip->reg1] == registers[ip->reg2]);
+	count_clock_cycles += ip->count;
+	count_executed_instructions += ip->count;
+	ip = CMP_VAL ? code + ip->target : ip + 1;
+	DISPATCH();
+
+// The trailing JMP only executes when the JE falls through
+do_je_jmp:
+	count_clock_cycles += ip->count + !CMP_VAL;
+	count_executed_instructions += ip->count + !CMP_VAL;
+	ip = code + (CMP_VAL ? ip->target : ip->target2);
+	DISPATCH();
+
+do_cmp_je_jmp:
+	CMP_VAL = (registers[ip->reg1] == registers[ip->reg2]);
+	count_clock_cycles += ip->count + !CMP_VAL;
+	count_executed_instructions += ip->count + !CMP_VAL;
+	ip = code + (CMP_VAL ? ip->target : ip->target2);
+	DISPATCH();
+
+#undef DISPATCH
+
+do_halt:
+	m->count_executed_instructions = count_executed_instructions;
+	m->count_clock_cycles = count_clock_cycles;
+	m->count_hits_to_local_memory = count_hits_to_local_memory;
+	m->count_memory_accesses = count_memory_accesses;
+	m->CMP_VAL = CMP_VAL;
+	free(code);
+}
+
+void execute_threaded(const struct program_t * prog, struct machine_t * m)
+{
+	run_threaded(prog, m, 0);
+}
+
+void execute_fused(const struct program_t * prog, struct machine_t * m)
+{
+	run_threaded(prog, m, 1);
+}
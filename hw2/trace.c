@@ -0,0 +1,265 @@
+// Description: Trace capture and replay: double-buffered trace writer, the tracing step
+// loop, and replay of a mapped trace through the cache model alone.
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "simpleISS.h"
+
+static int write_all(int fd, const unsigned char * data, size_t size)
+{
+	while(size > 0) {
+		ssize_t written = write(fd, data, size);
+
+		if(written <= 0) {
+			return -1;
+		}
+		data += written;
+		size -= written;
+	}
+	return 0;
+}
+
+// Write blocks in the order they are handed over, alternating between the two buffers
+static void * trace_writer_thread(void * argument)
+{
+	struct trace_writer_t * t = argument;
+	unsigned int next = 0;
+
+	pthread_mutex_lock(&t->lock);
+	for(;;) {
+		while(!t->full[next] && !t->done) {
+			pthread_cond_wait(&t->changed, &t->lock);
+		}
+		if(!t->full[next]) {
+			break;
+		}
+		pthread_mutex_unlock(&t->lock);
+		if(write_all(t->fd, t->buffers[next], t->lengths[next]) != 0) {
+			t->error = 1;
+		}
+		pthread_mutex_lock(&t->lock);
+		t->full[next] = 0;
+		pthread_cond_broadcast(&t->changed);
+		next ^= 1;
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+
+int open_trace(struct trace_writer_t * t, const char * path, int compressed)
+{
+	struct trace_header_t header;
+
+	memset(t, 0, sizeof(*t));
+	t->compressed = compressed;
+	t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	t->buffers[0] = malloc(TRACE_BLOCK_SIZE);
+	t->buffers[1] = malloc(TRACE_BLOCK_SIZE);
+	if(t->fd < 0 || t->buffers[0] == NULL || t->buffers[1] == NULL) {
+		printf("Error: Could not create trace %s\n", path);
+		goto fail;
+	}
+	t->buffer = t->buffers[0];
+
+	// Placeholder header, completed by close_trace once the counts are known
+	memset(&header, 0, sizeof(header));
+	if(write_all(t->fd, (const unsigned char *) &header, sizeof(header)) != 0) {
+		printf("Error: Could not write trace %s\n", path);
+		goto fail;
+	}
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->changed, NULL);
+	if(pthread_create(&t->thread, NULL, trace_writer_thread, t) != 0) {
+		printf("Error: Could not start the trace writer\n");
+		pthread_mutex_destroy(&t->lock);
+		pthread_cond_destroy(&t->changed);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if(t->fd >= 0) {
+		close(t->fd);
+	}
+	free(t->buffers[0]);
+	free(t->buffers[1]);
+	return -1;
+}
+
+void trace_flush_block(struct trace_writer_t * t)
+{
+	unsigned int current = t->current;
+
+	pthread_mutex_lock(&t->lock);
+	t->lengths[current] = t->length;
+	t->full[current] = 1;
+	pthread_cond_broadcast(&t->changed);
+	current ^= 1;
+	while(t->full[current]) {
+		pthread_cond_wait(&t->changed, &t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	t->current = current;
+	t->buffer = t->buffers[current];
+	t->length = 0;
+}
+
+int close_trace(struct trace_writer_t * t, uint64_t count_executed_instructions)
+{
+	struct trace_header_t header;
+	int status = 0;
+
+	if(t->length > 0) {
+		trace_flush_block(t);
+	}
+	pthread_mutex_lock(&t->lock);
+	t->done = 1;
+	pthread_cond_broadcast(&t->changed);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->thread, NULL);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.flags = t->compressed ? TRACE_COMPRESSED : 0;
+	header.count_records = t->count_records;
+	header.count_executed_instructions = count_executed_instructions;
+	if(t->error || pwrite(t->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+		printf("Error: Could not write trace\n");
+		status = -1;
+	}
+	if(close(t->fd) != 0) {
+		status = -1;
+	}
+
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->changed);
+	free(t->buffers[0]);
+	free(t->buffers[1]);
+	return status;
+}
+
+// Step through the program and append every LD/ST, with its hit or miss, to the trace
+void execute_traced(const struct program_t * prog, struct machine_t * m, struct trace_writer_t * t)
+{
+	unsigned int index = 0;
+
+	while(index < prog->count_instructions) {
+		const struct instruction_t * instr = &prog->instructions[index];
+		unsigned int pc = prog->first_address + index;
+
+		if(instr->operation == LD || instr->operation == ST) {
+			unsigned char address = (unsigned char) m->registers[(unsigned char)(instr->operation == LD ? instr->operand2 : instr->operand1)];
+			unsigned int hits = m->count_hits_to_local_memory;
+
+			index = step_instruction(prog, m, index);
+			trace_access(t, pc, instr->operation == ST, address, m->count_hits_to_local_memory != hits);
+		} else {
+			index = step_instruction(prog, m, index);
+		}
+	}
+}
+
+int is_trace_file(const char * path)
+{
+	char magic[sizeof(TRACE_MAGIC)];
+	FILE * fptr = fopen(path, "rb");
+	int found;
+
+	if(fptr == NULL) {
+		return 0;
+	}
+	found = fread(magic, 1, sizeof(magic), fptr) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+	fclose(fptr);
+	return found;
+}
+
+int map_trace(const char * path, struct trace_t * trace)
+{
+	struct stat st;
+	unsigned char * mapping;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*trace->header)) {
+		printf("Error: %s is not a valid trace\n", path);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		printf("Error: Could not map trace %s\n", path);
+		return -1;
+	}
+	madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+	trace->header = (const struct trace_header_t *) mapping;
+	trace->records = mapping + sizeof(*trace->header);
+	trace->size = st.st_size;
+	if(memcmp(trace->header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+			|| trace->header->version != TRACE_VERSION
+			|| (!(trace->header->flags & TRACE_COMPRESSED)
+				&& trace->size - sizeof(*trace->header) != trace->header->count_records * sizeof(struct trace_record_t))) {
+		printf("Error: %s is not a valid trace\n", path);
+		munmap(mapping, st.st_size);
+		return -1;
+	}
+	return 0;
+}
+
+void unmap_trace(struct trace_t * trace)
+{
+	munmap((void *) trace->header, trace->size);
+	trace->header = NULL;
+}
+
+// Drive only the cache model with the recorded addresses. Every instruction that is not a
+// LD/ST costs one cycle, so the totals match a full run with the same cache configuration.
+void replay_trace(const struct trace_t * trace, struct machine_t * m)
+{
+	register unsigned int count_clock_cycles = m->count_clock_cycles;
+	register unsigned int count_hits_to_local_memory = m->count_hits_to_local_memory;
+	unsigned int count_records = (unsigned int) trace->header->count_records;
+	struct cache_t * cache = &m->cache;
+	int hit;
+
+	if(trace->header->flags & TRACE_COMPRESSED) {
+		const unsigned char * p = trace->records;
+		const unsigned char * end = (const unsigned char *) trace->header + trace->size;
+		unsigned int i;
+
+		for(i = 0; i < count_records; i++) {
+			// Skip the PC delta varint
+			while(p < end && (*p & 0x80)) {
+				++p;
+			}
+			if(end - p < 3) {
+				count_records = i;
+				break;
+			}
+			count_clock_cycles += cache_access(cache, p[2], p[1] & TRACE_STORE, &hit);
+			count_hits_to_local_memory += hit;
+			p += 3;
+		}
+	} else {
+		const struct trace_record_t * record = (const struct trace_record_t *) trace->records;
+		const struct trace_record_t * end = record + count_records;
+
+		for(; record < end; record++) {
+			count_clock_cycles += cache_access(cache, record->address, record->flags & TRACE_STORE, &hit);
+			count_hits_to_local_memory += hit;
+		}
+	}
+
+	m->count_executed_instructions += (unsigned int) trace->header->count_executed_instructions;
+	m->count_memory_accesses += count_records;
+	m->count_clock_cycles = count_clock_cycles + (unsigned int) trace->header->count_executed_instructions - count_records;
+	m->count_hits_to_local_memory = count_hits_to_local_memory;
+}
@@ -0,0 +1,100 @@
+// Description: LD/ST memory-access traces.
+// A trace file is a fixed header followed by one record per LD/ST in execution order. Raw
+// records are 8-byte struct trace_record_t. Compressed records are the zigzag varint of the
+// PC delta to the previous record, a flags byte (TRACE_STORE, TRACE_HIT) and the address.
+// The writer fills fixed-size blocks in memory; a background thread writes full blocks while
+// the simulator fills the other one, so the simulator only waits when both are full.
+#ifndef __TRACE__H
+#define __TRACE__H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "SISSTRC"
+#define TRACE_VERSION 1
+#define TRACE_COMPRESSED 1 // header flag
+#define TRACE_STORE 1 // record flags
+#define TRACE_HIT 2
+#define TRACE_BLOCK_SIZE (1 << 16) // bytes per buffer, a multiple of sizeof(struct trace_record_t)
+#define TRACE_MAX_RECORD 8 // largest encoded record
+
+struct trace_header_t {
+	char magic[8]; // TRACE_MAGIC
+	uint32_t version; // TRACE_VERSION
+	uint32_t flags; // TRACE_COMPRESSED
+	uint64_t count_records;
+	uint64_t count_executed_instructions; // of the traced run, for full statistics on replay
+};
+
+struct trace_record_t {
+	uint32_t pc; // instruction address
+	uint8_t flags; // TRACE_STORE, TRACE_HIT
+	uint8_t address;
+	uint16_t reserved;
+};
+
+struct trace_writer_t {
+	int fd;
+	int compressed;
+	unsigned char * buffers[2];
+	size_t lengths[2];
+	int full[2]; // handed to the writer thread, not yet on disk
+	unsigned int current; // buffer being filled
+	unsigned char * buffer; // buffers[current]
+	size_t length; // bytes used in buffer
+	uint32_t last_pc;
+	uint64_t count_records;
+	int done; // no more blocks will be handed over
+	int error; // a write failed
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+// A trace mapped for replay
+struct trace_t {
+	const struct trace_header_t * header; // start of the mapping
+	const unsigned char * records;
+	size_t size; // bytes mapped
+};
+
+int open_trace(struct trace_writer_t * t, const char * path, int compressed); // Create the file and start the writer thread
+void trace_flush_block(struct trace_writer_t * t); // Hand the current block over and switch to the other one
+int close_trace(struct trace_writer_t * t, uint64_t count_executed_instructions); // Flush, finish the header, join
+
+// Append one LD/ST to the trace
+static inline void trace_access(struct trace_writer_t * t, unsigned int pc, int is_store, unsigned char address, int hit)
+{
+	unsigned char flags = (unsigned char) ((is_store ? TRACE_STORE : 0) | (hit ? TRACE_HIT : 0));
+	unsigned char * p;
+
+	if(t->length + TRACE_MAX_RECORD > TRACE_BLOCK_SIZE) {
+		trace_flush_block(t);
+	}
+	p = t->buffer + t->length;
+	if(t->compressed) {
+		int32_t delta = (int32_t) (pc - t->last_pc);
+		uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+
+		while(zigzag >= 0x80) {
+			*p++ = (unsigned char) (zigzag | 0x80);
+			zigzag >>= 7;
+		}
+		*p++ = (unsigned char) zigzag;
+		*p++ = flags;
+		*p++ = address;
+		t->length = p - t->buffer;
+		t->last_pc = pc;
+	} else {
+		struct trace_record_t * record = (struct trace_record_t *) p;
+
+		record->pc = pc;
+		record->flags = flags;
+		record->address = address;
+		record->reserved = 0;
+		t->length += sizeof(*record);
+	}
+	++t->count_records;
+}
+
+#endif